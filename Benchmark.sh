@@ -0,0 +1,112 @@
+#!/bin/sh
+
+# Measure how long Cakelisp takes to build a generated project, to catch performance regressions
+#
+# Usage: ./Benchmark.sh [options] [-- GenerateProject.sh options]
+#   -o <file>     Where to write results (default cakelisp_cache/benchmark/results.json)
+#   -b <file>     Compare against baseline results from a previous run
+#   -t <percent>  How much slower than the baseline counts as a regression (default 10)
+#
+# Example: measure a large project, then compare against it after making changes:
+#   ./Benchmark.sh -o baseline.json -- -n 100 -m 20
+#   ./Benchmark.sh -b baseline.json -- -n 100 -m 20
+#
+# Each scenario writes one JSON object per line to the results file:
+#   {"scenario":"clean","wall_ms":1234,"peak_rss_kb":5678,"phases_us":{"Evaluate":91011, ...}}
+# Scenarios are a clean build, a build with nothing to do, and a build after changing one file.
+# Exits with an error if any scenario regressed past the threshold
+
+WORK_DIR=cakelisp_cache/benchmark
+RESULTS_FILE=$WORK_DIR/results.json
+BASELINE_FILE=
+THRESHOLD_PERCENT=10
+
+while getopts "o:b:t:" option; do
+	case $option in
+		o) RESULTS_FILE=$OPTARG ;;
+		b) BASELINE_FILE=$OPTARG ;;
+		t) THRESHOLD_PERCENT=$OPTARG ;;
+		*) echo "Unrecognized option. See the top of $0 for usage"; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+CAKELISP=$(pwd)/bin/cakelisp
+if ! test -f "$CAKELISP"; then
+	echo "$CAKELISP does not exist. Run ./Build.sh first"
+	exit 1
+fi
+
+PROJECT_DIR=$WORK_DIR/project
+rm -rf "$PROJECT_DIR"
+test/Benchmark/GenerateProject.sh "$@" "$PROJECT_DIR" || exit $?
+
+mkdir -p "$(dirname "$RESULTS_FILE")"
+: > "$RESULTS_FILE"
+
+run_scenario() {
+	scenario=$1
+	log=$WORK_DIR/$scenario.log
+	trace=$WORK_DIR/$scenario.trace.json
+
+	start=$(date +%s%N)
+	(cd "$PROJECT_DIR" && "$CAKELISP" --verbose-performance --trace "../$scenario.trace.json" \
+										Main.cake) > "$log" 2>&1
+	status=$?
+	end=$(date +%s%N)
+	if test $status -ne 0; then
+		echo "$scenario: build failed. See $log"
+		exit 1
+	fi
+
+	wall_ms=$(((end - start) / 1000000))
+	peak_rss_kb=$(sed -n 's/^Peak memory usage: \([0-9]*\) KB.*/\1/p' "$log")
+	# Trace events are one per line, so the phases can be picked out without a JSON parser
+	phases=$(grep '"cat":"phase"' "$trace" |
+				 sed -n 's/.*"dur":\([0-9]*\),.*"name":"\([^"]*\)".*/"\2":\1/p' |
+				 paste -sd, -)
+
+	echo "{\"scenario\":\"$scenario\",\"wall_ms\":$wall_ms,\"peak_rss_kb\":${peak_rss_kb:-0},\"phases_us\":{$phases}}" >> "$RESULTS_FILE"
+	echo "$scenario: $wall_ms ms, peak memory ${peak_rss_kb:-?} KB"
+}
+
+rm -rf "$PROJECT_DIR/cakelisp_cache" "$PROJECT_DIR/a.out"
+run_scenario clean
+
+run_scenario no-op
+
+# Change what one function returns, so exactly one module needs to be rebuilt. Modification times
+# have one second resolution, so make sure the change doesn't land in the same second as the build
+sleep 1
+sed "s/(return [0-9]*)) ;; edit-point/(return $(date +%s))) ;; edit-point/" \
+	"$PROJECT_DIR/Module0.cake" > "$PROJECT_DIR/Module0.cake.edited" &&
+	mv "$PROJECT_DIR/Module0.cake.edited" "$PROJECT_DIR/Module0.cake" || exit $?
+run_scenario one-file-changed
+
+echo "Wrote results to $RESULTS_FILE"
+
+if test -z "$BASELINE_FILE"; then
+	exit 0
+fi
+
+regressed=0
+for scenario in clean no-op one-file-changed; do
+	baseline_ms=$(grep "\"scenario\":\"$scenario\"" "$BASELINE_FILE" |
+					  sed -n 's/.*"wall_ms":\([0-9]*\).*/\1/p')
+	current_ms=$(grep "\"scenario\":\"$scenario\"" "$RESULTS_FILE" |
+					 sed -n 's/.*"wall_ms":\([0-9]*\).*/\1/p')
+	if test -z "$baseline_ms" || test "$baseline_ms" -eq 0; then
+		echo "$scenario: no baseline"
+		continue
+	fi
+
+	change_percent=$(((current_ms - baseline_ms) * 100 / baseline_ms))
+	if test $change_percent -gt "$THRESHOLD_PERCENT"; then
+		echo "$scenario: REGRESSED $change_percent% ($baseline_ms ms -> $current_ms ms)"
+		regressed=1
+	else
+		echo "$scenario: $change_percent% ($baseline_ms ms -> $current_ms ms)"
+	fi
+done
+
+exit $regressed
@@ -28,11 +28,13 @@ else
 		src/DynamicLoader.cpp \
 		src/ModuleManager.cpp \
 		src/Logging.cpp \
+		src/Tracing.cpp \
+		src/Interpreter.cpp \
 		src/Main.cpp \
 		-DUNIX || exit $?
 	# Need -ldl for dynamic loading, --export-dynamic to let compile-time functions resolve to
-	# Cakelisp symbols
-	$LINK -o $CAKELISP_BOOTSTRAP_BIN *.o -ldl -Wl,--export-dynamic || exit $?
+	# Cakelisp symbols, -lpthread for writing outputs in parallel
+	$LINK -o $CAKELISP_BOOTSTRAP_BIN *.o -ldl -lpthread -Wl,--export-dynamic || exit $?
 	rm *.o
 	echo "Built $CAKELISP_BOOTSTRAP_BIN successfully. Now building with Cakelisp"
 	$CAKELISP_BOOTSTRAP_BIN Bootstrap.cake || exit $?
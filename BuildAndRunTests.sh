@@ -19,6 +19,45 @@
 # ./bin/cakelisp --verbose-build-process \
 						  # runtime/HotReloadingCodeModifier.cake runtime/TextAdventure.cake || exit $?
 
+# Executables linking a library from the same run must relink when only the library changes
+./bin/cakelisp test/BuildTargets.cake > /dev/null || exit $?
+cp test/BuildTargetsGreeting.cake test/BuildTargetsGreeting.cake.original
+# Modification times are only compared to the second
+sleep 1
+sed 's/Hello, /Goodbye, /' test/BuildTargetsGreeting.cake.original > test/BuildTargetsGreeting.cake
+./bin/cakelisp test/BuildTargets.cake > /dev/null
+buildStatus=$?
+mv test/BuildTargetsGreeting.cake.original test/BuildTargetsGreeting.cake
+[ $buildStatus -eq 0 ] || exit $buildStatus
+if ! ./test/BuildTargetsAppStatic | grep -q Goodbye; then
+	echo "error: test/BuildTargetsAppStatic wasn't relinked after its library changed"
+	exit 1
+fi
+
+# One evaluation builds every configuration, each into its own directory with its own options
+./bin/cakelisp --configs Debug,Release test/BuildConfigurations.cake > /dev/null || exit $?
+if ! ./test/Debug/BuildConfigurationsApp | grep -q "Hello from Debug" ||
+	! ./test/Release/BuildConfigurationsApp | grep -q "Hello from Release"; then
+	echo "error: test/BuildConfigurations.cake configurations weren't built with their own options"
+	exit 1
+fi
+
+# Saved pure macro expansions must be thrown away when compile-time code the macro calls changes
+pureMacroTest=test/PureMacroDependencies.cake
+./bin/cakelisp --cache-macro-expansions --execute $pureMacroTest > /dev/null 2>&1 || exit $?
+cp $pureMacroTest $pureMacroTest.original
+# Compile-time libraries are also only rebuilt if their source is at least a second newer
+sleep 1
+sed 's/"Hello"/"Goodbye"/' $pureMacroTest.original > $pureMacroTest
+pureMacroOutput=$(./bin/cakelisp --cache-macro-expansions --execute $pureMacroTest 2>&1)
+buildStatus=$?
+mv $pureMacroTest.original $pureMacroTest
+[ $buildStatus -eq 0 ] || exit $buildStatus
+if ! echo "$pureMacroOutput" | grep -q "Goodbye, pure macros"; then
+	echo "error: $pureMacroTest used an expansion saved before its dependency changed"
+	exit 1
+fi
+
 # TestMain is the loader. It doesn't care at all about fancy hot reloading macros, it just loads libs
 ./bin/cakelisp --verbose-processes --verbose-include-scanning \
 						  runtime/HotLoader.cake  || exit $?
@@ -8,9 +8,16 @@
 #include <stdio.h>
 #include <string.h>
 
-void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* bufferOut,
-                               int bufferOutSize, const Token& token)
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Returns false if any error was reported during conversion
+static bool lispNameStyleToCNameStyleInternal(NameStyleMode mode, const char* name,
+                                              char* bufferOut, int bufferOutSize,
+                                              const Token& token)
 {
+	bool hadError = false;
 	bool upcaseNextCharacter = false;
 	bool isPlural = false;
 	bool requiredSymbolConversion = false;
@@ -26,7 +33,7 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 				case NameStyleMode_Underscores:
 					if (!writeCharToBufferErrorToken('_', &bufferWrite, bufferOut, bufferOutSize,
 					                                 token))
-						return;
+						return false;
 					break;
 				case NameStyleMode_CamelCase:
 					upcaseNextCharacter = true;
@@ -42,6 +49,7 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 					ErrorAtToken(token,
 					             "lispNameStyleToCNameStyle() encountered unrecognized separator "
 					             "mode\n");
+					hadError = true;
 					break;
 			}
 		}
@@ -51,21 +59,24 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 			if ((c == name && *c + 1 == ':') || (*(c + 1) == ':' || *(c - 1) == ':'))
 			{
 				if (!writeCharToBufferErrorToken(*c, &bufferWrite, bufferOut, bufferOutSize, token))
-					return;
+					return false;
 			}
 			else
 			{
 				if (c == name)
+				{
 					ErrorAtToken(
 					    token,
 					    "lispNameStyleToCNameStyle() received name starting with : which "
 					    "wasn't a C++-style :: scope resolution operator; is a generator wrongly "
 					    "interpreting a special symbol?\n");
+					hadError = true;
+				}
 
 				requiredSymbolConversion = true;
 				if (!writeStringToBufferErrorToken("Colon", &bufferWrite, bufferOut, bufferOutSize,
 				                                   token))
-					return;
+					return false;
 			}
 		}
 		else if (isalnum(*c) || *c == '_')
@@ -74,12 +85,12 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 			{
 				if (!writeCharToBufferErrorToken(toupper(*c), &bufferWrite, bufferOut,
 				                                 bufferOutSize, token))
-					return;
+					return false;
 			}
 			else
 			{
 				if (!writeCharToBufferErrorToken(*c, &bufferWrite, bufferOut, bufferOutSize, token))
-					return;
+					return false;
 			}
 
 			upcaseNextCharacter = false;
@@ -94,33 +105,33 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 				case '+':
 					if (!writeStringToBufferErrorToken("Add", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '-':
 					if (!writeStringToBufferErrorToken("Sub", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '*':
 					if (!writeStringToBufferErrorToken("Mul", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '/':
 					if (!writeStringToBufferErrorToken("Div", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '%':
 					if (!writeStringToBufferErrorToken("Mod", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '.':
 					// TODO: Decide how to handle object pathing
 					if (!writeStringToBufferErrorToken(".", &bufferWrite, bufferOut, bufferOutSize,
 					                                   token))
-						return;
+						return false;
 					break;
 				default:
 					ErrorAtTokenf(
@@ -129,9 +140,10 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 					    "'%c' which has no conversion equivalent. It will be replaced with "
 					    "'BadChar'",
 					    name, *c);
+					hadError = true;
 					if (!writeStringToBufferErrorToken("BadChar", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 			}
 		}
@@ -153,4 +165,52 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 		bufferOut[0] = tolower(bufferOut[0]);
 
 	*bufferWrite = '\0';
+	return !hadError;
+}
+
+void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* bufferOut,
+                               int bufferOutSize, const Token& token)
+{
+	lispNameStyleToCNameStyleInternal(mode, name, bufferOut, bufferOutSize, token);
+}
+
+// Names are converted once per mode, then looked up. Converted strings are never modified or
+// removed, so pointers to them stay valid for as long as the thread which looked them up
+typedef std::unordered_map<std::string, std::string> ConvertedNameTable;
+// The writer converts names from multiple threads. Each thread looks in its own table first so that
+// the common case, a name the thread has already seen, never takes a lock. The shared table lets
+// threads reuse each other's conversions, and is only consulted when the thread's own table misses
+static thread_local ConvertedNameTable s_threadConvertedNames[NameStyleMode_PascalCaseIfLispy + 1];
+static ConvertedNameTable s_sharedConvertedNames[NameStyleMode_PascalCaseIfLispy + 1];
+static std::mutex s_sharedConvertedNamesMutex;
+
+const char* lispNameStyleToCNameStyleCached(NameStyleMode mode, const std::string& name,
+                                            char* fallbackBufferOut, int fallbackBufferOutSize,
+                                            const Token& token)
+{
+	ConvertedNameTable& threadConvertedNames = s_threadConvertedNames[mode];
+	ConvertedNameTable::iterator findIt = threadConvertedNames.find(name);
+	if (findIt != threadConvertedNames.end())
+		return findIt->second.c_str();
+
+	{
+		std::lock_guard<std::mutex> lock(s_sharedConvertedNamesMutex);
+		ConvertedNameTable& sharedConvertedNames = s_sharedConvertedNames[mode];
+		ConvertedNameTable::iterator sharedFindIt = sharedConvertedNames.find(name);
+		if (sharedFindIt != sharedConvertedNames.end())
+			return threadConvertedNames.emplace(name, sharedFindIt->second)
+			    .first->second.c_str();
+	}
+
+	// Don't cache names which had errors, so that every use of them gets reported
+	if (!lispNameStyleToCNameStyleInternal(mode, name.c_str(), fallbackBufferOut,
+	                                       fallbackBufferOutSize, token))
+		return fallbackBufferOut;
+
+	{
+		std::lock_guard<std::mutex> lock(s_sharedConvertedNamesMutex);
+		// If another thread beat us to it, the existing entry is kept (and is identical)
+		s_sharedConvertedNames[mode].emplace(name, fallbackBufferOut);
+	}
+	return threadConvertedNames.emplace(name, fallbackBufferOut).first->second.c_str();
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #include "ConverterEnums.hpp"
 
 struct Token;
@@ -28,3 +30,11 @@ struct NameStyleSettings
 // generated (so long as your non-'-' strings match the other C/C++ names)
 void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* bufferOut,
                                int bufferOutSize, const Token& token);
+
+// Same as lispNameStyleToCNameStyle(), but remembers the result so each distinct name is only
+// converted once per mode. Returns either the cached name or fallbackBufferOut, which is used as
+// scratch space for the conversion (and is the result when conversion reported errors). Cached
+// names belong to the calling thread, so don't hand the result to other threads
+const char* lispNameStyleToCNameStyleCached(NameStyleMode mode, const std::string& name,
+                                            char* fallbackBufferOut, int fallbackBufferOutSize,
+                                            const Token& token);
@@ -1,5 +1,7 @@
 #include "DynamicLoader.hpp"
 
+#include "Tracing.hpp"
+
 #include <stdio.h>
 
 #include <string>
@@ -24,6 +26,8 @@ static DynamicLibraryMap dynamicLibraries;
 
 DynamicLibHandle loadDynamicLibrary(const char* libraryPath)
 {
+	TraceScope loadScope("load", libraryPath);
+
 	void* libHandle = nullptr;
 
 #ifdef UNIX
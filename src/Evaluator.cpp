@@ -5,10 +5,12 @@
 #include "FileUtilities.hpp"
 #include "GeneratorHelpers.hpp"
 #include "Generators.hpp"
+#include "Interpreter.hpp"
 #include "Logging.hpp"
 #include "OutputPreambles.hpp"
 #include "RunProcess.hpp"
 #include "Tokenizer.hpp"
+#include "Tracing.hpp"
 #include "Utilities.hpp"
 #include "Writer.hpp"
 
@@ -16,6 +18,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>
+
 //
 // Environment
 //
@@ -26,6 +31,8 @@ const char* cakelispWorkingDir = "cakelisp_cache";
 const char* g_environmentPreLinkHookSignature =
     "('manager (& ModuleManager) 'link-command (& ProcessCommand) 'link-time-inputs (* "
     "ProcessCommandInput) 'num-link-time-inputs int &return bool)";
+const char* g_environmentPostBuildProcessHookSignature =
+    "('manager (& ModuleManager) 'result (& (const ProcessResult)) &return bool)";
 const char* g_environmentPostReferencesResolvedHookSignature =
     "('environment (& EvaluatorEnvironment) 'was-code-modified (& bool) &return bool)";
 
@@ -47,6 +54,116 @@ static MacroFunc findMacro(EvaluatorEnvironment& environment, const char* functi
 	return nullptr;
 }
 
+// Interpreted macros are only found once they would have been loaded if they were compiled
+static InterpretedMacro* findInterpretedMacro(EvaluatorEnvironment& environment,
+                                              const char* macroName)
+{
+	if (!environment.useInterpreter)
+		return nullptr;
+	InterpretedMacroTableIterator findIt = environment.interpretedMacros.find(macroName);
+	if (findIt != environment.interpretedMacros.end() && findIt->second->isLoaded)
+		return findIt->second;
+	return nullptr;
+}
+
+// Hashes the types and contents of [startTokenIndex, endTokenIndex), leaving out positions
+static uint32_t hashTokenContents(const std::vector<Token>& tokens, int startTokenIndex,
+                                  int endTokenIndex)
+{
+	uint32_t hash = 0;
+	for (int i = startTokenIndex; i < endTokenIndex; ++i)
+	{
+		unsigned char type = (unsigned char)tokens[i].type;
+		crc32(&type, sizeof(type), &hash);
+		crc32(tokens[i].contents.c_str(), tokens[i].contents.size() + 1, &hash);
+	}
+	return hash;
+}
+
+static const PureMacroExpansion* findPureMacroExpansion(PureMacroExpansionCache& cache,
+                                                        uint32_t argumentsHash,
+                                                        const std::vector<Token>& tokens,
+                                                        int invocationStartIndex,
+                                                        int endInvocationIndex)
+{
+	int numTokens = endInvocationIndex - invocationStartIndex;
+	std::pair<PureMacroExpansionCacheIterator, PureMacroExpansionCacheIterator> candidates =
+	    cache.equal_range(argumentsHash);
+	for (PureMacroExpansionCacheIterator it = candidates.first; it != candidates.second; ++it)
+	{
+		const PureMacroExpansion& expansion = it->second;
+		const std::vector<Token>& cachedTokens = *expansion.invocationTokens;
+		if (FindCloseParenTokenIndex(cachedTokens, expansion.invocationStartIndex) -
+		        expansion.invocationStartIndex !=
+		    numTokens)
+			continue;
+
+		bool isMatch = true;
+		for (int i = 2; i < numTokens; ++i)
+		{
+			const Token& a = tokens[invocationStartIndex + i];
+			const Token& b = cachedTokens[expansion.invocationStartIndex + i];
+			if (a.type != b.type || a.contents != b.contents)
+			{
+				isMatch = false;
+				break;
+			}
+		}
+		if (isMatch)
+			return &expansion;
+	}
+	return nullptr;
+}
+
+// Tokens copied from the arguments keep the position of the argument, which lets us find where they
+// came from. Everything else came from the macro itself
+static void addPureMacroExpansion(PureMacroExpansionCache& cache, uint32_t argumentsHash,
+                                  const std::vector<Token>& tokens, int invocationStartIndex,
+                                  int endInvocationIndex, const std::vector<Token>& expansion)
+{
+	PureMacroExpansion newExpansion = {};
+	newExpansion.invocationTokens = &tokens;
+	newExpansion.invocationStartIndex = invocationStartIndex;
+	newExpansion.expansion = &expansion;
+	newExpansion.invocationOffsets.resize(expansion.size(), -1);
+	for (size_t expansionIndex = 0; expansionIndex < expansion.size(); ++expansionIndex)
+	{
+		const Token& expansionToken = expansion[expansionIndex];
+		for (int i = invocationStartIndex + 2; i < endInvocationIndex; ++i)
+		{
+			const Token& argumentToken = tokens[i];
+			if (argumentToken.source == expansionToken.source &&
+			    argumentToken.lineNumber == expansionToken.lineNumber &&
+			    argumentToken.columnStart == expansionToken.columnStart &&
+			    argumentToken.type == expansionToken.type &&
+			    argumentToken.contents == expansionToken.contents)
+			{
+				newExpansion.invocationOffsets[expansionIndex] = i - invocationStartIndex;
+				break;
+			}
+		}
+	}
+	cache.insert({argumentsHash, std::move(newExpansion)});
+}
+
+static void copyPureMacroExpansion(const PureMacroExpansion& cachedExpansion,
+                                   const std::vector<Token>& tokens, int invocationStartIndex,
+                                   std::vector<Token>& output)
+{
+	output = *cachedExpansion.expansion;
+	for (size_t i = 0; i < output.size(); ++i)
+	{
+		int invocationOffset = cachedExpansion.invocationOffsets[i];
+		if (invocationOffset == -1)
+			continue;
+		const Token& argumentToken = tokens[invocationStartIndex + invocationOffset];
+		output[i].source = argumentToken.source;
+		output[i].lineNumber = argumentToken.lineNumber;
+		output[i].columnStart = argumentToken.columnStart;
+		output[i].columnEnd = argumentToken.columnEnd;
+	}
+}
+
 void* findCompileTimeFunction(EvaluatorEnvironment& environment, const char* functionName)
 {
 	CompileTimeFunctionTableIterator findIt =
@@ -62,7 +179,8 @@ static bool isCompileTimeCodeLoaded(EvaluatorEnvironment& environment,
 	switch (definition.type)
 	{
 		case ObjectType_CompileTimeMacro:
-			return findMacro(environment, definition.name.c_str()) != nullptr;
+			return findMacro(environment, definition.name.c_str()) != nullptr ||
+			       findInterpretedMacro(environment, definition.name.c_str()) != nullptr;
 		case ObjectType_CompileTimeGenerator:
 			return findGenerator(environment, definition.name.c_str()) != nullptr;
 		case ObjectType_CompileTimeFunction:
@@ -195,6 +313,103 @@ bool isCompileTimeObject(ObjectType type)
 	       type == ObjectType_CompileTimeFunction;
 }
 
+// Hashes the types and contents of the definition's invocation, leaving out positions
+static uint32_t hashDefinitionTokens(const ObjectDefinition& definition)
+{
+	uint32_t hash = 0;
+	int depth = 0;
+	for (const Token* token = definition.definitionInvocation;; ++token)
+	{
+		unsigned char type = (unsigned char)token->type;
+		crc32(&type, sizeof(type), &hash);
+		crc32(token->contents.c_str(), token->contents.size() + 1, &hash);
+		if (token->type == TokenType_OpenParen)
+			++depth;
+		else if (token->type == TokenType_CloseParen)
+			--depth;
+		if (depth == 0)
+			break;
+	}
+	return hash;
+}
+
+// Saved expansions are only reused if neither the defmacro nor any of the compile-time functions,
+// macros, and generators it depends on have changed. A library's CRC can't be used instead because
+// saved expansions are reused before the macro is built. Returns false if a dependency isn't
+// defined, which may just mean it hasn't been evaluated yet
+static bool hashPureMacroDependencies(EvaluatorEnvironment& environment, const PureMacro& pureMacro,
+                                      const std::vector<std::string>& dependencies,
+                                      uint32_t* hashOut)
+{
+	uint32_t hash = pureMacro.definitionHash;
+	for (const std::string& dependency : dependencies)
+	{
+		ObjectDefinitionMap::iterator findIt = environment.definitions.find(dependency);
+		if (findIt == environment.definitions.end() ||
+		    !isCompileTimeObject(findIt->second.type))
+			return false;
+
+		uint32_t dependencyHash = hashDefinitionTokens(findIt->second);
+		crc32(dependency.c_str(), dependency.size() + 1, &hash);
+		crc32(&dependencyHash, sizeof(dependencyHash), &hash);
+	}
+	*hashOut = hash;
+	return true;
+}
+
+// Moves the expansions previous runs saved into the macro's cache, unless they're out of date. See
+// --cache-macro-expansions
+static void claimSavedMacroExpansions(EvaluatorEnvironment& environment,
+                                      const std::string& macroName, PureMacro& pureMacro,
+                                      const std::vector<Token>& tokens, int invocationStartIndex,
+                                      int endInvocationIndex)
+{
+	SavedMacroExpansionTableIterator findIt = environment.savedMacroExpansions.find(macroName);
+	if (findIt == environment.savedMacroExpansions.end())
+	{
+		pureMacro.savedExpansionsClaimed = true;
+		return;
+	}
+
+	// Try again on the next invocation, once more has been evaluated
+	uint32_t definitionHash = 0;
+	if (!hashPureMacroDependencies(environment, pureMacro, findIt->second.dependencies,
+	                               &definitionHash))
+		return;
+
+	for (SavedMacroExpansion& saved : findIt->second.expansions)
+	{
+		// The macro or something it depends on has changed since this was expanded
+		if (saved.definitionHash != definitionHash)
+		{
+			environment.macroExpansionCacheModified = true;
+			continue;
+		}
+
+		// Rebuild an invocation for later invocations to compare their arguments against. Token
+		// lists must outlive the expansions which point to them, so the environment owns them
+		std::vector<Token>* invocation = new std::vector<Token>();
+		invocation->reserve(saved.arguments.size() + 3);
+		invocation->push_back(tokens[invocationStartIndex]);
+		invocation->push_back(tokens[invocationStartIndex + 1]);
+		invocation->insert(invocation->end(), saved.arguments.begin(), saved.arguments.end());
+		invocation->push_back(tokens[endInvocationIndex]);
+		environment.comptimeTokens.push_back(invocation);
+
+		std::vector<Token>* expansion = new std::vector<Token>(std::move(saved.expansion));
+		environment.comptimeTokens.push_back(expansion);
+
+		PureMacroExpansion newExpansion = {};
+		newExpansion.invocationTokens = invocation;
+		newExpansion.invocationStartIndex = 0;
+		newExpansion.expansion = expansion;
+		newExpansion.invocationOffsets = std::move(saved.invocationOffsets);
+		pureMacro.expansions.insert({saved.argumentsHash, std::move(newExpansion)});
+	}
+	environment.savedMacroExpansions.erase(findIt);
+	pureMacro.savedExpansionsClaimed = true;
+}
+
 bool CreateCompileTimeVariable(EvaluatorEnvironment& environment, const char* name,
                                const char* typeExpression, void* data,
                                const char* destroyCompileTimeFuncName)
@@ -247,6 +462,74 @@ bool GetCompileTimeVariable(EvaluatorEnvironment& environment, const char* name,
 // Evaluator
 //
 
+static unsigned long long getProfileMicroseconds()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+	           std::chrono::steady_clock::now().time_since_epoch())
+	    .count();
+}
+
+// Accounts for a single macro or generator invocation from construction to the end of scope
+struct InvocationProfileScope
+{
+	EvaluatorEnvironment& environment;
+	InvocationProfile* profile;
+	unsigned long numEmitted;
+
+	InvocationProfileScope(EvaluatorEnvironment& environment, const std::string& name,
+	                       bool isMacro, bool isCacheHit)
+	    : environment(environment), profile(nullptr), numEmitted(0)
+	{
+		if (!environment.profileInvocations)
+			return;
+
+		profile = &environment.invocationProfiles[name];
+		profile->isMacro = isMacro;
+		if (isCacheHit)
+			++profile->numCacheHits;
+		else
+			++profile->numInvocations;
+		++profile->numActiveInvocations;
+		environment.invocationProfileStack.push_back({profile, getProfileMicroseconds(), 0});
+	}
+
+	~InvocationProfileScope()
+	{
+		if (!profile)
+			return;
+
+		InvocationProfileFrame frame = environment.invocationProfileStack.back();
+		environment.invocationProfileStack.pop_back();
+
+		unsigned long long elapsed = getProfileMicroseconds() - frame.startMicroseconds;
+		// Don't count time twice when a macro expands to more invocations of itself
+		if (--profile->numActiveInvocations == 0)
+			profile->inclusiveMicroseconds += elapsed;
+		profile->exclusiveMicroseconds += elapsed - frame.childMicroseconds;
+		profile->numEmitted += numEmitted;
+
+		if (!environment.invocationProfileStack.empty())
+			environment.invocationProfileStack.back().childMicroseconds += elapsed;
+	}
+};
+
+static unsigned long countGeneratorOutputs(const GeneratorOutput& output)
+{
+	return output.source.size() + output.header.size();
+}
+
+static void countCompileTimeInvocation(EvaluatorEnvironment& environment, void* function)
+{
+	if (environment.compileTimeOptimizeThreshold <= 0 ||
+	    environment.loadedCompileTimeDefinitions.empty())
+		return;
+
+	CompileTimeFunctionDefinitionTableIterator findIt =
+	    environment.loadedCompileTimeDefinitions.find(function);
+	if (findIt != environment.loadedCompileTimeDefinitions.end())
+		++findIt->second->numInvocations;
+}
+
 // Dispatch to a generator or expand a macro and evaluate its output recursively. If the reference
 // is unknown, add it to a list so EvaluateResolveReferences() can come back and decide what to do
 // with it. Only EvaluateResolveReferences() decides whether to create a C/C++ invocation
@@ -260,8 +543,40 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 		return false;
 
 	MacroFunc invokedMacro = findMacro(environment, invocationName.contents.c_str());
-	if (invokedMacro)
+	// Compiled macros take precedence, in case one was built before the interpreter could be used
+	const InterpretedMacro* interpretedMacro =
+	    invokedMacro ? nullptr : findInterpretedMacro(environment, invocationName.contents.c_str());
+
+	// Pure macros only need to be run once for each unique set of arguments. Expansions saved by
+	// previous runs can be used before the macro is loaded, so it may not need to be built at all
+	PureMacroExpansionCache* pureExpansions = nullptr;
+	const PureMacroExpansion* cachedExpansion = nullptr;
+	uint32_t argumentsHash = 0;
+	int endInvocationIndex = 0;
+	if (!environment.pureMacros.empty())
 	{
+		PureMacroTableIterator findPureIt = environment.pureMacros.find(invocationName.contents);
+		if (findPureIt != environment.pureMacros.end())
+		{
+			PureMacro& pureMacro = findPureIt->second;
+			pureExpansions = &pureMacro.expansions;
+			endInvocationIndex = FindCloseParenTokenIndex(tokens, invocationStartIndex);
+			if (!pureMacro.savedExpansionsClaimed)
+				claimSavedMacroExpansions(environment, findPureIt->first, pureMacro, tokens,
+				                          invocationStartIndex, endInvocationIndex);
+			argumentsHash = hashTokenContents(tokens, invocationStartIndex + 2, endInvocationIndex);
+			cachedExpansion = findPureMacroExpansion(*pureExpansions, argumentsHash, tokens,
+			                                         invocationStartIndex, endInvocationIndex);
+		}
+	}
+
+	if (invokedMacro || interpretedMacro || cachedExpansion)
+	{
+		// Covers both expanding and evaluating the expansion
+		InvocationProfileScope profileScope(environment, invocationName.contents,
+		                                    /*isMacro=*/true,
+		                                    /*isCacheHit=*/cachedExpansion != nullptr);
+
 		// We must use a separate vector for each macro because Token lists must be immutable. If
 		// they weren't, pointers to tokens would be invalidated
 		const std::vector<Token>* macroOutputTokens = nullptr;
@@ -270,12 +585,33 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 			// Do NOT modify token lists after they are created. You can change the token contents
 			std::vector<Token>* macroOutputTokensNoConst_CREATIONONLY = new std::vector<Token>();
 
-			// Have the macro generate some code for us!
-			macroSucceeded = invokedMacro(environment, context, tokens, invocationStartIndex,
-			                              *macroOutputTokensNoConst_CREATIONONLY);
+			if (cachedExpansion)
+			{
+				copyPureMacroExpansion(*cachedExpansion, tokens, invocationStartIndex,
+				                       *macroOutputTokensNoConst_CREATIONONLY);
+				macroSucceeded = true;
+			}
+			else
+			{
+				if (invokedMacro)
+					countCompileTimeInvocation(environment, (void*)invokedMacro);
+
+				// Have the macro generate some code for us!
+				TraceScope macroScope("macro", invocationName.contents.c_str(),
+				                      invocationName.source);
+				if (invokedMacro)
+					macroSucceeded = invokedMacro(environment, context, tokens,
+					                              invocationStartIndex,
+					                              *macroOutputTokensNoConst_CREATIONONLY);
+				else
+					macroSucceeded = interpreterRunMacro(*interpretedMacro, environment, context,
+					                                     tokens, invocationStartIndex,
+					                                     *macroOutputTokensNoConst_CREATIONONLY);
+			}
 
 			// Make it const to save any temptation of modifying the list and breaking everything
 			macroOutputTokens = macroOutputTokensNoConst_CREATIONONLY;
+			profileScope.numEmitted = macroOutputTokens->size();
 		}
 
 		// Don't even try to validate the code if the macro wasn't satisfied
@@ -321,6 +657,13 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 		// It's also necessary for error reporting
 		environment.comptimeTokens.push_back(macroOutputTokens);
 
+		if (pureExpansions && !cachedExpansion)
+		{
+			addPureMacroExpansion(*pureExpansions, argumentsHash, tokens, invocationStartIndex,
+			                      endInvocationIndex, *macroOutputTokens);
+			environment.macroExpansionCacheModified = true;
+		}
+
 		// Let the definition know about the expansion so it is easy to construct an expanded list
 		// of all tokens in the definition
 		if (context.definitionName)
@@ -359,8 +702,19 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 	{
 		environment.lastGeneratorReferences[invocationName.contents.c_str()] =
 		    &tokens[invocationStartIndex];
-
-		return invokedGenerator(environment, context, tokens, invocationStartIndex, output);
+		countCompileTimeInvocation(environment, (void*)invokedGenerator);
+
+		TraceScope generatorScope("generator", invocationName.contents.c_str(),
+		                          invocationName.source);
+		InvocationProfileScope profileScope(environment, invocationName.contents,
+		                                    /*isMacro=*/false, /*isCacheHit=*/false);
+		unsigned long numOutputsBefore =
+		    environment.profileInvocations ? countGeneratorOutputs(output) : 0;
+		bool result =
+		    invokedGenerator(environment, context, tokens, invocationStartIndex, output);
+		if (environment.profileInvocations)
+			profileScope.numEmitted = countGeneratorOutputs(output) - numOutputsBefore;
+		return result;
 	}
 
 	// Check for known Cakelisp functions
@@ -590,6 +944,16 @@ bool ReplaceAndEvaluateDefinition(EvaluatorEnvironment& environment,
 	// its own output. Have the environment hold on to it for later destruction
 	environment.orphanedOutputs.push_back(definitionOutput);
 
+	for (CompileTimeFunctionDefinitionTableIterator it =
+	         environment.loadedCompileTimeDefinitions.begin();
+	     it != environment.loadedCompileTimeDefinitions.end();)
+	{
+		if (it->second == &findIt->second)
+			it = environment.loadedCompileTimeDefinitions.erase(it);
+		else
+			++it;
+	}
+
 	// This makes me nervous because the user could have a reference to this when calling this
 	// function. I can't think of a safer way to get rid of the reference without deleting it
 	environment.definitions.erase(findIt);
@@ -684,12 +1048,14 @@ static void PropagateRequiredToReferences(EvaluatorEnvironment& environment)
 
 static void OnCompileProcessOutput(const char* output)
 {
-	// TODO C/C++ error to Cakelisp token mapper
+	printCakelispLocationsForCompilerOutput(output);
 }
 
 enum BuildStage
 {
 	BuildStage_None,
+	// Interpreted macros skip compiling, linking, and loading
+	BuildStage_Interpreting,
 	BuildStage_Compiling,
 	BuildStage_Linking,
 	BuildStage_Loading,
@@ -710,8 +1076,158 @@ struct BuildObject
 	std::string dynamicLibraryPath;
 	std::string buildObjectName;
 	ObjectDefinition* definition = nullptr;
+	InterpretedMacro* interpretedMacro = nullptr;
 };
 
+// Various stages will append the appropriate file extension
+static std::string getCompileTimeArtifactsName(const ObjectDefinition& definition)
+{
+	char convertedNameBuffer[MAX_NAME_LENGTH] = {0};
+	const char* convertedName = lispNameStyleToCNameStyleCached(
+	    NameStyleMode_Underscores, definition.name, convertedNameBuffer,
+	    sizeof(convertedNameBuffer), *definition.definitionInvocation);
+	char artifactsName[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(artifactsName, "comptime_%s", convertedName);
+	return artifactsName;
+}
+
+static std::string getCakelispHeadersInclude(EvaluatorEnvironment& environment)
+{
+	if (environment.cakelispSrcDir.empty())
+		return "-Isrc/";
+	return "-I" + environment.cakelispSrcDir;
+}
+
+// When piping compile-time source, nothing refers to the generated file by name, so the source
+// must find its includes in the cache directory some other way. Points to storage in the strings
+static void getCompileTimeSourceInputs(EvaluatorEnvironment& environment,
+                                       const char* sourceOutputName, std::string& cacheInclude,
+                                       std::vector<const char*>& inputsOut)
+{
+	if (!environment.pipeCompileTimeSource)
+	{
+		inputsOut.push_back(sourceOutputName);
+		return;
+	}
+
+	cacheInclude = "-I";
+	cacheInclude += cakelispWorkingDir;
+	inputsOut.push_back(cacheInclude.c_str());
+	inputsOut.push_back("-x");
+	inputsOut.push_back("c++");
+	inputsOut.push_back("-");
+}
+
+// Piped source is never on disk, so its CRC is written to sourceOutputName.crc instead. It is only
+// written when the source changes, so its modification time can be compared with the library's
+// just like the source's would be
+static bool writeCompileTimeSourceCrc(const std::string& source, const char* sourceOutputName,
+                                      char* crcFilenameOut, int crcFilenameOutSize)
+{
+	SafeSnprinf(crcFilenameOut, crcFilenameOutSize, "%s.crc", sourceOutputName);
+
+	uint32_t sourceCrc = 0;
+	crc32(source.data(), source.size(), &sourceCrc);
+	char crcContents[32] = {0};
+	PrintfBuffer(crcContents, "%u\n", sourceCrc);
+	return writeIfContentsNewer(crcContents, crcFilenameOut);
+}
+
+// Optimized builds of hot compile-time code are kept alongside the unoptimized build. See
+// StartOptimizingHotCompileTimeCode()
+static std::string getOptimizedLibraryPath(const std::string& artifactsName)
+{
+	char optimizedLibraryPath[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(optimizedLibraryPath, "%s/lib%s_optimized.so", cakelispWorkingDir,
+	             artifactsName.c_str());
+	return optimizedLibraryPath;
+}
+
+// Loads the library of an object which compiled and linked successfully, then adds it to the
+// environment
+static bool loadCompileTimeObject(EvaluatorEnvironment& environment, BuildObject& buildObject)
+{
+	if (buildObject.status != 0)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation, "Failed to link definition");
+		return false;
+	}
+
+	buildObject.stage = BuildStage_Loading;
+
+	if (logging.buildProcess)
+		Logf("Linked %s successfully\n", buildObject.definition->name.c_str());
+
+	DynamicLibHandle builtLib = loadDynamicLibrary(buildObject.dynamicLibraryPath.c_str());
+	if (!builtLib)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation,
+		             "Failed to load compile-time library");
+		return false;
+	}
+
+	// We need to do name conversion to be compatible with C naming
+	// TODO: Make these come from the top
+	NameStyleSettings nameSettings;
+	char symbolNameBuffer[MAX_NAME_LENGTH] = {0};
+	const char* symbolName = lispNameStyleToCNameStyleCached(
+	    nameSettings.functionNameMode, buildObject.definition->name, symbolNameBuffer,
+	    sizeof(symbolNameBuffer), *buildObject.definition->definitionInvocation);
+	void* compileTimeFunction = getSymbolFromDynamicLibrary(builtLib, symbolName);
+	if (!compileTimeFunction)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation,
+		             "Failed to find symbol in loaded library");
+		return false;
+	}
+
+	// Add to environment
+	switch (buildObject.definition->type)
+	{
+		case ObjectType_CompileTimeMacro:
+		{
+			MacroFunc previousMacro = findMacro(environment, buildObject.definition->name.c_str());
+			if (previousMacro)
+			{
+				NoteAtToken(*buildObject.definition->definitionInvocation, "redefined macro");
+				environment.loadedCompileTimeDefinitions.erase((void*)previousMacro);
+			}
+			environment.macros[buildObject.definition->name] = (MacroFunc)compileTimeFunction;
+			environment.loadedCompileTimeDefinitions[compileTimeFunction] = buildObject.definition;
+			break;
+		}
+		case ObjectType_CompileTimeGenerator:
+		{
+			GeneratorFunc previousGenerator =
+			    findGenerator(environment, buildObject.definition->name.c_str());
+			if (previousGenerator)
+			{
+				NoteAtToken(*buildObject.definition->definitionInvocation,
+				            "redefined generator");
+				environment.loadedCompileTimeDefinitions.erase((void*)previousGenerator);
+			}
+			environment.generators[buildObject.definition->name] =
+			    (GeneratorFunc)compileTimeFunction;
+			environment.loadedCompileTimeDefinitions[compileTimeFunction] = buildObject.definition;
+			break;
+		}
+		case ObjectType_CompileTimeFunction:
+			if (findCompileTimeFunction(environment, buildObject.definition->name.c_str()))
+				NoteAtToken(*buildObject.definition->definitionInvocation,
+				            "redefined function");
+			environment.compileTimeFunctions[buildObject.definition->name] =
+			    (void*)compileTimeFunction;
+			break;
+		default:
+			ErrorAtToken(
+			    *buildObject.definition->definitionInvocation,
+			    "Tried to build definition which is not compile-time object. Code error?");
+			break;
+	}
+
+	return true;
+}
+
 int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
                                      std::vector<BuildObject>& definitionsToBuild,
                                      int& numErrorsOut)
@@ -720,7 +1236,6 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 
 	// Spin up as many compile processes as necessary
 	// TODO: Combine sure-thing builds into batches (ones where we know all references)
-	// TODO: Instead of creating files, pipe straight to compiler?
 	// TODO: Make pipeline able to start e.g. linker while other objects are still compiling
 	// NOTE: definitionsToBuild must not be resized from when runProcess() is called until
 	// waitForAllProcessesClosed(), else the status pointer could be invalidated
@@ -732,6 +1247,18 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 		if (logging.buildProcess)
 			Logf("Build %s\n", definition->name.c_str());
 
+		if (definition->type == ObjectType_CompileTimeMacro && environment.useInterpreter)
+		{
+			InterpretedMacroTableIterator findIt =
+			    environment.interpretedMacros.find(definition->name);
+			if (findIt != environment.interpretedMacros.end())
+			{
+				buildObject.interpretedMacro = findIt->second;
+				buildObject.stage = BuildStage_Interpreting;
+				continue;
+			}
+		}
+
 		if (!definition->output)
 		{
 			ErrorAtToken(*buildObject.definition->definitionInvocation,
@@ -739,14 +1266,8 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 			continue;
 		}
 
-		char convertedNameBuffer[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(NameStyleMode_Underscores, definition->name.c_str(),
-		                          convertedNameBuffer, sizeof(convertedNameBuffer),
-		                          *definition->definitionInvocation);
-		char artifactsName[MAX_PATH_LENGTH] = {0};
-		// Various stages will append the appropriate file extension
-		PrintfBuffer(artifactsName, "comptime_%s", convertedNameBuffer);
-		buildObject.artifactsName = artifactsName;
+		buildObject.artifactsName = getCompileTimeArtifactsName(*definition);
+		const char* artifactsName = buildObject.artifactsName.c_str();
 		char fileOutputName[MAX_PATH_LENGTH] = {0};
 		// Writer will append the appropriate file extensions
 		PrintfBuffer(fileOutputName, "%s/%s", cakelispWorkingDir,
@@ -818,6 +1339,10 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 			PrintfBuffer(localHeaderOutputName, "%s.hpp", artifactsName);
 			definition->compileTimeHeaderName = localHeaderOutputName;
 		}
+		// The header is still written, because other compile-time functions may include it
+		std::string pipedSource;
+		if (environment.pipeCompileTimeSource)
+			outputSettings.sourceContentsOut = &pipedSource;
 		// Use the separate output prepared specifically for this compile-time object
 		if (!writeGeneratorOutput(*definition->output, nameSettings, formatSettings,
 		                          outputSettings))
@@ -845,30 +1370,53 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 		             buildObject.artifactsName.c_str());
 		buildObject.dynamicLibraryPath = dynamicLibraryOut;
 
-		if (canUseCachedFile(environment, sourceOutputName, buildObject.dynamicLibraryPath.c_str()))
+		// What to compare the cached library against to tell whether the source changed
+		char sourceStampName[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(sourceStampName, "%s", sourceOutputName);
+		if (environment.pipeCompileTimeSource)
 		{
+			// Diagnostics should still name the generated file so they are mapped to Cakelisp.
+			// The directive doesn't count as a line, so lines match the source map
+			char lineDirective[MAX_PATH_LENGTH + 32] = {0};
+			PrintfBuffer(lineDirective, "#line 1 \"%s\"\n", sourceOutputName);
+			pipedSource.insert(0, lineDirective);
+			definition->compileTimePipedSource = pipedSource;
+
+			if (!writeCompileTimeSourceCrc(pipedSource, sourceOutputName, sourceStampName,
+			                               sizeof(sourceStampName)))
+			{
+				ErrorAtToken(*buildObject.definition->definitionInvocation,
+				             "Failed to write compile-time source CRC file");
+				buildObject.stage = BuildStage_None;
+				continue;
+			}
+		}
+
+		if (canUseCachedFile(environment, sourceStampName, buildObject.dynamicLibraryPath.c_str()))
+		{
+			// A previous run found this hot enough to optimize
+			std::string optimizedLibraryPath = getOptimizedLibraryPath(buildObject.artifactsName);
+			if (canUseCachedFile(environment, sourceStampName, optimizedLibraryPath.c_str()))
+				buildObject.dynamicLibraryPath = optimizedLibraryPath;
+
 			if (logging.buildProcess)
-				Logf("Skipping compiling %s (using cached library)\n", sourceOutputName);
+				Logf("Skipping compiling %s (using cached library %s)\n", sourceOutputName,
+				     buildObject.dynamicLibraryPath.c_str());
 			// Skip straight to linking, which immediately becomes loading
 			buildObject.stage = BuildStage_Linking;
 			buildObject.status = 0;
 			continue;
 		}
 
-		char headerInclude[MAX_PATH_LENGTH] = {0};
-		if (environment.cakelispSrcDir.empty())
-		{
-			PrintBuffer(headerInclude, "-Isrc/");
-		}
-		else
-		{
-			PrintfBuffer(headerInclude, "-I%s", environment.cakelispSrcDir.c_str());
-		}
+		std::string headerInclude = getCakelispHeadersInclude(environment);
+		std::string cacheInclude;
+		std::vector<const char*> sourceInputs;
+		getCompileTimeSourceInputs(environment, sourceOutputName, cacheInclude, sourceInputs);
 
 		ProcessCommandInput compileTimeInputs[] = {
-		    {ProcessCommandArgumentType_SourceInput, {sourceOutputName}},
+		    {ProcessCommandArgumentType_SourceInput, sourceInputs},
 		    {ProcessCommandArgumentType_ObjectOutput, {buildObjectName}},
-		    {ProcessCommandArgumentType_CakelispHeadersInclude, {headerInclude}}};
+		    {ProcessCommandArgumentType_CakelispHeadersInclude, {headerInclude.c_str()}}};
 		const char** buildArguments = MakeProcessArgumentsFromCommand(
 		    environment.compileTimeBuildCommand, compileTimeInputs, ArraySize(compileTimeInputs));
 		if (!buildArguments)
@@ -880,6 +1428,8 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 		RunProcessArguments compileArguments = {};
 		compileArguments.fileToExecute = environment.compileTimeBuildCommand.fileToExecute.c_str();
 		compileArguments.arguments = buildArguments;
+		if (environment.pipeCompileTimeSource)
+			compileArguments.standardInput = definition->compileTimePipedSource.c_str();
 		if (runProcess(compileArguments, &buildObject.status) != 0)
 		{
 			// TODO: Abort building if cannot invoke compiler?
@@ -961,72 +1511,17 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 
 	for (BuildObject& buildObject : definitionsToBuild)
 	{
-		if (buildObject.stage != BuildStage_Linking)
-			continue;
-
-		if (buildObject.status != 0)
+		if (buildObject.stage == BuildStage_Interpreting)
 		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to link definition");
-			continue;
-		}
-
-		buildObject.stage = BuildStage_Loading;
-
-		if (logging.buildProcess)
-			Logf("Linked %s successfully\n", buildObject.definition->name.c_str());
+			buildObject.interpretedMacro->isLoaded = true;
 
-		DynamicLibHandle builtLib = loadDynamicLibrary(buildObject.dynamicLibraryPath.c_str());
-		if (!builtLib)
-		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to load compile-time library");
-			continue;
+			if (logging.buildProcess)
+				Logf("Interpreting %s instead of building it\n",
+				     buildObject.definition->name.c_str());
 		}
-
-		// We need to do name conversion to be compatible with C naming
-		// TODO: Make these come from the top
-		NameStyleSettings nameSettings;
-		char symbolNameBuffer[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(
-		    nameSettings.functionNameMode, buildObject.definition->name.c_str(), symbolNameBuffer,
-		    sizeof(symbolNameBuffer), *buildObject.definition->definitionInvocation);
-		void* compileTimeFunction = getSymbolFromDynamicLibrary(builtLib, symbolNameBuffer);
-		if (!compileTimeFunction)
-		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to find symbol in loaded library");
+		else if (buildObject.stage != BuildStage_Linking ||
+		         !loadCompileTimeObject(environment, buildObject))
 			continue;
-		}
-
-		// Add to environment
-		switch (buildObject.definition->type)
-		{
-			case ObjectType_CompileTimeMacro:
-				if (findMacro(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation, "redefined macro");
-				environment.macros[buildObject.definition->name] = (MacroFunc)compileTimeFunction;
-				break;
-			case ObjectType_CompileTimeGenerator:
-				if (findGenerator(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation,
-					            "redefined generator");
-				environment.generators[buildObject.definition->name] =
-				    (GeneratorFunc)compileTimeFunction;
-				break;
-			case ObjectType_CompileTimeFunction:
-				if (findCompileTimeFunction(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation,
-					            "redefined function");
-				environment.compileTimeFunctions[buildObject.definition->name] =
-				    (void*)compileTimeFunction;
-				break;
-			default:
-				ErrorAtToken(
-				    *buildObject.definition->definitionInvocation,
-				    "Tried to build definition which is not compile-time object. Code error?");
-				break;
-		}
 
 		buildObject.stage = BuildStage_ResolvingReferences;
 
@@ -1339,6 +1834,7 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 	}
 
 	int numBuildResolveErrors = 0;
+	int numResolvePasses = 0;
 	bool codeModified = false;
 	do
 	{
@@ -1348,6 +1844,10 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 		bool needsAnotherPass = false;
 		do
 		{
+			char passName[64] = {0};
+			PrintfBuffer(passName, "Resolve pass %d", ++numResolvePasses);
+			TraceScope passScope("resolve", passName);
+
 			if (logging.buildProcess)
 				Log("Propagate references\n");
 
@@ -1373,6 +1873,7 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 		codeModified = false;
 		for (PostReferencesResolvedHook& hook : environment.postReferencesResolvedHooks)
 		{
+			TraceScope hookScope("resolve", "Post references resolved hook");
 			bool codeModifiedByHook = false;
 			if (!hook(environment, codeModifiedByHook))
 			{
@@ -1466,6 +1967,445 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 	return errors == 0 && numBuildResolveErrors == 0;
 }
 
+struct OptimizedCompileTimeBuild
+{
+	std::string definitionName;
+	std::string objectPath;
+	// Linked to a temporary path first so a failed link never leaves a broken library in the cache
+	std::string linkOutputPath;
+	std::string libraryPath;
+	int status;
+};
+
+void StartOptimizingHotCompileTimeCode(EvaluatorEnvironment& environment)
+{
+	if (environment.compileTimeOptimizeThreshold <= 0)
+		return;
+
+	TraceScope optimizeScope("resolve", "Start optimizing hot compile-time code");
+	for (const CompileTimeFunctionDefinitionPair& definitionPair :
+	     environment.loadedCompileTimeDefinitions)
+	{
+		ObjectDefinition* definition = definitionPair.second;
+		if (definition->numInvocations < environment.compileTimeOptimizeThreshold)
+			continue;
+
+		std::string artifactsName = getCompileTimeArtifactsName(*definition);
+		char sourcePath[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(sourcePath, "%s/%s.cpp", cakelispWorkingDir, artifactsName.c_str());
+
+		OptimizedCompileTimeBuild* build = new OptimizedCompileTimeBuild;
+		build->definitionName = definition->name;
+		build->libraryPath = getOptimizedLibraryPath(artifactsName);
+		build->linkOutputPath = build->libraryPath + ".tmp";
+		build->status = -1;
+		char objectPath[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(objectPath, "%s/%s_optimized.o", cakelispWorkingDir, artifactsName.c_str());
+		build->objectPath = objectPath;
+
+		char sourceStampPath[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(sourceStampPath, environment.pipeCompileTimeSource ? "%s.crc" : "%s",
+		             sourcePath);
+		// The source is only in memory if the definition was built this run
+		if (canUseCachedFile(environment, sourceStampPath, build->libraryPath.c_str()) ||
+		    (environment.pipeCompileTimeSource && definition->compileTimePipedSource.empty()))
+		{
+			delete build;
+			continue;
+		}
+
+		if (logging.buildProcess)
+			Logf("Optimizing %s (invoked %d times)\n", definition->name.c_str(),
+			     definition->numInvocations);
+
+		// Later arguments take precedence, so this overrides any optimization level already set
+		ProcessCommand optimizedBuildCommand = environment.compileTimeBuildCommand;
+		optimizedBuildCommand.arguments.push_back({ProcessCommandArgumentType_String, "-O2"});
+
+		std::string headerInclude = getCakelispHeadersInclude(environment);
+		std::string cacheInclude;
+		std::vector<const char*> sourceInputs;
+		getCompileTimeSourceInputs(environment, sourcePath, cacheInclude, sourceInputs);
+		ProcessCommandInput compileTimeInputs[] = {
+		    {ProcessCommandArgumentType_SourceInput, sourceInputs},
+		    {ProcessCommandArgumentType_ObjectOutput, {build->objectPath.c_str()}},
+		    {ProcessCommandArgumentType_CakelispHeadersInclude, {headerInclude.c_str()}}};
+		const char** buildArguments = MakeProcessArgumentsFromCommand(
+		    optimizedBuildCommand, compileTimeInputs, ArraySize(compileTimeInputs));
+		if (!buildArguments)
+		{
+			delete build;
+			continue;
+		}
+
+		RunProcessArguments compileArguments = {};
+		compileArguments.fileToExecute = optimizedBuildCommand.fileToExecute.c_str();
+		compileArguments.arguments = buildArguments;
+		if (environment.pipeCompileTimeSource)
+			compileArguments.standardInput = definition->compileTimePipedSource.c_str();
+		// Status is written when the process is waited on, so the build must not move until then
+		if (runProcess(compileArguments, &build->status) == 0)
+			environment.optimizedBuilds.push_back(build);
+		else
+			delete build;
+
+		free(buildArguments);
+	}
+}
+
+void FinishOptimizingHotCompileTimeCode(EvaluatorEnvironment& environment)
+{
+	if (environment.optimizedBuilds.empty())
+		return;
+
+	TraceScope optimizeScope("build", "Finish optimizing hot compile-time code");
+
+	// Usually these finished while the runtime code was being built
+	waitForAllProcessesClosed(OnCompileProcessOutput);
+
+	for (OptimizedCompileTimeBuild* build : environment.optimizedBuilds)
+	{
+		if (build->status != 0)
+		{
+			Logf("note: failed to optimize %s. The unoptimized build will still be used\n",
+			     build->definitionName.c_str());
+			continue;
+		}
+
+		build->status = -1;
+		ProcessCommandInput linkTimeInputs[] = {
+		    {ProcessCommandArgumentType_DynamicLibraryOutput, {build->linkOutputPath.c_str()}},
+		    {ProcessCommandArgumentType_ObjectInput, {build->objectPath.c_str()}}};
+		const char** linkArgumentList = MakeProcessArgumentsFromCommand(
+		    environment.compileTimeLinkCommand, linkTimeInputs, ArraySize(linkTimeInputs));
+		if (!linkArgumentList)
+			continue;
+		RunProcessArguments linkArguments = {};
+		linkArguments.fileToExecute = environment.compileTimeLinkCommand.fileToExecute.c_str();
+		linkArguments.arguments = linkArgumentList;
+		runProcess(linkArguments, &build->status);
+		free(linkArgumentList);
+	}
+
+	waitForAllProcessesClosed(OnCompileProcessOutput);
+
+	for (OptimizedCompileTimeBuild* build : environment.optimizedBuilds)
+	{
+		if (build->status == 0)
+		{
+			if (rename(build->linkOutputPath.c_str(), build->libraryPath.c_str()) != 0)
+				perror("FinishOptimizingHotCompileTimeCode: ");
+			else if (logging.buildProcess)
+				Logf("Optimized %s. Later runs will use %s\n", build->definitionName.c_str(),
+				     build->libraryPath.c_str());
+		}
+
+		delete build;
+	}
+	environment.optimizedBuilds.clear();
+}
+
+static const uint32_t macroExpansionCacheMagic = 0x58454b43;  // "CKEX"
+static const uint32_t macroExpansionCacheVersion = 2;
+
+static void getMacroExpansionCachePath(char* bufferOut, int bufferSize)
+{
+	SafeSnprinf(bufferOut, bufferSize, "%s/MacroExpansions.bin", cakelispWorkingDir);
+}
+
+static bool readSavedMacroExpansions(const char* at, const char* end,
+                                     EvaluatorEnvironment& environment)
+{
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	if (!bufferReadUint32(&at, end, &magic) || magic != macroExpansionCacheMagic ||
+	    !bufferReadUint32(&at, end, &version) || version != macroExpansionCacheVersion)
+		return false;
+
+	uint32_t numMacros = 0;
+	if (!bufferReadUint32(&at, end, &numMacros))
+		return false;
+	for (uint32_t macroIndex = 0; macroIndex < numMacros; ++macroIndex)
+	{
+		std::string macroName;
+		uint32_t numDependencies = 0;
+		if (!bufferReadString(&at, end, macroName) ||
+		    !bufferReadUint32(&at, end, &numDependencies))
+			return false;
+
+		SavedPureMacro& savedMacro = environment.savedMacroExpansions[macroName];
+		savedMacro.dependencies.resize(numDependencies);
+		for (std::string& dependency : savedMacro.dependencies)
+		{
+			if (!bufferReadString(&at, end, dependency))
+				return false;
+		}
+
+		uint32_t numExpansions = 0;
+		if (!bufferReadUint32(&at, end, &numExpansions))
+			return false;
+		for (uint32_t expansionIndex = 0; expansionIndex < numExpansions; ++expansionIndex)
+		{
+			SavedMacroExpansion saved = {};
+			if (!bufferReadUint32(&at, end, &saved.definitionHash) ||
+			    !bufferReadUint32(&at, end, &saved.argumentsHash) ||
+			    !readTokensBinary(&at, end, saved.arguments,
+			                      environment.macroExpansionCacheSources) ||
+			    !readTokensBinary(&at, end, saved.expansion,
+			                      environment.macroExpansionCacheSources))
+				return false;
+
+			// Offsets are relative to the invocation, where arguments start after the name
+			int maxOffset = (int)saved.arguments.size() + 1;
+			saved.invocationOffsets.resize(saved.expansion.size());
+			for (int& invocationOffset : saved.invocationOffsets)
+			{
+				uint32_t offset = 0;
+				if (!bufferReadUint32(&at, end, &offset))
+					return false;
+				invocationOffset = (int)offset;
+				if (invocationOffset != -1 && (invocationOffset < 2 || invocationOffset > maxOffset))
+					return false;
+			}
+
+			savedMacro.expansions.push_back(std::move(saved));
+		}
+	}
+	return true;
+}
+
+static void readMacroExpansionCache(EvaluatorEnvironment& environment)
+{
+	char cacheFilename[MAX_PATH_LENGTH] = {0};
+	getMacroExpansionCachePath(cacheFilename, sizeof(cacheFilename));
+	// This is fine if no pure macros have been expanded yet
+	if (!fileExists(cacheFilename))
+		return;
+
+	MappedFile mappedFile;
+	if (!fileMap(cacheFilename, mappedFile))
+		return;
+	bool isValid = readSavedMacroExpansions(mappedFile.data, mappedFile.data + mappedFile.size,
+	                                        environment);
+	fileUnmap(mappedFile);
+
+	if (!isValid)
+	{
+		Logf("warning: ignoring invalid or outdated macro expansion cache %s\n", cacheFilename);
+		environment.savedMacroExpansions.clear();
+		environment.macroExpansionCacheModified = true;
+		return;
+	}
+
+	if (logging.fileSystem)
+		Logf("Read macro expansions for %d macros from %s\n",
+		     (int)environment.savedMacroExpansions.size(), cacheFilename);
+}
+
+void setMacroPure(EvaluatorEnvironment& environment, const std::vector<Token>& tokens,
+                  int startTokenIndex, const std::string& macroName, bool isPure)
+{
+	if (!isPure)
+	{
+		environment.pureMacros.erase(macroName);
+		return;
+	}
+
+	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
+	PureMacro& pureMacro = environment.pureMacros[macroName];
+	// Start over in case this is a redefinition
+	pureMacro.expansions.clear();
+	pureMacro.definitionHash = hashTokenContents(tokens, startTokenIndex, endInvocationIndex + 1);
+	// Saved expansions are claimed by claimSavedMacroExpansions()
+	pureMacro.savedExpansionsClaimed = !environment.cacheMacroExpansions;
+
+	if (!environment.cacheMacroExpansions)
+		return;
+
+	// Expansions from previous runs are ignored with --ignore-cache, but still overwritten
+	if (!environment.macroExpansionCacheRead && environment.useCachedFiles)
+	{
+		readMacroExpansionCache(environment);
+		environment.macroExpansionCacheRead = true;
+	}
+}
+
+// Adds the compile-time functions, macros, and generators referenced by the definition, and
+// everything they reference in turn, to dependenciesOut
+static void collectCompileTimeDependencies_Recursive(EvaluatorEnvironment& environment,
+                                                     const std::string& definitionName,
+                                                     std::vector<std::string>& dependenciesOut)
+{
+	ObjectDefinitionMap::iterator findIt = environment.definitions.find(definitionName);
+	if (findIt == environment.definitions.end())
+		return;
+
+	for (ObjectReferenceStatusPair& reference : findIt->second.references)
+	{
+		ObjectDefinitionMap::iterator findReferenceIt =
+		    environment.definitions.find(reference.first);
+		if (findReferenceIt == environment.definitions.end() ||
+		    !isCompileTimeObject(findReferenceIt->second.type) ||
+		    std::find(dependenciesOut.begin(), dependenciesOut.end(), reference.first) !=
+		        dependenciesOut.end())
+			continue;
+
+		dependenciesOut.push_back(reference.first);
+		collectCompileTimeDependencies_Recursive(environment, reference.first, dependenciesOut);
+	}
+}
+
+static void writeSavedMacroDependencies(FILE* file, const std::vector<std::string>& dependencies)
+{
+	fileWriteUint32(file, (uint32_t)dependencies.size());
+	for (const std::string& dependency : dependencies)
+		fileWriteString(file, dependency);
+}
+
+static void writeSavedMacroExpansion(FILE* file, uint32_t definitionHash, uint32_t argumentsHash,
+                                     const std::vector<Token>& arguments,
+                                     const std::vector<Token>& expansion,
+                                     const std::vector<int>& invocationOffsets,
+                                     std::vector<const char*>& sources)
+{
+	fileWriteUint32(file, definitionHash);
+	fileWriteUint32(file, argumentsHash);
+	writeTokensBinary(file, arguments, sources);
+	writeTokensBinary(file, expansion, sources);
+	for (int invocationOffset : invocationOffsets)
+		fileWriteUint32(file, (uint32_t)invocationOffset);
+}
+
+void writeMacroExpansionCache(EvaluatorEnvironment& environment)
+{
+	if (!environment.cacheMacroExpansions || !environment.macroExpansionCacheModified)
+		return;
+
+	char cacheFilename[MAX_PATH_LENGTH] = {0};
+	getMacroExpansionCachePath(cacheFilename, sizeof(cacheFilename));
+	// Write to a temporary file first so an interrupted write can't leave a partial cache
+	char tempFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(tempFilename, "%s.tmp", cacheFilename);
+
+	FILE* file = fileOpen(tempFilename, "wb");
+	if (!file)
+		return;
+
+	fileWriteUint32(file, macroExpansionCacheMagic);
+	fileWriteUint32(file, macroExpansionCacheVersion);
+	// Expansions of macros which weren't defined this run are kept for later runs. Macros which
+	// were defined replace their saved expansions, even if they never claimed them
+	uint32_t numMacros = (uint32_t)environment.pureMacros.size();
+	for (SavedMacroExpansionTablePair& savedPair : environment.savedMacroExpansions)
+	{
+		if (environment.pureMacros.find(savedPair.first) == environment.pureMacros.end())
+			++numMacros;
+	}
+	fileWriteUint32(file, numMacros);
+
+	std::vector<const char*> sources;
+	std::vector<Token> arguments;
+	std::vector<std::string> dependencies;
+	for (PureMacroTablePair& pureMacroPair : environment.pureMacros)
+	{
+		const PureMacro& pureMacro = pureMacroPair.second;
+		// Sorted so the hash doesn't depend on the order references were made in
+		dependencies.clear();
+		collectCompileTimeDependencies_Recursive(environment, pureMacroPair.first, dependencies);
+		std::sort(dependencies.begin(), dependencies.end());
+		// Every dependency was found among the definitions, so this can't fail
+		uint32_t definitionHash = 0;
+		hashPureMacroDependencies(environment, pureMacro, dependencies, &definitionHash);
+
+		fileWriteString(file, pureMacroPair.first);
+		writeSavedMacroDependencies(file, dependencies);
+		fileWriteUint32(file, (uint32_t)pureMacro.expansions.size());
+		for (const std::pair<const uint32_t, PureMacroExpansion>& expansionPair :
+		     pureMacro.expansions)
+		{
+			const PureMacroExpansion& expansion = expansionPair.second;
+			const std::vector<Token>& invocationTokens = *expansion.invocationTokens;
+			int endInvocationIndex =
+			    FindCloseParenTokenIndex(invocationTokens, expansion.invocationStartIndex);
+			arguments.assign(invocationTokens.begin() + expansion.invocationStartIndex + 2,
+			                 invocationTokens.begin() + endInvocationIndex);
+			writeSavedMacroExpansion(file, definitionHash, expansionPair.first,
+			                         arguments, *expansion.expansion,
+			                         expansion.invocationOffsets, sources);
+		}
+	}
+
+	for (SavedMacroExpansionTablePair& savedPair : environment.savedMacroExpansions)
+	{
+		if (environment.pureMacros.find(savedPair.first) != environment.pureMacros.end())
+			continue;
+		fileWriteString(file, savedPair.first);
+		writeSavedMacroDependencies(file, savedPair.second.dependencies);
+		fileWriteUint32(file, (uint32_t)savedPair.second.expansions.size());
+		for (const SavedMacroExpansion& saved : savedPair.second.expansions)
+			writeSavedMacroExpansion(file, saved.definitionHash, saved.argumentsHash,
+			                         saved.arguments, saved.expansion, saved.invocationOffsets,
+			                         sources);
+	}
+
+	bool writeFailed = ferror(file);
+	fclose(file);
+	if (writeFailed || rename(tempFilename, cacheFilename) != 0)
+	{
+		Logf("error: failed to write macro expansion cache %s\n", cacheFilename);
+		remove(tempFilename);
+		return;
+	}
+
+	environment.macroExpansionCacheModified = false;
+	if (logging.fileSystem)
+		Logf("Wrote %s\n", cacheFilename);
+}
+
+bool printInvocationProfile(EvaluatorEnvironment& environment, const char* csvFilename)
+{
+	std::vector<const InvocationProfilePair*> sortedProfiles;
+	sortedProfiles.reserve(environment.invocationProfiles.size());
+	for (const InvocationProfilePair& profilePair : environment.invocationProfiles)
+		sortedProfiles.push_back(&profilePair);
+	std::sort(sortedProfiles.begin(), sortedProfiles.end(),
+	          [](const InvocationProfilePair* a, const InvocationProfilePair* b) {
+		          return a->second.exclusiveMicroseconds > b->second.exclusiveMicroseconds;
+	          });
+
+	Log("\nInvocation profile (times in milliseconds):\n");
+	Logf("%-40s %-9s %10s %10s %12s %12s %10s\n", "Name", "Type", "Calls", "Cached",
+	     "Inclusive", "Exclusive", "Emitted");
+	for (const InvocationProfilePair* profilePair : sortedProfiles)
+	{
+		const InvocationProfile& profile = profilePair->second;
+		Logf("%-40s %-9s %10d %10d %12.3f %12.3f %10lu\n", profilePair->first.c_str(),
+		     profile.isMacro ? "macro" : "generator", profile.numInvocations,
+		     profile.numCacheHits, profile.inclusiveMicroseconds / 1000.0,
+		     profile.exclusiveMicroseconds / 1000.0, profile.numEmitted);
+	}
+
+	if (!csvFilename)
+		return true;
+
+	FILE* csvFile = fileOpen(csvFilename, "w");
+	if (!csvFile)
+		return false;
+	fprintf(csvFile,
+	        "name,type,calls,cached,inclusive_microseconds,exclusive_microseconds,emitted\n");
+	for (const InvocationProfilePair* profilePair : sortedProfiles)
+	{
+		const InvocationProfile& profile = profilePair->second;
+		fprintf(csvFile, "\"%s\",%s,%d,%d,%llu,%llu,%lu\n", profilePair->first.c_str(),
+		        profile.isMacro ? "macro" : "generator", profile.numInvocations,
+		        profile.numCacheHits, profile.inclusiveMicroseconds,
+		        profile.exclusiveMicroseconds, profile.numEmitted);
+	}
+	fclose(csvFile);
+	Logf("Wrote invocation profile to %s\n", csvFilename);
+	return true;
+}
+
 // This serves only as a warning. I want to be very explicit with the lifetime of tokens
 EvaluatorEnvironment::~EvaluatorEnvironment()
 {
@@ -1565,6 +2505,17 @@ void environmentDestroyInvalidateTokens(EvaluatorEnvironment& environment)
 	for (const std::vector<Token>* comptimeTokens : environment.comptimeTokens)
 		delete comptimeTokens;
 	environment.comptimeTokens.clear();
+
+	for (InterpretedMacroTablePair& interpretedMacroPair : environment.interpretedMacros)
+		delete interpretedMacroPair.second;
+	environment.interpretedMacros.clear();
+
+	// Cached expansions point to the comptimeTokens destroyed above
+	environment.pureMacros.clear();
+	environment.savedMacroExpansions.clear();
+	for (const char* source : environment.macroExpansionCacheSources)
+		free((void*)source);
+	environment.macroExpansionCacheSources.clear();
 }
 
 const char* evaluatorScopeToString(EvaluatorScope expectedScope)
@@ -1634,7 +2585,7 @@ bool searchForFileInPaths(const char* shortPath, const char* encounteredInFile,
 		if (logging.fileSearch)
 			Logf("File exists? %s (", foundFilePathOut);
 
-		if (fileExists(foundFilePathOut))
+		if (fileExistsCached(foundFilePathOut))
 		{
 			if (logging.fileSearch)
 				Log("yes)\n");
@@ -1651,7 +2602,7 @@ bool searchForFileInPaths(const char* shortPath, const char* encounteredInFile,
 		if (logging.fileSearch)
 			Logf("File exists? %s (", foundFilePathOut);
 
-		if (fileExists(foundFilePathOut))
+		if (fileExistsCached(foundFilePathOut))
 		{
 			if (logging.fileSearch)
 				Log("yes)\n");
@@ -1675,6 +2626,13 @@ bool searchForFileInPathsWithError(const char* shortPath, const char* encountere
 	if (!searchForFileInPaths(shortPath, encounteredInFile, searchPaths, foundFilePathOut,
 	                          foundFilePathOutSize))
 	{
+		// The file might have been created (e.g. by a macro) after the directory listings were
+		// cached. Failing is rare enough that it's worth checking again before giving up
+		fileExistsCacheClear();
+		if (searchForFileInPaths(shortPath, encounteredInFile, searchPaths, foundFilePathOut,
+		                         foundFilePathOutSize))
+			return true;
+
 		ErrorAtToken(blameToken, "file not found! Checked the following paths:");
 		Logf("Checked if relative to %s\n", encounteredInFile);
 		Log("Checked search paths:\n");
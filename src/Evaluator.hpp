@@ -108,6 +108,12 @@ typedef std::unordered_map<std::string, GeneratorFunc> GeneratorTable;
 typedef MacroTable::iterator MacroIterator;
 typedef GeneratorTable::iterator GeneratorIterator;
 
+// Macros simple enough to run without compiling them. See Interpreter.hpp
+struct InterpretedMacro;
+typedef std::unordered_map<std::string, InterpretedMacro*> InterpretedMacroTable;
+typedef InterpretedMacroTable::iterator InterpretedMacroTableIterator;
+typedef std::pair<const std::string, InterpretedMacro*> InterpretedMacroTablePair;
+
 typedef std::unordered_map<std::string, const Token*> GeneratorLastReferenceTable;
 typedef GeneratorLastReferenceTable::iterator GeneratorLastReferenceTableIterator;
 
@@ -187,6 +193,9 @@ struct ObjectDefinition
 	bool isLoaded;
 	// Used by other compile-time functions to include this function's already output header
 	std::string compileTimeHeaderName;
+	// When pipeCompileTimeSource is set, the source isn't on disk, so it's kept here in case the
+	// definition is rebuilt with optimizations
+	std::string compileTimePipedSource;
 
 	// Arbitrary tags user may add for compile-time reference
 	std::vector<std::string> tags;
@@ -194,6 +203,10 @@ struct ObjectDefinition
 	// In order to have context-unique symbols, this number is incremented for each unique name
 	// requested. This is only relevant for compile-time function bodies
 	int nextFreeUniqueSymbolNum;
+
+	// Only counted for loaded compile-time macros and generators, and only while
+	// compileTimeOptimizeThreshold is set. See StartOptimizingHotCompileTimeCode()
+	int numInvocations;
 };
 
 struct ObjectReferencePool
@@ -225,6 +238,8 @@ typedef CompileTimeFunctionMetadataTable::iterator CompileTimeFunctionMetadataTa
 extern const char* g_environmentPreLinkHookSignature;
 typedef bool (*PreLinkHook)(ModuleManager& manager, ProcessCommand& linkCommand,
                             ProcessCommandInput* linkTimeInputs, int numLinkTimeInputs);
+extern const char* g_environmentPostBuildProcessHookSignature;
+typedef bool (*PostBuildProcessHook)(ModuleManager& manager, const ProcessResult& result);
 extern const char* g_environmentPostReferencesResolvedHookSignature;
 typedef bool (*PostReferencesResolvedHook)(EvaluatorEnvironment& environment,
                                            bool& wasCodeModifiedOut);
@@ -250,6 +265,112 @@ typedef std::unordered_map<std::string, const char*> RequiredCompileTimeFunction
 typedef RequiredCompileTimeFunctionReasonsTable::iterator
     RequiredCompileTimeFunctionReasonsTableIterator;
 
+// Accumulated cost of all invocations of a single macro or generator
+struct InvocationProfile
+{
+	bool isMacro;
+	// Pure macro invocations which reused a saved expansion are counted separately, because the
+	// macro itself didn't run
+	int numInvocations;
+	int numCacheHits;
+	// Inclusive includes everything invoked while running (e.g. a macro's expansion being
+	// evaluated); exclusive subtracts out other profiled invocations
+	unsigned long long inclusiveMicroseconds;
+	unsigned long long exclusiveMicroseconds;
+	// Tokens output for macros, StringOutputs for generators
+	unsigned long numEmitted;
+	// Recursive invocations only count towards inclusive time once
+	int numActiveInvocations;
+};
+typedef std::unordered_map<std::string, InvocationProfile> InvocationProfileTable;
+typedef std::pair<const std::string, InvocationProfile> InvocationProfilePair;
+
+struct InvocationProfileFrame
+{
+	InvocationProfile* profile;
+	unsigned long long startMicroseconds;
+	unsigned long long childMicroseconds;
+};
+
+typedef std::unordered_map<void*, ObjectDefinition*> CompileTimeFunctionDefinitionTable;
+typedef CompileTimeFunctionDefinitionTable::iterator CompileTimeFunctionDefinitionTableIterator;
+typedef std::pair<void* const, ObjectDefinition*> CompileTimeFunctionDefinitionPair;
+
+// See StartOptimizingHotCompileTimeCode()
+struct OptimizedCompileTimeBuild;
+
+// An expansion of a macro defined with &pure, which can be reused by any invocation with the same
+// arguments. Both token lists are owned by the environment and live until
+// environmentDestroyInvalidateTokens()
+struct PureMacroExpansion
+{
+	const std::vector<Token>* invocationTokens;
+	int invocationStartIndex;
+	const std::vector<Token>* expansion;
+	// For each expansion token, the offset from invocationStartIndex of the argument token it was
+	// copied from, or -1 if it came from the macro itself. Reused expansions take the source
+	// positions of the new invocation's arguments so errors point to the right place
+	std::vector<int> invocationOffsets;
+};
+// Keyed by a hash of the argument tokens' types and contents
+typedef std::unordered_multimap<uint32_t, PureMacroExpansion> PureMacroExpansionCache;
+typedef PureMacroExpansionCache::iterator PureMacroExpansionCacheIterator;
+
+struct PureMacro
+{
+	// Hash of the defmacro's tokens. See hashPureMacroDependencies() for what saved expansions are
+	// checked against
+	uint32_t definitionHash;
+	// Saved expansions can't be checked until the compile-time definitions they depend on have been
+	// evaluated, so they are claimed when the macro is first invoked after that
+	bool savedExpansionsClaimed;
+	PureMacroExpansionCache expansions;
+};
+typedef std::unordered_map<std::string, PureMacro> PureMacroTable;
+typedef PureMacroTable::iterator PureMacroTableIterator;
+typedef std::pair<const std::string, PureMacro> PureMacroTablePair;
+
+// An expansion read from the macro expansion cache file, which hasn't been claimed by a definition.
+// See --cache-macro-expansions
+struct SavedMacroExpansion
+{
+	// Covers the defmacro and the compile-time definitions it depends on
+	uint32_t definitionHash;
+	uint32_t argumentsHash;
+	// Only the types and contents are used
+	std::vector<Token> arguments;
+	std::vector<Token> expansion;
+	std::vector<int> invocationOffsets;
+};
+struct SavedPureMacro
+{
+	// Names of the compile-time functions, macros, and generators the macro referenced, directly or
+	// through each other, when its expansions were saved
+	std::vector<std::string> dependencies;
+	std::vector<SavedMacroExpansion> expansions;
+};
+typedef std::unordered_map<std::string, SavedPureMacro> SavedMacroExpansionTable;
+typedef SavedMacroExpansionTable::iterator SavedMacroExpansionTableIterator;
+typedef std::pair<const std::string, SavedPureMacro> SavedMacroExpansionTablePair;
+
+// An executable or library linked from a specific set of modules. See add-build-target
+struct BuildTarget
+{
+	BuildTargetType type;
+	// Where the final artifact is copied to, relative to the working directory. Also the target's
+	// name when setting its options
+	std::string outputName;
+	// Their C/C++ build dependencies are linked as well
+	std::vector<Module*> modules;
+	// Only the parts which are set replace the default link command for the target's type
+	ProcessCommand linkCommandOverride;
+	const Token* nameToken;
+};
+
+// Build options keyed by the build configuration label they apply to
+typedef std::unordered_map<std::string, std::vector<std::string>> BuildConfigurationOptionsTable;
+typedef BuildConfigurationOptionsTable::iterator BuildConfigurationOptionsTableIterator;
+
 // Unlike context, which can't be changed, environment can be changed.
 // Keep in mind that calling functions which can change the environment may invalidate your pointers
 // if things resize.
@@ -333,6 +454,8 @@ struct EvaluatorEnvironment
 	ProcessCommand compileTimeLinkCommand;
 	ProcessCommand buildTimeBuildCommand;
 	ProcessCommand buildTimeLinkCommand;
+	ProcessCommand buildTimeStaticLinkCommand;
+	ProcessCommand buildTimeSharedLinkCommand;
 
 	// At this point, all known references are resolved. This is the best time to let the user do
 	// arbitrary code generation and modification. These changes will need to be evaluated and their
@@ -342,6 +465,54 @@ struct EvaluatorEnvironment
 	// Gives the user the chance to change the link command
 	std::vector<PreLinkHook> preLinkHooks;
 
+	// Run after each compile or link process closes, to inspect its output, status, and resource
+	// usage. Returning false stops the build
+	std::vector<PostBuildProcessHook> postBuildProcessHooks;
+
+	// Record how much time is spent in each macro and generator. See printInvocationProfile()
+	bool profileInvocations;
+	InvocationProfileTable invocationProfiles;
+	std::vector<InvocationProfileFrame> invocationProfileStack;
+
+	// Run macros with the interpreter when they are simple enough, rather than compiling them.
+	// Macros which can be interpreted are added to interpretedMacros by defmacro, but are not used
+	// until they are required, just like compiled macros
+	bool useInterpreter;
+	InterpretedMacroTable interpretedMacros;
+
+	// Compile-time code is built without optimizations so it can be used as soon as possible.
+	// Macros and generators invoked at least this many times are rebuilt with optimizations in the
+	// background, and later runs load the optimized build from the cache. 0 disables counting
+	int compileTimeOptimizeThreshold;
+	// Loaded macros and generators by function, so invocations are counted on their definitions
+	// without looking them up by name. Built-ins have no definition, so they are never counted
+	CompileTimeFunctionDefinitionTable loadedCompileTimeDefinitions;
+	std::vector<OptimizedCompileTimeBuild*> optimizedBuilds;
+
+	// Pipe the source of compile-time code straight to the compiler instead of writing it to the
+	// cache first. Only a small file with the source's CRC is written, to tell when to rebuild
+	bool pipeCompileTimeSource;
+
+	// Every macro defined with &pure has an entry, even before it has been expanded
+	PureMacroTable pureMacros;
+
+	// Save expansions of pure macros to a file, so later runs can skip running them entirely
+	bool cacheMacroExpansions;
+	bool macroExpansionCacheRead;
+	// Whether there's anything new to write
+	bool macroExpansionCacheModified;
+	SavedMacroExpansionTable savedMacroExpansions;
+	// Sources of tokens read from the file. Freed by environmentDestroyInvalidateTokens()
+	std::vector<const char*> macroExpansionCacheSources;
+
+	// If empty, every built module is linked into a single executable (see executableOutput).
+	// Otherwise, only the modules in these targets are built, and each target is linked separately
+	std::vector<BuildTarget> buildTargets;
+
+	// Added to every object built in a configuration with the label. See
+	// add-build-options-for-config
+	BuildConfigurationOptionsTable buildConfigurationOptions;
+
 	// Will NOT clean up macroExpansions! Use environmentDestroyInvalidateTokens()
 	~EvaluatorEnvironment();
 };
@@ -370,6 +541,25 @@ bool ReplaceAndEvaluateDefinition(EvaluatorEnvironment& environment,
 // Returns whether all references were resolved successfully
 bool EvaluateResolveReferences(EvaluatorEnvironment& environment);
 
+// Spawn optimized builds of compile-time code invoked more than compileTimeOptimizeThreshold times.
+// They run while the runtime code is written and built. Call once all references are resolved
+void StartOptimizingHotCompileTimeCode(EvaluatorEnvironment& environment);
+// Waits for optimized builds then links them into the cache, where later runs will find them.
+// Failures only mean the unoptimized build keeps being used, so they are not errors
+void FinishOptimizingHotCompileTimeCode(EvaluatorEnvironment& environment);
+
+// Called by defmacro. Pure macros reuse expansions for arguments they have seen before, including
+// those saved by previous runs when cacheMacroExpansions is set
+void setMacroPure(EvaluatorEnvironment& environment, const std::vector<Token>& tokens,
+                  int startTokenIndex, const std::string& macroName, bool isPure);
+// Writes expansions of pure macros to the cache, if cacheMacroExpansions is set and there are new
+// expansions. Call before environmentDestroyInvalidateTokens()
+void writeMacroExpansionCache(EvaluatorEnvironment& environment);
+
+// Print a table of macro and generator costs, sorted by exclusive time. If csvFilename is not null,
+// also write the table there as CSV
+bool printInvocationProfile(EvaluatorEnvironment& environment, const char* csvFilename);
+
 const char* evaluatorScopeToString(EvaluatorScope expectedScope);
 
 bool addObjectDefinition(EvaluatorEnvironment& environment, ObjectDefinition& definition);
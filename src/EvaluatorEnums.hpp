@@ -82,3 +82,10 @@ enum ObjectReferenceResolutionType
 	ObjectReferenceResolutionType_None = 0,
 	ObjectReferenceResolutionType_Splice,
 };
+
+enum BuildTargetType
+{
+	BuildTargetType_Executable,
+	BuildTargetType_StaticLibrary,
+	BuildTargetType_SharedLibrary
+};
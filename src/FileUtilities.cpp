@@ -3,14 +3,20 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "Logging.hpp"
 #include "Utilities.hpp"
 
 #ifdef UNIX
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #else
@@ -67,6 +73,48 @@ bool fileExists(const char* filename)
 	return access(filename, F_OK) != -1;
 }
 
+// Directories which don't exist are remembered as empty listings
+typedef std::unordered_map<std::string, std::unordered_set<std::string>> DirectoryListingTable;
+static DirectoryListingTable s_directoryListings;
+static std::mutex s_directoryListingsMutex;
+
+bool fileExistsCached(const char* filename)
+{
+	const char* lastSlash = strrchr(filename, '/');
+	const char* name = lastSlash ? lastSlash + 1 : filename;
+	// Directory entries don't include these, and trailing slashes leave no name to look for
+	if (!name[0] || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return fileExists(filename);
+
+	std::string directory = ".";
+	if (lastSlash)
+		directory = lastSlash == filename ? "/" : std::string(filename, lastSlash - filename);
+
+	std::lock_guard<std::mutex> lock(s_directoryListingsMutex);
+	DirectoryListingTable::iterator findIt = s_directoryListings.find(directory);
+	if (findIt == s_directoryListings.end())
+	{
+		std::unordered_set<std::string>& entries = s_directoryListings[directory];
+#ifdef UNIX
+		DIR* directoryHandle = opendir(directory.c_str());
+		if (directoryHandle)
+		{
+			while (struct dirent* entry = readdir(directoryHandle))
+				entries.insert(entry->d_name);
+			closedir(directoryHandle);
+		}
+#endif
+		return entries.find(name) != entries.end();
+	}
+	return findIt->second.find(name) != findIt->second.end();
+}
+
+void fileExistsCacheClear()
+{
+	std::lock_guard<std::mutex> lock(s_directoryListingsMutex);
+	s_directoryListings.clear();
+}
+
 void makeDirectory(const char* path)
 {
 #ifdef UNIX
@@ -317,3 +365,77 @@ void addExecutablePermission(const char* filename)
 	}
 #endif
 }
+
+void fileWriteUint32(FILE* file, uint32_t value)
+{
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+void fileWriteString(FILE* file, const std::string& value)
+{
+	fileWriteUint32(file, (uint32_t)value.size());
+	fwrite(value.data(), sizeof(char), value.size(), file);
+}
+
+bool bufferReadUint32(const char** at, const char* end, uint32_t* valueOut)
+{
+	if ((size_t)(end - *at) < sizeof(*valueOut))
+		return false;
+	memcpy(valueOut, *at, sizeof(*valueOut));
+	*at += sizeof(*valueOut);
+	return true;
+}
+
+bool bufferReadString(const char** at, const char* end, std::string& valueOut)
+{
+	uint32_t length = 0;
+	if (!bufferReadUint32(at, end, &length) || (size_t)(end - *at) < length)
+		return false;
+	valueOut.assign(*at, length);
+	*at += length;
+	return true;
+}
+
+bool fileMap(const char* filename, MappedFile& mappedFileOut)
+{
+	mappedFileOut = {};
+#ifdef UNIX
+	int fileDescriptor = open(filename, O_RDONLY);
+	if (fileDescriptor == -1)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) != 0)
+	{
+		close(fileDescriptor);
+		return false;
+	}
+
+	if (fileStat.st_size > 0)
+	{
+		void* data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fileDescriptor);
+			return false;
+		}
+		mappedFileOut.data = (const char*)data;
+		mappedFileOut.size = fileStat.st_size;
+	}
+
+	// The mapping stays valid after the file is closed
+	close(fileDescriptor);
+	return true;
+#else
+	return false;
+#endif
+}
+
+void fileUnmap(MappedFile& mappedFile)
+{
+#ifdef UNIX
+	if (mappedFile.data)
+		munmap((void*)mappedFile.data, mappedFile.size);
+#endif
+	mappedFile = {};
+}
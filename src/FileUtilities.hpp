@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
 // Returns zero if the file doesn't exist, or there was some other error
 unsigned long fileGetLastModificationTime(const char* filename);
 
@@ -9,6 +14,11 @@ unsigned long fileGetLastModificationTime(const char* filename);
 bool fileIsMoreRecentlyModified(const char* filename, const char* reference);
 
 bool fileExists(const char* filename);
+// Like fileExists(), but each directory is only read once, then answered from memory. This is much
+// faster when looking for many files in many directories, like when scanning includes. Files
+// created after their directory was read won't be found until fileExistsCacheClear()
+bool fileExistsCached(const char* filename);
+void fileExistsCacheClear();
 
 void makeDirectory(const char* path);
 
@@ -35,3 +45,21 @@ bool copyFileTo(const char* srcFilename, const char* destFilename);
 bool moveFile(const char* srcFilename, const char* destFilename);
 
 void addExecutablePermission(const char* filename);
+
+// Binary cache files. Values are written in native byte order, so these files should only be read
+// on the machine which wrote them. Files are mapped into memory to be read. Reads advance at and
+// return false if they would go past end, which means the file is bad
+void fileWriteUint32(FILE* file, uint32_t value);
+void fileWriteString(FILE* file, const std::string& value);
+bool bufferReadUint32(const char** at, const char* end, uint32_t* valueOut);
+bool bufferReadString(const char** at, const char* end, std::string& valueOut);
+
+struct MappedFile
+{
+	const char* data;
+	unsigned long size;
+};
+// Returns false if the file doesn't exist or couldn't be mapped. Empty files are mapped with null
+// data. Call fileUnmap() when done
+bool fileMap(const char* filename, MappedFile& mappedFileOut);
+void fileUnmap(MappedFile& mappedFile);
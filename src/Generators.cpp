@@ -9,21 +9,23 @@
 #include "FileUtilities.hpp"
 #include "GeneratorHelpers.hpp"
 #include "GeneratorHelpersEnums.hpp"
+#include "Interpreter.hpp"
 #include "ModuleManager.hpp"
 #include "Tokenizer.hpp"
 #include "Utilities.hpp"
 
+// valueArgumentIndex is the index of the option's first value, counting the invocation name as 0
 typedef bool (*ProcessCommandOptionFunc)(EvaluatorEnvironment& environment,
                                          const std::vector<Token>& tokens, int startTokenIndex,
-                                         ProcessCommand* command);
+                                         int valueArgumentIndex, ProcessCommand* command);
 
 bool SetProcessCommandFileToExec(EvaluatorEnvironment& environment,
                                  const std::vector<Token>& tokens, int startTokenIndex,
-                                 ProcessCommand* command)
+                                 int valueArgumentIndex, ProcessCommand* command)
 {
 	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
-	int argumentIndex = getExpectedArgument("expected path to compiler", tokens, startTokenIndex, 2,
-	                                        endInvocationIndex);
+	int argumentIndex = getExpectedArgument("expected path to compiler", tokens, startTokenIndex,
+	                                        valueArgumentIndex, endInvocationIndex);
 	if (argumentIndex == -1)
 		return false;
 
@@ -37,12 +39,14 @@ bool SetProcessCommandFileToExec(EvaluatorEnvironment& environment,
 }
 
 bool SetProcessCommandArguments(EvaluatorEnvironment& environment, const std::vector<Token>& tokens,
-                                int startTokenIndex, ProcessCommand* command)
+                                int startTokenIndex, int valueArgumentIndex,
+                                ProcessCommand* command)
 {
 	command->arguments.clear();
 
 	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
-	int startArgsIndex = getArgument(tokens, startTokenIndex, 2, endInvocationIndex);
+	int startArgsIndex =
+	    getArgument(tokens, startTokenIndex, valueArgumentIndex, endInvocationIndex);
 	// No args is weird, but we'll allow it
 	if (startArgsIndex == -1)
 		return true;
@@ -203,6 +207,14 @@ bool SetCakelispOption(EvaluatorEnvironment& environment, const EvaluatorContext
 	    {"build-time-linker", &environment.buildTimeLinkCommand, SetProcessCommandFileToExec},
 	    {"build-time-link-arguments", &environment.buildTimeLinkCommand,
 	     SetProcessCommandArguments},
+	    {"build-time-static-linker", &environment.buildTimeStaticLinkCommand,
+	     SetProcessCommandFileToExec},
+	    {"build-time-static-link-arguments", &environment.buildTimeStaticLinkCommand,
+	     SetProcessCommandArguments},
+	    {"build-time-shared-linker", &environment.buildTimeSharedLinkCommand,
+	     SetProcessCommandFileToExec},
+	    {"build-time-shared-link-arguments", &environment.buildTimeSharedLinkCommand,
+	     SetProcessCommandArguments},
 	};
 
 	for (unsigned int i = 0; i < ArraySize(commandOptions); ++i)
@@ -210,7 +222,7 @@ bool SetCakelispOption(EvaluatorEnvironment& environment, const EvaluatorContext
 		if (tokens[optionNameIndex].contents.compare(commandOptions[i].optionName) == 0)
 		{
 			return commandOptions[i].handler(environment, tokens, startTokenIndex,
-			                                 commandOptions[i].command);
+			                                 /*valueArgumentIndex=*/2, commandOptions[i].command);
 		}
 	}
 
@@ -270,7 +282,7 @@ bool SetModuleOption(EvaluatorEnvironment& environment, const EvaluatorContext&
 		if (tokens[optionNameIndex].contents.compare(commandOptions[i].optionName) == 0)
 		{
 			return commandOptions[i].handler(environment, tokens, startTokenIndex,
-			                                 commandOptions[i].command);
+			                                 /*valueArgumentIndex=*/2, commandOptions[i].command);
 		}
 	}
 
@@ -369,6 +381,32 @@ bool AddCompileTimeHookGenerator(EvaluatorEnvironment& environment, const Evalua
 			return true;
 		}
 
+		if (!isModuleHook && hookName.contents.compare("post-build-process") == 0)
+		{
+			// Insert only if not already hooked
+			if (FindInContainer(environment.postBuildProcessHooks, hookFunction) ==
+			    environment.postBuildProcessHooks.end())
+			{
+				// Finally, check the signature so we can call it safely
+				static std::vector<Token> expectedSignature;
+				if (expectedSignature.empty())
+				{
+					if (!tokenizeLinePrintError(g_environmentPostBuildProcessHookSignature,
+					                            __FILE__, __LINE__, expectedSignature))
+						return false;
+				}
+
+				if (!CompileTimeFunctionSignatureMatches(environment, tokens[functionNameIndex],
+				                                         tokens[functionNameIndex].contents.c_str(),
+				                                         expectedSignature))
+					return false;
+
+				environment.postBuildProcessHooks.push_back((PostBuildProcessHook)hookFunction);
+			}
+
+			return true;
+		}
+
 		if (!isModuleHook && hookName.contents.compare("post-references-resolved") == 0)
 		{
 			// Insert only if not already hooked
@@ -591,6 +629,44 @@ bool AddBuildOptionGenerator(EvaluatorEnvironment& environment, const EvaluatorC
 	return true;
 }
 
+// (add-build-options-for-config "Release" "-O2" "-DNDEBUG")
+bool AddBuildOptionsForConfigGenerator(EvaluatorEnvironment& environment,
+                                       const EvaluatorContext& context,
+                                       const std::vector<Token>& tokens, int startTokenIndex,
+                                       GeneratorOutput& output)
+{
+	// Don't let the user think this function can be called during comptime
+	if (!ExpectEvaluatorScope("add-build-options-for-config", tokens[startTokenIndex], context,
+	                          EvaluatorScope_Module))
+		return false;
+
+	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
+	int labelIndex = getExpectedArgument("expected build configuration label", tokens,
+	                                     startTokenIndex, 1, endInvocationIndex);
+	if (labelIndex == -1 ||
+	    !ExpectTokenType("add-build-options-for-config", tokens[labelIndex], TokenType_String))
+		return false;
+
+	int firstOptionIndex = getExpectedArgument("expected build option(s)", tokens, startTokenIndex,
+	                                           2, endInvocationIndex);
+	if (firstOptionIndex == -1)
+		return false;
+
+	std::vector<std::string>& options =
+	    environment.buildConfigurationOptions[tokens[labelIndex].contents];
+	for (int i = firstOptionIndex; i < endInvocationIndex;
+	     i = getNextArgument(tokens, i, endInvocationIndex))
+	{
+		if (!ExpectTokenType("add-build-options-for-config", tokens[i], TokenType_String))
+			return false;
+
+		if (FindInContainer(options, tokens[i].contents) == options.end())
+			options.push_back(tokens[i].contents);
+	}
+
+	return true;
+}
+
 bool AddBuildConfigLabelGenerator(EvaluatorEnvironment& environment,
                                   const EvaluatorContext& context, const std::vector<Token>& tokens,
                                   int startTokenIndex, GeneratorOutput& output)
@@ -631,6 +707,174 @@ bool AddBuildConfigLabelGenerator(EvaluatorEnvironment& environment,
 	return true;
 }
 
+static BuildTarget* findBuildTarget(EvaluatorEnvironment& environment, const std::string& name)
+{
+	for (BuildTarget& target : environment.buildTargets)
+	{
+		if (target.outputName.compare(name) == 0)
+			return &target;
+	}
+	return nullptr;
+}
+
+// (add-build-target executable "bin/app" "App.cake" "Other.cake")
+// Modules are imported if they haven't been already
+bool AddBuildTargetGenerator(EvaluatorEnvironment& environment, const EvaluatorContext& context,
+                             const std::vector<Token>& tokens, int startTokenIndex,
+                             GeneratorOutput& output)
+{
+	// Don't let the user think this function can be called during comptime
+	if (!ExpectEvaluatorScope("add-build-target", tokens[startTokenIndex], context,
+	                          EvaluatorScope_Module))
+		return false;
+
+	if (!environment.moduleManager)
+	{
+		ErrorAtToken(tokens[startTokenIndex], "building not supported (internal code error?)");
+		return false;
+	}
+
+	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
+	int typeIndex =
+	    getExpectedArgument("expected target type", tokens, startTokenIndex, 1, endInvocationIndex);
+	if (typeIndex == -1 || !ExpectTokenType("add-build-target", tokens[typeIndex], TokenType_Symbol))
+		return false;
+
+	int nameIndex =
+	    getExpectedArgument("expected output path", tokens, startTokenIndex, 2, endInvocationIndex);
+	if (nameIndex == -1 || !ExpectTokenType("add-build-target", tokens[nameIndex], TokenType_String))
+		return false;
+
+	int firstModuleIndex = getExpectedArgument("expected module(s) to link", tokens,
+	                                           startTokenIndex, 3, endInvocationIndex);
+	if (firstModuleIndex == -1)
+		return false;
+
+	struct
+	{
+		const char* name;
+		BuildTargetType type;
+	} targetTypes[] = {{"executable", BuildTargetType_Executable},
+	                   {"static-library", BuildTargetType_StaticLibrary},
+	                   {"shared-library", BuildTargetType_SharedLibrary}};
+	const Token& typeToken = tokens[typeIndex];
+	int targetTypeIndex = -1;
+	for (unsigned int i = 0; i < ArraySize(targetTypes); ++i)
+	{
+		if (typeToken.contents.compare(targetTypes[i].name) == 0)
+		{
+			targetTypeIndex = i;
+			break;
+		}
+	}
+	if (targetTypeIndex == -1)
+	{
+		ErrorAtToken(typeToken, "unrecognized target type. Options are:");
+		for (unsigned int i = 0; i < ArraySize(targetTypes); ++i)
+			Logf("\t%s\n", targetTypes[i].name);
+		return false;
+	}
+
+	const Token& nameToken = tokens[nameIndex];
+	if (findBuildTarget(environment, nameToken.contents))
+	{
+		ErrorAtToken(nameToken, "a target with this output was already added");
+		return false;
+	}
+
+	BuildTarget newTarget = {};
+	newTarget.type = targetTypes[targetTypeIndex].type;
+	newTarget.outputName = nameToken.contents;
+	newTarget.nameToken = &nameToken;
+
+	for (int i = firstModuleIndex; i < endInvocationIndex;
+	     i = getNextArgument(tokens, i, endInvocationIndex))
+	{
+		const Token& moduleToken = tokens[i];
+		if (!ExpectTokenType("add-build-target", moduleToken, TokenType_String) ||
+		    moduleToken.contents.empty())
+			return false;
+
+		char resolvedPathBuffer[MAX_PATH_LENGTH] = {0};
+		if (!searchForFileInPathsWithError(moduleToken.contents.c_str(),
+		                                   /*encounteredInFile=*/moduleToken.source,
+		                                   environment.searchPaths, resolvedPathBuffer,
+		                                   ArraySize(resolvedPathBuffer), moduleToken))
+			return false;
+
+		Module* module = nullptr;
+		if (!moduleManagerAddEvaluateFile(*environment.moduleManager, resolvedPathBuffer,
+		                                  &module) ||
+		    !module)
+		{
+			ErrorAtToken(moduleToken, "failed to import Cakelisp module");
+			return false;
+		}
+
+		if (FindInContainer(newTarget.modules, module) == newTarget.modules.end())
+			newTarget.modules.push_back(module);
+	}
+
+	environment.buildTargets.push_back(newTarget);
+	return true;
+}
+
+// (set-build-target-option "bin/app" build-time-link-arguments "-o" 'executable-output ...)
+bool SetBuildTargetOptionGenerator(EvaluatorEnvironment& environment,
+                                   const EvaluatorContext& context,
+                                   const std::vector<Token>& tokens, int startTokenIndex,
+                                   GeneratorOutput& output)
+{
+	// Don't let the user think this function can be called during comptime
+	if (!ExpectEvaluatorScope("set-build-target-option", tokens[startTokenIndex], context,
+	                          EvaluatorScope_Module))
+		return false;
+
+	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
+	int nameIndex = getExpectedArgument("expected target output", tokens, startTokenIndex, 1,
+	                                    endInvocationIndex);
+	if (nameIndex == -1 ||
+	    !ExpectTokenType("set-build-target-option", tokens[nameIndex], TokenType_String))
+		return false;
+
+	int optionNameIndex =
+	    getExpectedArgument("expected option name", tokens, startTokenIndex, 2, endInvocationIndex);
+	if (optionNameIndex == -1)
+		return false;
+
+	BuildTarget* target = findBuildTarget(environment, tokens[nameIndex].contents);
+	if (!target)
+	{
+		ErrorAtToken(tokens[nameIndex],
+		             "target not found. Targets must be added with add-build-target before their "
+		             "options are set");
+		return false;
+	}
+
+	struct ProcessCommandOptions
+	{
+		const char* optionName;
+		ProcessCommandOptionFunc handler;
+	};
+	ProcessCommandOptions commandOptions[] = {
+	    {"build-time-linker", SetProcessCommandFileToExec},
+	    {"build-time-link-arguments", SetProcessCommandArguments},
+	};
+
+	for (unsigned int i = 0; i < ArraySize(commandOptions); ++i)
+	{
+		if (tokens[optionNameIndex].contents.compare(commandOptions[i].optionName) == 0)
+		{
+			return commandOptions[i].handler(environment, tokens, startTokenIndex,
+			                                 /*valueArgumentIndex=*/3,
+			                                 &target->linkCommandOverride);
+		}
+	}
+
+	ErrorAtToken(tokens[optionNameIndex], "unrecognized option");
+	return false;
+}
+
 bool SkipBuildGenerator(EvaluatorEnvironment& environment, const EvaluatorContext& context,
                         const std::vector<Token>& tokens, int startTokenIndex,
                         GeneratorOutput& output)
@@ -1079,6 +1323,17 @@ bool DefunGenerator(EvaluatorEnvironment& environment, const EvaluatorContext& c
 	return true;
 }
 
+// Unity builds need to know which types would conflict if modules were compiled together
+static void addModuleLocalTypeName(const EvaluatorContext& context, const Token& nameToken)
+{
+	if (context.scope != EvaluatorScope_Module || !context.module)
+		return;
+
+	std::vector<std::string>& localTypeNames = context.module->localTypeNames;
+	if (FindInContainer(localTypeNames, nameToken.contents) == localTypeNames.end())
+		localTypeNames.push_back(nameToken.contents);
+}
+
 bool DefFunctionSignatureGenerator(EvaluatorEnvironment& environment,
                                    const EvaluatorContext& context,
                                    const std::vector<Token>& tokens, int startTokenIndex,
@@ -1111,6 +1366,8 @@ bool DefFunctionSignatureGenerator(EvaluatorEnvironment& environment,
 
 	if (context.scope != EvaluatorScope_Module && isModuleLocal)
 		NoteAtToken(tokens[startTokenIndex + 1], "no need to specify local if in body scope");
+	if (isModuleLocal)
+		addModuleLocalTypeName(context, nameToken);
 
 	std::vector<StringOutput>& outputDest = isModuleLocal ? output.source : output.header;
 
@@ -1733,6 +1990,18 @@ bool DefMacroGenerator(EvaluatorEnvironment& environment, const EvaluatorContext
 	StripInvocation(startNameTokenIndex, endTokenIndex);
 
 	int nameIndex = startNameTokenIndex;
+	// Pure macros promise their output depends only on their arguments, so expansions can be reused
+	bool isPure = false;
+	if (tokens[nameIndex].type == TokenType_Symbol &&
+	    tokens[nameIndex].contents.compare("&pure") == 0)
+	{
+		isPure = true;
+		++nameIndex;
+		if (!ExpectInInvocation("defmacro expected name", tokens, nameIndex,
+		                        endInvocationTokenIndex))
+			return false;
+	}
+
 	const Token& nameToken = tokens[nameIndex];
 	if (!ExpectTokenType("defmacro", nameToken, TokenType_Symbol))
 		return false;
@@ -1815,6 +2084,26 @@ bool DefMacroGenerator(EvaluatorEnvironment& environment, const EvaluatorContext
 
 	addLangTokenOutput(compTimeOutput->source, StringOutMod_CloseBlock, &tokens[endTokenIndex]);
 
+	// Simple macros can skip compilation and be interpreted instead. The compiled version is still
+	// output above in case the interpreter is disabled. Always replace the previous entry, in case
+	// this is a redefinition which is no longer simple enough
+	InterpretedMacroTableIterator findInterpretedIt =
+	    environment.interpretedMacros.find(nameToken.contents);
+	if (findInterpretedIt != environment.interpretedMacros.end())
+	{
+		delete findInterpretedIt->second;
+		environment.interpretedMacros.erase(findInterpretedIt);
+	}
+	if (environment.useInterpreter)
+	{
+		InterpretedMacro* interpretedMacro =
+		    interpreterCompileMacro(tokens, startTokenIndex, argsIndex);
+		if (interpretedMacro)
+			environment.interpretedMacros[nameToken.contents] = interpretedMacro;
+	}
+
+	setMacroPure(environment, tokens, startTokenIndex, nameToken.contents, isPure);
+
 	return true;
 }
 
@@ -1929,6 +2218,8 @@ bool DefStructGenerator(EvaluatorEnvironment& environment, const EvaluatorContex
 	                tokens[startTokenIndex + 1].contents.compare("defstruct") == 0;
 
 	std::vector<StringOutput>& outputDest = isGlobal ? output.header : output.source;
+	if (!isGlobal)
+		addModuleLocalTypeName(context, tokens[nameIndex]);
 
 	addStringOutput(outputDest, "struct", StringOutMod_SpaceAfter, &tokens[startTokenIndex]);
 
@@ -2268,6 +2559,8 @@ static bool DefTypeAliasGenerator(EvaluatorEnvironment& environment,
 	addModifierToStringOutput(typeOutput.back(), StringOutMod_SpaceAfter);
 
 	std::vector<StringOutput>& outputDest = isGlobal ? output.header : output.source;
+	if (!isGlobal)
+		addModuleLocalTypeName(context, tokens[nameIndex]);
 
 	addStringOutput(outputDest, "typedef", StringOutMod_SpaceAfter, &invocationToken);
 	PushBackAll(outputDest, typeOutput);
@@ -2289,16 +2582,52 @@ bool IgnoreGenerator(EvaluatorEnvironment& environment, const EvaluatorContext&
 	return true;
 }
 
-// I'm not too happy with this
-static void tokenizeGenerateStringTokenize(const char* outputVarName, const Token& triggerToken,
-                                           const char* stringToTokenize, GeneratorOutput& output)
+// Output the quoted tokens as a constant array, so expanding the macro only copies them rather than
+// tokenizing them from a string every time. The array is static so it's only constructed once
+static void tokenizePushOutputTemplate(EvaluatorEnvironment& environment,
+                                       const EvaluatorContext& context, const char* outputVarName,
+                                       const std::vector<Token>& tokens, int startTemplateIndex,
+                                       int endTemplateIndex, GeneratorOutput& output)
 {
-	// TODO Need to gensym error, or replace with a function call
-	char tokenizeLineBuffer[2048] = {0};
-	PrintfBuffer(tokenizeLineBuffer,
-	             "if (!tokenizeLinePrintError(\"%s\", \"%s\", %d, %s)) {return false;}",
-	             stringToTokenize, triggerToken.source, triggerToken.lineNumber, outputVarName);
-	addStringOutput(output.source, tokenizeLineBuffer, StringOutMod_NewlineAfter, &triggerToken);
+	const Token& triggerToken = tokens[startTemplateIndex];
+	Token templateName = triggerToken;
+	MakeContextUniqueSymbolName(environment, context, "tokenizePushTemplate", &templateName);
+
+	const char* tokenTypeNames[] = {"TokenType_OpenParen", "TokenType_CloseParen",
+	                                "TokenType_Symbol", "TokenType_String"};
+
+	std::string templateDefinition = "static const Token ";
+	templateDefinition += templateName.contents;
+	templateDefinition += "[] = {";
+	for (int i = startTemplateIndex; i < endTemplateIndex; ++i)
+	{
+		const Token& token = tokens[i];
+		// Contents are written as-is, so the C++ compiler unescapes them, as it did when templates
+		// were strings to tokenize
+		templateDefinition += "{";
+		templateDefinition += tokenTypeNames[token.type];
+		templateDefinition += ", \"";
+		templateDefinition += token.contents;
+		templateDefinition += "\", \"";
+		templateDefinition += token.source;
+		templateDefinition += "\", ";
+		templateDefinition += std::to_string(token.lineNumber);
+		templateDefinition += ", ";
+		templateDefinition += std::to_string(token.columnStart);
+		templateDefinition += ", ";
+		templateDefinition += std::to_string(token.columnEnd);
+		templateDefinition += "}";
+		if (i + 1 < endTemplateIndex)
+			templateDefinition += ", ";
+	}
+	templateDefinition += "};";
+	addStringOutput(output.source, templateDefinition, StringOutMod_NewlineAfter, &triggerToken);
+
+	char pushBuffer[512] = {0};
+	PrintfBuffer(pushBuffer, "%s.insert(%s.end(), %s, %s + %d);", outputVarName, outputVarName,
+	             templateName.contents.c_str(), templateName.contents.c_str(),
+	             endTemplateIndex - startTemplateIndex);
+	addStringOutput(output.source, pushBuffer, StringOutMod_NewlineAfter, &triggerToken);
 }
 
 bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorContext& context,
@@ -2336,11 +2665,8 @@ bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 		addLangTokenOutput(output.source, StringOutMod_EndStatement, &tokens[startTokenIndex + 1]);
 	}
 
-	// This is odd: convert tokens in the macro invocation into string, then the generated C++ will
-	// use that string to create tokens...
-	char tokenToStringBuffer[1024] = {0};
-	char* tokenToStringWrite = tokenToStringBuffer;
-	const Token* tokenToStringStartToken = nullptr;
+	// Runs of quoted tokens between splices are output as constant token arrays
+	int startTemplateIndex = -1;
 	int startOutputToken = getExpectedArgument("tokenize-push expected tokens to output", tokens,
 	                                           startTokenIndex, 2, endInvocationIndex);
 	if (startOutputToken == -1)
@@ -2359,14 +2685,12 @@ bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 			bool isArray = nextToken.contents.compare("token-splice-array") == 0;
 			bool tokenMakePointer = nextToken.contents.compare("token-splice-addr") == 0;
 
-			if (tokenToStringWrite != tokenToStringBuffer)
+			if (startTemplateIndex != -1)
 			{
-				*tokenToStringWrite = '\0';
-				tokenizeGenerateStringTokenize(evaluateOutputTempVar.contents.c_str(),
-				                               *tokenToStringStartToken, tokenToStringBuffer,
-				                               output);
-				tokenToStringWrite = tokenToStringBuffer;
-				tokenToStringStartToken = nullptr;
+				tokenizePushOutputTemplate(environment, context,
+				                           evaluateOutputTempVar.contents.c_str(), tokens,
+				                           startTemplateIndex, i, output);
+				startTemplateIndex = -1;
 			}
 
 			// Skip invocation
@@ -2404,26 +2728,16 @@ bool TokenizePushGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 		}
 		else
 		{
-			// All other tokens are "quoted" and added to string to output at compile-time
-			if (!tokenToStringStartToken)
-				tokenToStringStartToken = &currentToken;
-
-			if (!appendTokenToString(currentToken, &tokenToStringWrite, tokenToStringBuffer,
-			                         sizeof(tokenToStringBuffer)))
-				return false;
+			// All other tokens are "quoted" and copied to the output at compile-time
+			if (startTemplateIndex == -1)
+				startTemplateIndex = i;
 		}
 	}
 
 	// Finish up leftover tokens
-	if (tokenToStringWrite != tokenToStringBuffer)
-	{
-		*tokenToStringWrite = '\0';
-		tokenizeGenerateStringTokenize(evaluateOutputTempVar.contents.c_str(),
-		                               *tokenToStringStartToken, tokenToStringBuffer, output);
-		// We don't really need to reset it, but we will
-		tokenToStringWrite = tokenToStringBuffer;
-		tokenToStringStartToken = nullptr;
-	}
+	if (startTemplateIndex != -1)
+		tokenizePushOutputTemplate(environment, context, evaluateOutputTempVar.contents.c_str(),
+		                           tokens, startTemplateIndex, endInvocationIndex, output);
 
 	return true;
 }
@@ -2783,6 +3097,9 @@ void importFundamentalGenerators(EvaluatorEnvironment& environment)
 	environment.generators["add-c-search-directory"] = AddCSearchDirectoryGenerator;
 	environment.generators["add-cakelisp-search-directory"] = AddCakelispSearchPathGenerator;
 	environment.generators["add-build-config-label"] = AddBuildConfigLabelGenerator;
+	environment.generators["add-build-options-for-config"] = AddBuildOptionsForConfigGenerator;
+	environment.generators["add-build-target"] = AddBuildTargetGenerator;
+	environment.generators["set-build-target-option"] = SetBuildTargetOptionGenerator;
 
 	// Dispatches based on invocation name
 	const char* cStatementKeywords[] = {
@@ -0,0 +1,413 @@
+#include "Interpreter.hpp"
+
+#include "GeneratorHelpers.hpp"
+#include "Utilities.hpp"
+
+// Bound arguments are kept on the stack while running
+static const int maxInterpretedMacroArguments = 32;
+
+// Compiled macros write tokenize-push's quoted tokens' contents into C string literals, which the
+// C++ compiler unescapes. Only escaped backslashes are simple enough to reproduce; anything else is
+// left to the compiler
+static bool unescapeLikeStringLiteral(const std::string& contents, std::string& unescapedOut)
+{
+	unescapedOut.clear();
+	unescapedOut.reserve(contents.size());
+	for (size_t i = 0; i < contents.size(); ++i)
+	{
+		if (contents[i] == '\\')
+		{
+			if (i + 1 >= contents.size() || contents[i + 1] != '\\')
+				return false;
+			++i;
+		}
+		unescapedOut.push_back(contents[i]);
+	}
+	return true;
+}
+
+static int findArgument(const InterpretedMacro& macro, const Token& nameToken)
+{
+	for (int i = 0; i < (int)macro.arguments.size(); ++i)
+	{
+		if (macro.arguments[i].name->contents.compare(nameToken.contents) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static bool parseArguments(const std::vector<Token>& tokens, int startArgsIndex,
+                           InterpretedMacro& macro)
+{
+	int endArgsIndex = FindCloseParenTokenIndex(tokens, startArgsIndex);
+	// Compiled macros without arguments don't check them at all
+	if (startArgsIndex + 1 == endArgsIndex)
+		return true;
+
+	bool isOptional = false;
+	bool checkArgCount = true;
+	macro.numRequiredArguments = 1;  // Invocation counts as one
+
+	for (int i = startArgsIndex + 1; i < endArgsIndex; i = getNextArgument(tokens, i, endArgsIndex))
+	{
+		if (tokens[i].type == TokenType_Symbol && isSpecialSymbol(tokens[i]))
+		{
+			if (tokens[i].contents.compare("&optional") == 0)
+				isOptional = true;
+			else if (tokens[i].contents.compare("&rest") == 0)
+				checkArgCount = false;
+			else
+				return false;
+			continue;
+		}
+
+		int typeIndex = getNextArgument(tokens, i, endArgsIndex);
+		if (tokens[i].type != TokenType_Symbol || typeIndex >= endArgsIndex)
+			return false;
+
+		InterpreterArgument argument = {};
+		argument.name = &tokens[i];
+		argument.isOptional = isOptional;
+		argument.bindType = InterpreterBindType_Pointer;
+
+		const Token* containedType = &tokens[typeIndex];
+		if (containedType->type == TokenType_OpenParen)
+		{
+			if (tokens[typeIndex + 1].contents.compare("index") == 0)
+				argument.bindType = InterpreterBindType_Index;
+			else if (tokens[typeIndex + 1].contents.compare("ref") == 0)
+				argument.bindType = InterpreterBindType_Reference;
+			else
+				return false;
+			containedType = &tokens[typeIndex + 2];
+		}
+
+		argument.checkType = true;
+		if (containedType->contents.compare("any") == 0)
+			argument.checkType = false;
+		else if (containedType->contents.compare("string") == 0)
+			argument.expectedType = TokenType_String;
+		else if (containedType->contents.compare("symbol") == 0)
+			argument.expectedType = TokenType_Symbol;
+		else if (containedType->contents.compare("array") == 0)
+			argument.expectedType = TokenType_OpenParen;
+		else
+			return false;
+
+		if ((int)macro.arguments.size() >= maxInterpretedMacroArguments)
+			return false;
+		macro.arguments.push_back(argument);
+		if (!isOptional)
+			++macro.numRequiredArguments;
+
+		i = typeIndex;
+	}
+
+	macro.checkNumArguments = checkArgCount && !isOptional;
+	return true;
+}
+
+// Conditions may only check whether a pointer argument was provided, because that's the only check
+// which means the same thing when compiled
+static bool compileCondition(const std::vector<Token>& tokens, int conditionIndex,
+                             const InterpretedMacro& macro, InterpreterOperation& jumpOut)
+{
+	const Token& condition = tokens[conditionIndex];
+	if (condition.type == TokenType_Symbol)
+	{
+		int argumentIndex = findArgument(macro, condition);
+		if (argumentIndex == -1 ||
+		    macro.arguments[argumentIndex].bindType != InterpreterBindType_Pointer)
+			return false;
+
+		jumpOut.argumentIndex = argumentIndex;
+		jumpOut.isProvided = true;
+		return true;
+	}
+
+	if (condition.type != TokenType_OpenParen ||
+	    tokens[conditionIndex + 1].contents.compare("not") != 0)
+		return false;
+
+	int endConditionIndex = FindCloseParenTokenIndex(tokens, conditionIndex);
+	int negatedIndex = conditionIndex + 2;
+	if (negatedIndex >= endConditionIndex ||
+	    getNextArgument(tokens, negatedIndex, endConditionIndex) != endConditionIndex)
+		return false;
+
+	if (!compileCondition(tokens, negatedIndex, macro, jumpOut))
+		return false;
+	jumpOut.isProvided = !jumpOut.isProvided;
+	return true;
+}
+
+static bool compileTokenizePush(const std::vector<Token>& tokens, int startTokenIndex,
+                                InterpretedMacro& macro)
+{
+	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
+	int outputIndex = getArgument(tokens, startTokenIndex, 1, endInvocationIndex);
+	if (outputIndex == -1 || tokens[outputIndex].contents.compare("output") != 0)
+		return false;
+
+	int pushOperation = -1;
+	for (int i = outputIndex + 1; i < endInvocationIndex; ++i)
+	{
+		const Token& currentToken = tokens[i];
+		const Token& nextToken = tokens[i + 1];
+		if (currentToken.type == TokenType_OpenParen && nextToken.type == TokenType_Symbol &&
+		    (nextToken.contents.compare("token-splice") == 0 ||
+		     nextToken.contents.compare("token-splice-addr") == 0 ||
+		     nextToken.contents.compare("token-splice-array") == 0))
+		{
+			// Arrays are only ever local variables, which the interpreter doesn't have
+			if (nextToken.contents.compare("token-splice-array") == 0)
+				return false;
+
+			// Compiled macros pass the splice straight to PushBackTokenExpression(), so only the
+			// binding which is already a pointer will compile
+			InterpreterBindType requiredBindType =
+			    nextToken.contents.compare("token-splice-addr") == 0 ?
+			        InterpreterBindType_Reference :
+			        InterpreterBindType_Pointer;
+
+			int endSpliceIndex = FindCloseParenTokenIndex(tokens, i);
+			for (int spliceArg = i + 2; spliceArg < endSpliceIndex; ++spliceArg)
+			{
+				if (tokens[spliceArg].type != TokenType_Symbol)
+					return false;
+
+				int argumentIndex = findArgument(macro, tokens[spliceArg]);
+				if (argumentIndex == -1 ||
+				    macro.arguments[argumentIndex].bindType != requiredBindType)
+					return false;
+
+				InterpreterOperation splice = {};
+				splice.type = InterpreterOperation_SpliceArgument;
+				splice.argumentIndex = argumentIndex;
+				macro.operations.push_back(splice);
+			}
+
+			i = endSpliceIndex;
+			pushOperation = -1;
+			continue;
+		}
+
+		Token quotedToken = currentToken;
+		if (!unescapeLikeStringLiteral(currentToken.contents, quotedToken.contents))
+			return false;
+
+		// Consecutive quoted tokens are pushed in one operation
+		int templateIndex = (int)macro.templateTokens.size();
+		macro.templateTokens.push_back(quotedToken);
+		if (pushOperation != -1)
+		{
+			++macro.operations[pushOperation].endTokenIndex;
+		}
+		else
+		{
+			InterpreterOperation push = {};
+			push.type = InterpreterOperation_PushTokens;
+			push.startTokenIndex = templateIndex;
+			push.endTokenIndex = templateIndex + 1;
+			pushOperation = (int)macro.operations.size();
+			macro.operations.push_back(push);
+		}
+	}
+
+	return true;
+}
+
+static bool compileStatement(const std::vector<Token>& tokens, int statementIndex,
+                             InterpretedMacro& macro);
+
+static bool compileStatements(const std::vector<Token>& tokens, int startIndex, int endIndex,
+                              InterpretedMacro& macro)
+{
+	for (int i = startIndex; i < endIndex; i = getNextArgument(tokens, i, endIndex))
+	{
+		if (!compileStatement(tokens, i, macro))
+			return false;
+	}
+	return true;
+}
+
+static bool compileStatement(const std::vector<Token>& tokens, int statementIndex,
+                             InterpretedMacro& macro)
+{
+	if (tokens[statementIndex].type != TokenType_OpenParen)
+		return false;
+
+	const Token& invocation = tokens[statementIndex + 1];
+	int endInvocationIndex = FindCloseParenTokenIndex(tokens, statementIndex);
+
+	if (invocation.contents.compare("tokenize-push") == 0)
+		return compileTokenizePush(tokens, statementIndex, macro);
+
+	if (invocation.contents.compare("return") == 0)
+	{
+		int valueIndex = statementIndex + 2;
+		if (valueIndex + 1 != endInvocationIndex)
+			return false;
+
+		InterpreterOperation returnOperation = {};
+		returnOperation.type = InterpreterOperation_Return;
+		if (tokens[valueIndex].contents.compare("true") == 0)
+			returnOperation.returnValue = true;
+		else if (tokens[valueIndex].contents.compare("false") == 0)
+			returnOperation.returnValue = false;
+		else
+			return false;
+		macro.operations.push_back(returnOperation);
+		return true;
+	}
+
+	bool isWhen = invocation.contents.compare("when") == 0;
+	bool isUnless = invocation.contents.compare("unless") == 0;
+	bool isIf = invocation.contents.compare("if") == 0;
+	if (!isWhen && !isUnless && !isIf)
+		return false;
+
+	int conditionIndex = statementIndex + 2;
+	if (conditionIndex >= endInvocationIndex)
+		return false;
+	int startBodyIndex = getNextArgument(tokens, conditionIndex, endInvocationIndex);
+	if (startBodyIndex >= endInvocationIndex)
+		return false;
+
+	InterpreterOperation skipBody = {};
+	skipBody.type = InterpreterOperation_JumpUnlessProvided;
+	if (!compileCondition(tokens, conditionIndex, macro, skipBody))
+		return false;
+	if (isUnless)
+		skipBody.isProvided = !skipBody.isProvided;
+	int skipBodyOperation = (int)macro.operations.size();
+	macro.operations.push_back(skipBody);
+
+	if (!isIf)
+	{
+		if (!compileStatements(tokens, startBodyIndex, endInvocationIndex, macro))
+			return false;
+		macro.operations[skipBodyOperation].target = (int)macro.operations.size();
+		return true;
+	}
+
+	int elseIndex = getNextArgument(tokens, startBodyIndex, endInvocationIndex);
+	if (elseIndex < endInvocationIndex &&
+	    getNextArgument(tokens, elseIndex, endInvocationIndex) != endInvocationIndex)
+		return false;
+
+	if (!compileStatement(tokens, startBodyIndex, macro))
+		return false;
+
+	int skipElseOperation = (int)macro.operations.size();
+	InterpreterOperation skipElse = {};
+	skipElse.type = InterpreterOperation_Jump;
+	macro.operations.push_back(skipElse);
+
+	macro.operations[skipBodyOperation].target = (int)macro.operations.size();
+	if (elseIndex < endInvocationIndex && !compileStatement(tokens, elseIndex, macro))
+		return false;
+	macro.operations[skipElseOperation].target = (int)macro.operations.size();
+	return true;
+}
+
+InterpretedMacro* interpreterCompileMacro(const std::vector<Token>& tokens, int startTokenIndex,
+                                          int argsIndex)
+{
+	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
+	int startBodyIndex = getNextArgument(tokens, argsIndex, endInvocationIndex);
+
+	// Compiled macros which don't end in a return have undefined behavior, so there's nothing
+	// sensible to interpret
+	int lastStatementIndex = -1;
+	for (int i = startBodyIndex; i < endInvocationIndex;
+	     i = getNextArgument(tokens, i, endInvocationIndex))
+		lastStatementIndex = i;
+	if (lastStatementIndex == -1 || tokens[lastStatementIndex].type != TokenType_OpenParen ||
+	    tokens[lastStatementIndex + 1].contents.compare("return") != 0)
+		return nullptr;
+
+	InterpretedMacro* macro = new InterpretedMacro;
+	macro->checkNumArguments = false;
+	macro->numRequiredArguments = 0;
+	macro->isLoaded = false;
+	if (!parseArguments(tokens, argsIndex, *macro) ||
+	    !compileStatements(tokens, startBodyIndex, endInvocationIndex, *macro))
+	{
+		delete macro;
+		return nullptr;
+	}
+
+	return macro;
+}
+
+bool interpreterRunMacro(const InterpretedMacro& macro, EvaluatorEnvironment& environment,
+                         const EvaluatorContext& context, const std::vector<Token>& tokens,
+                         int startTokenIndex, std::vector<Token>& output)
+{
+	int endInvocationIndex = FindCloseParenTokenIndex(tokens, startTokenIndex);
+
+	// Bind arguments exactly like ComptimeGenerateTokenArguments() generated code would
+	int argumentTokenIndices[maxInterpretedMacroArguments];
+	for (int i = 0; i < (int)macro.arguments.size(); ++i)
+	{
+		const InterpreterArgument& argument = macro.arguments[i];
+		int argumentIndex =
+		    argument.isOptional ?
+		        getArgument(tokens, startTokenIndex, i + 1, endInvocationIndex) :
+		        getExpectedArgument(argument.name->contents.c_str(), tokens, startTokenIndex, i + 1,
+		                            endInvocationIndex);
+		if (argumentIndex == -1 && !argument.isOptional)
+			return false;
+
+		if (argument.checkType && argumentIndex != -1 &&
+		    !ExpectTokenType(argument.name->contents.c_str(), tokens[argumentIndex],
+		                     argument.expectedType))
+			return false;
+
+		argumentTokenIndices[i] = argumentIndex;
+	}
+
+	if (macro.checkNumArguments &&
+	    !ExpectNumArguments(tokens, startTokenIndex, endInvocationIndex,
+	                        macro.numRequiredArguments))
+		return false;
+
+	int numOperations = (int)macro.operations.size();
+	for (int i = 0; i < numOperations;)
+	{
+		const InterpreterOperation& operation = macro.operations[i];
+		switch (operation.type)
+		{
+			case InterpreterOperation_PushTokens:
+				output.insert(output.end(),
+				              macro.templateTokens.begin() + operation.startTokenIndex,
+				              macro.templateTokens.begin() + operation.endTokenIndex);
+				++i;
+				break;
+			case InterpreterOperation_SpliceArgument:
+			{
+				int argumentIndex = argumentTokenIndices[operation.argumentIndex];
+				PushBackTokenExpression(output,
+				                        argumentIndex != -1 ? &tokens[argumentIndex] : nullptr);
+				++i;
+				break;
+			}
+			case InterpreterOperation_JumpUnlessProvided:
+			{
+				bool isProvided = argumentTokenIndices[operation.argumentIndex] != -1;
+				i = isProvided == operation.isProvided ? i + 1 : operation.target;
+				break;
+			}
+			case InterpreterOperation_Jump:
+				i = operation.target;
+				break;
+			case InterpreterOperation_Return:
+				return operation.returnValue;
+		}
+	}
+
+	// interpreterCompileMacro() makes sure the body ends in a return, but a branch could skip it
+	Log("error: interpreted macro did not return a value. Internal code error?\n");
+	return false;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+
+#include "Tokenizer.hpp"
+
+// Runs simple macros directly from their tokens, so they don't need to be compiled, linked, and
+// loaded before they can be invoked. Only macros made of tokenize-push, conditionals on whether
+// optional arguments were provided, and returning true or false are understood. Everything else is
+// compiled as usual, including loops and calls to GeneratorHelpers functions, which would need
+// local variables and C++ values. See "Interpreted macros" in doc/Cakelisp.org
+
+struct EvaluatorContext;
+struct EvaluatorEnvironment;
+
+enum InterpreterBindType
+{
+	InterpreterBindType_Index,
+	InterpreterBindType_Pointer,
+	InterpreterBindType_Reference
+};
+
+struct InterpreterArgument
+{
+	const Token* name;
+	InterpreterBindType bindType;
+	bool isOptional;
+	// Arguments of type any are not checked
+	bool checkType;
+	TokenType expectedType;
+};
+
+enum InterpreterOperationType
+{
+	// Copy templateTokens [startTokenIndex, endTokenIndex) to the output
+	InterpreterOperation_PushTokens,
+	// Copy the argument's whole expression to the output
+	InterpreterOperation_SpliceArgument,
+	// Go to target if whether the argument was provided doesn't match isProvided
+	InterpreterOperation_JumpUnlessProvided,
+	InterpreterOperation_Jump,
+	InterpreterOperation_Return
+};
+
+struct InterpreterOperation
+{
+	InterpreterOperationType type;
+	int startTokenIndex;
+	int endTokenIndex;
+	int argumentIndex;
+	bool isProvided;
+	int target;
+	bool returnValue;
+};
+
+struct InterpretedMacro
+{
+	// The quoted tokens of every tokenize-push, already unescaped like compiled macros would
+	std::vector<Token> templateTokens;
+	// Names point into the defmacro's tokens, which live as long as the environment
+	std::vector<InterpreterArgument> arguments;
+	// Same rules as compiled macros' generated argument checks
+	bool checkNumArguments;
+	int numRequiredArguments;
+
+	std::vector<InterpreterOperation> operations;
+
+	// Set once the macro is required, which is when a compiled macro would be built and loaded
+	bool isLoaded;
+};
+
+// Returns null if the macro uses something the interpreter doesn't support. The definition must
+// have already been evaluated successfully, which validates its arguments. argsIndex is the
+// defmacro's argument list, which comes after the name and any modifiers like &pure
+InterpretedMacro* interpreterCompileMacro(const std::vector<Token>& tokens, int startTokenIndex,
+                                          int argsIndex);
+
+// Same signature and behavior as a compiled MacroFunc
+bool interpreterRunMacro(const InterpretedMacro& macro, EvaluatorEnvironment& environment,
+                         const EvaluatorContext& context, const std::vector<Token>& tokens,
+                         int startTokenIndex, std::vector<Token>& output);
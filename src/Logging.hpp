@@ -23,6 +23,8 @@ struct LoggingSettings
 	bool performance;
 	bool includeScanning;
 	bool strictIncludes;
+
+	bool memory;
 };
 
 extern LoggingSettings logging;
@@ -1,12 +1,19 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <vector>
 
+#ifdef UNIX
+#include <sys/resource.h>  // getrusage
+#endif
+
+#include "Evaluator.hpp"
 #include "FileUtilities.hpp"
 #include "Logging.hpp"
 #include "ModuleManager.hpp"
 #include "RunProcess.hpp"
+#include "Tracing.hpp"
 #include "Utilities.hpp"
 
 struct CommandLineOption
@@ -14,6 +21,8 @@ struct CommandLineOption
 	const char* handle;
 	bool* toggleOnOut;
 	const char* help;
+	// If set, the option takes the next argument as its value instead of being a toggle
+	const char** valueOut;
 };
 
 void printHelp(const CommandLineOption* options, int numOptions)
@@ -30,7 +39,8 @@ void printHelp(const CommandLineOption* options, int numOptions)
 
 	for (int optionIndex = 0; optionIndex < numOptions; ++optionIndex)
 	{
-		Logf("  %s\n    %s\n\n", options[optionIndex].handle, options[optionIndex].help);
+		Logf("  %s%s\n    %s\n\n", options[optionIndex].handle,
+		     options[optionIndex].valueOut ? " <value>" : "", options[optionIndex].help);
 	}
 }
 
@@ -43,63 +53,116 @@ int main(int numArguments, char* arguments[])
 	bool ignoreCachedFiles = false;
 	bool executeOutput = false;
 	bool listBuiltInGeneratorsThenQuit = false;
+	const char* traceOutputFilename = nullptr;
+	bool profileInvocations = false;
+	bool disableInterpreter = false;
+	bool cacheMacroExpansions = false;
+	const char* compileTimeOptimizeThreshold = nullptr;
+	const char* invocationProfileCsvFilename = nullptr;
+	const char* buildConfigurations = nullptr;
+	bool unityBuild = false;
+	bool pipeCompileTimeSource = false;
 
 	const CommandLineOption options[] = {
 	    {"--ignore-cache", &ignoreCachedFiles,
 	     "Prohibit skipping an operation if the resultant file is already in the cache (and the "
 	     "source file hasn't been modified more recently). This is a good way to test a 'clean' "
-	     "build without having to delete the Cakelisp cache directory"},
+	     "build without having to delete the Cakelisp cache directory", nullptr},
 	    {"--execute", &executeOutput,
 	     "If building completes successfully, run the output executable. Its working directory "
 	     "will be the final location of the executable. This allows Cakelisp code to be run as if "
-	     "it were a script"},
+	     "it were a script", nullptr},
 	    {"--list-built-ins", &listBuiltInGeneratorsThenQuit,
 	     "List all built-in compile-time procedures, then exit. This list contains every procedure "
-	     "you can possibly call, until you import more or define your own"},
+	     "you can possibly call, until you import more or define your own", nullptr},
+	    {"--trace", nullptr,
+	     "Record how long each phase, file, macro, generator, and subprocess takes, then write it "
+	     "to the given file in Chrome's trace event format. Open it in chrome://tracing or "
+	     "https://ui.perfetto.dev",
+	     &traceOutputFilename},
+	    {"--no-interpreter", &disableInterpreter,
+	     "Compile every macro, even those simple enough to be run by the interpreter. Use this if "
+	     "you suspect an interpreted macro behaves differently than it would compiled", nullptr},
+	    {"--cache-macro-expansions", &cacheMacroExpansions,
+	     "Save the expansions of macros defined with &pure to the cache, so later runs can reuse "
+	     "them instead of running the macros again", nullptr},
+	    {"--comptime-optimize-threshold", nullptr,
+	     "Rebuild compile-time macros and generators with optimizations once they are invoked at "
+	     "least this many times in one run (default 500). The optimized build is used by later "
+	     "runs. 0 disables optimized builds",
+	     &compileTimeOptimizeThreshold},
+	    {"--configs", nullptr,
+	     "Build each of the given comma-separated build configurations, e.g. Debug,Release. Files "
+	     "are only evaluated once, then every configuration is compiled and linked at the same "
+	     "time. Each configuration's outputs go in a directory named after it, next to where "
+	     "they would normally go",
+	     &buildConfigurations},
+	    {"--unity-build", &unityBuild,
+	     "Compile generated modules in groups, each group as a single source file, instead of "
+	     "running the compiler once per module. Modules stay in the same groups between runs, so "
+	     "changing a module only rebuilds its group", nullptr},
+	    {"--pipe-compile-time-source", &pipeCompileTimeSource,
+	     "Pipe the source of compile-time code straight to the compiler's stdin instead of "
+	     "writing it to the cache first. Headers other compile-time code includes are still "
+	     "written. This helps when the cache is on a slow file system. The compiler must accept "
+	     "source from stdin with '-x c++ -'", nullptr},
+	    {"--profile-invocations", &profileInvocations,
+	     "Count calls and measure time spent in each macro and generator, then print a table "
+	     "sorted by exclusive time (time not spent in other macros and generators) once "
+	     "references are resolved", nullptr},
+	    {"--profile-invocations-csv", nullptr,
+	     "Like --profile-invocations, but also write the table to the given file as CSV",
+	     &invocationProfileCsvFilename},
 	    // Logging
 	    {"--verbose-phases", &logging.phases,
-	     "Output labels for each major phase Cakelisp goes through"},
+	     "Output labels for each major phase Cakelisp goes through", nullptr},
 	    {"--verbose-performance", &logging.performance,
-	     "Output statistics which help estimate Cakelisp's compilation performance"},
+	     "Output statistics which help estimate Cakelisp's compilation performance", nullptr},
 	    {"--verbose-build-omissions", &logging.buildOmissions,
 	     "Output when compile-time functions are not built at all (because they were never "
-	     "invoked). This can be useful if you expect your function to be referenced, but it isn't"},
+	     "invoked). This can be useful if you expect your function to be referenced, but it isn't",
+	     nullptr},
 	    {"--verbose-imports", &logging.imports,
 	     "Output when .cake files are loaded. Also outputs when a .cake file is imported but has "
-	     "already been loaded"},
+	     "already been loaded", nullptr},
 	    {"--verbose-tokenization", &logging.tokenization,
-	     "Output details about the conversion from file text to tokens"},
+	     "Output details about the conversion from file text to tokens", nullptr},
 	    {"--verbose-references", &logging.references,
 	     "Output when references to function/macro/generator invocations are created, and list all "
-	     "definitions and their references"},
+	     "definitions and their references", nullptr},
 	    {"--verbose-dependency-propagation", &logging.dependencyPropagation,
-	     "Output why objects are being built (why they are required for building)"},
+	     "Output why objects are being built (why they are required for building)", nullptr},
 	    {"--verbose-build-reasons", &logging.buildReasons,
-	     "Output why objects are being built (i.e., why the cached version couldn't be used"},
+	     "Output why objects are being built (i.e., why the cached version couldn't be used",
+	     nullptr},
 	    {"--verbose-compile-time-build-reasons", &logging.compileTimeBuildReasons,
-	     "Output why objects are or are not being built in each compile-time build cycle"},
+	     "Output why objects are or are not being built in each compile-time build cycle", nullptr},
 	    {"--verbose-build-process", &logging.buildProcess,
-	     "Output object statuses as they move through the compile-time pipeline"},
+	     "Output object statuses as they move through the compile-time pipeline", nullptr},
 	    {"--verbose-compile-time-build-objects", &logging.compileTimeBuildObjects,
 	     "Output when a compile-time object is being built/loaded. Like --verbose-build-process, "
-	     "but less verbose"},
+	     "but less verbose", nullptr},
 	    {"--verbose-command-crcs", &logging.commandCrcs,
 	     "Output CRC32s generated by process argument lists to determine whether cached files need "
-	     "rebuilds"},
+	     "rebuilds", nullptr},
 	    {"--verbose-processes", &logging.processes,
 	     "Output full command lines and other information about all child processes created during "
-	     "the compile-time build process"},
+	     "the compile-time build process", nullptr},
 	    {"--verbose-file-system", &logging.fileSystem,
-	     "Output why files are being written, the status of comparing files, etc."},
+	     "Output why files are being written, the status of comparing files, etc.", nullptr},
 	    {"--verbose-file-search", &logging.fileSearch,
-	     "Output when paths are being investigated for a file"},
+	     "Output when paths are being investigated for a file", nullptr},
 	    {"--verbose-include-scanning", &logging.includeScanning,
 	     "Output when #include files are being checked for modifications. If they are modified, "
-	     "the cached object files will be rebuilt"},
+	     "the cached object files will be rebuilt", nullptr},
 	    {"--verbose-strict-includes", &logging.strictIncludes,
 	     "Output when #include files are not found during include scanning. The more header files "
-	     "not found, the higher the chances false \"nothing to do\" builds could occur"},
-	    {"--verbose-metadata", &logging.metadata, "Output generated metadata"},
+	     "not found, the higher the chances false \"nothing to do\" builds could occur", nullptr},
+	    {"--verbose-metadata", &logging.metadata, "Output generated metadata", nullptr},
+	    {"--verbose-memory", &logging.memory,
+	     "Output estimates of how much memory tokens, generator outputs, definitions, and "
+	     "references take up at the end of each phase, the most each took up at the end of any "
+	     "phase, and the process's true peak memory usage", nullptr},
 	};
 
 	if (numArguments == 1)
@@ -138,7 +201,18 @@ int main(int numArguments, char* arguments[])
 			{
 				if (strcmp(arguments[i], options[optionIndex].handle) == 0)
 				{
-					*options[optionIndex].toggleOnOut = true;
+					if (options[optionIndex].valueOut)
+					{
+						if (i + 1 >= numArguments)
+						{
+							Logf("Error: %s expects a value\n\n", arguments[i]);
+							printHelp(options, ArraySize(options));
+							return 1;
+						}
+						*options[optionIndex].valueOut = arguments[++i];
+					}
+					else
+						*options[optionIndex].toggleOnOut = true;
 					foundOption = true;
 					break;
 				}
@@ -170,6 +244,16 @@ int main(int numArguments, char* arguments[])
 		return 1;
 	}
 
+	if (traceOutputFilename)
+	{
+		tracingBegin(traceOutputFilename);
+		// Write the trace no matter how we exit, because traces of failed builds are useful too
+		atexit([]() { tracingWriteOutput(); });
+	}
+
+	// Share the limit on parallel jobs with the make running us, or with the processes we run
+	jobserverInitialize(maxProcessesRecommendedSpawned);
+
 	ModuleManager moduleManager = {};
 	moduleManagerInitialize(moduleManager);
 
@@ -181,28 +265,97 @@ int main(int numArguments, char* arguments[])
 			    "(--ignore-cache)\n");
 			moduleManager.environment.useCachedFiles = false;
 		}
+
+		if (profileInvocations || invocationProfileCsvFilename)
+			moduleManager.environment.profileInvocations = true;
+
+		if (disableInterpreter)
+			moduleManager.environment.useInterpreter = false;
+
+		if (cacheMacroExpansions)
+			moduleManager.environment.cacheMacroExpansions = true;
+
+		if (compileTimeOptimizeThreshold)
+			moduleManager.environment.compileTimeOptimizeThreshold =
+			    atoi(compileTimeOptimizeThreshold);
+
+		if (unityBuild)
+			moduleManager.unityBuild = true;
+
+		if (pipeCompileTimeSource)
+			moduleManager.environment.pipeCompileTimeSource = true;
+
+		if (buildConfigurations)
+		{
+			const char* configurationStart = buildConfigurations;
+			for (const char* c = buildConfigurations;; ++c)
+			{
+				if (*c != ',' && *c != '\0')
+					continue;
+
+				if (c == configurationStart)
+				{
+					Logf("Error: --configs expects comma-separated names, got '%s'\n",
+					     buildConfigurations);
+					moduleManagerDestroy(moduleManager);
+					return 1;
+				}
+
+				std::string configuration(configurationStart, c - configurationStart);
+				if (FindInContainer(moduleManager.buildConfigurations, configuration) ==
+				    moduleManager.buildConfigurations.end())
+					moduleManager.buildConfigurations.push_back(configuration);
+
+				if (*c == '\0')
+					break;
+				configurationStart = c + 1;
+			}
+		}
 	}
 
-	for (const char* filename : filesToEvaluate)
+	moduleManagerPrescanImports(moduleManager, filesToEvaluate);
+
 	{
-		if (!moduleManagerAddEvaluateFile(moduleManager, filename, /*moduleOut=*/nullptr))
+		TraceScope evaluateScope("phase", "Evaluate");
+		for (const char* filename : filesToEvaluate)
 		{
-			moduleManagerDestroy(moduleManager);
-			return 1;
+			if (!moduleManagerAddEvaluateFile(moduleManager, filename, /*moduleOut=*/nullptr))
+			{
+				moduleManagerDestroy(moduleManager);
+				return 1;
+			}
 		}
 	}
+	moduleManagerReportMemoryUsage(moduleManager, "evaluation");
 
-	if (!moduleManagerEvaluateResolveReferences(moduleManager))
 	{
-		moduleManagerDestroy(moduleManager);
-		return 1;
+		TraceScope resolveScope("phase", "Resolve references");
+		bool resolvedReferences = moduleManagerEvaluateResolveReferences(moduleManager);
+
+		// All macros and generators have run at this point
+		if (moduleManager.environment.profileInvocations)
+			printInvocationProfile(moduleManager.environment, invocationProfileCsvFilename);
+		moduleManagerReportMemoryUsage(moduleManager, "resolving references");
+
+		if (!resolvedReferences)
+		{
+			moduleManagerDestroy(moduleManager);
+			return 1;
+		}
 	}
 
-	if (!moduleManagerWriteGeneratedOutput(moduleManager))
+	// Runs alongside writing and building
+	StartOptimizingHotCompileTimeCode(moduleManager.environment);
+
 	{
-		moduleManagerDestroy(moduleManager);
-		return 1;
+		TraceScope writeScope("phase", "Write");
+		if (!moduleManagerWriteGeneratedOutput(moduleManager))
+		{
+			moduleManagerDestroy(moduleManager);
+			return 1;
+		}
 	}
+	moduleManagerReportMemoryUsage(moduleManager, "writing");
 
 	if (logging.phases)
 		Log("Successfully generated files\n");
@@ -211,11 +364,32 @@ int main(int numArguments, char* arguments[])
 		Log("\nBuild:\n");
 
 	std::vector<std::string> builtOutputs;
-	if (!moduleManagerBuild(moduleManager, builtOutputs))
 	{
-		moduleManagerDestroy(moduleManager);
-		return 1;
+		TraceScope buildScope("phase", "Build");
+		bool buildSucceeded = moduleManagerBuild(moduleManager, builtOutputs);
+		// Before executing, so the executable's output isn't mixed with the compiler's
+		FinishOptimizingHotCompileTimeCode(moduleManager.environment);
+		moduleManagerReportMemoryUsage(moduleManager, "building");
+		if (!buildSucceeded)
+		{
+			moduleManagerDestroy(moduleManager);
+			return 1;
+		}
+	}
+
+#ifdef UNIX
+	if (logging.performance)
+	{
+		// Note that on Linux, ru_maxrss is in kilobytes. Subprocesses are measured separately,
+		// because they never share memory with us
+		struct rusage selfUsage = {};
+		struct rusage childrenUsage = {};
+		getrusage(RUSAGE_SELF, &selfUsage);
+		getrusage(RUSAGE_CHILDREN, &childrenUsage);
+		Logf("Peak memory usage: %ld KB (largest subprocess: %ld KB)\n", selfUsage.ru_maxrss,
+		     childrenUsage.ru_maxrss);
 	}
+#endif
 
 	if (executeOutput)
 	{
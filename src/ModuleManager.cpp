@@ -2,7 +2,13 @@
 
 #include <string.h>
 
+#include <atomic>
 #include <cstring>
+#include <thread>
+
+#ifdef UNIX
+#include <sys/resource.h>  // getrusage
+#endif
 
 #include "Converters.hpp"
 #include "DynamicLoader.hpp"
@@ -15,6 +21,7 @@
 #include "OutputPreambles.hpp"
 #include "RunProcess.hpp"
 #include "Tokenizer.hpp"
+#include "Tracing.hpp"
 #include "Utilities.hpp"
 #include "Writer.hpp"
 
@@ -109,6 +116,19 @@ void moduleManagerInitialize(ModuleManager& manager)
 		    {ProcessCommandArgumentType_ExecutableOutput, EmptyString},
 		    {ProcessCommandArgumentType_ObjectInput, EmptyString}};
 
+		manager.environment.buildTimeStaticLinkCommand.fileToExecute = "/usr/bin/ar";
+		manager.environment.buildTimeStaticLinkCommand.arguments = {
+		    {ProcessCommandArgumentType_String, "rcs"},
+		    {ProcessCommandArgumentType_DynamicLibraryOutput, EmptyString},
+		    {ProcessCommandArgumentType_ObjectInput, EmptyString}};
+
+		manager.environment.buildTimeSharedLinkCommand.fileToExecute = "/usr/bin/g++";
+		manager.environment.buildTimeSharedLinkCommand.arguments = {
+		    {ProcessCommandArgumentType_String, "-shared"},
+		    {ProcessCommandArgumentType_String, "-o"},
+		    {ProcessCommandArgumentType_DynamicLibraryOutput, EmptyString},
+		    {ProcessCommandArgumentType_ObjectInput, EmptyString}};
+
 		// TODO: Add defaults for Windows
 #ifdef WINDOWS
 #error Set sensible defaults for compile time build command
@@ -116,6 +136,8 @@ void moduleManagerInitialize(ModuleManager& manager)
 	}
 
 	manager.environment.useCachedFiles = true;
+	manager.environment.useInterpreter = true;
+	manager.environment.compileTimeOptimizeThreshold = 500;
 	makeDirectory(cakelispWorkingDir);
 	if (logging.fileSystem || logging.phases)
 		Logf("Using cache at %s\n", cakelispWorkingDir);
@@ -127,6 +149,9 @@ void moduleManagerInitialize(ModuleManager& manager)
 
 void moduleManagerDestroy(ModuleManager& manager)
 {
+	// Usually already finished after building, but builds which failed may have left some running
+	FinishOptimizingHotCompileTimeCode(manager.environment);
+	writeMacroExpansionCache(manager.environment);
 	environmentDestroyInvalidateTokens(manager.environment);
 	for (Module* module : manager.modules)
 	{
@@ -136,17 +161,350 @@ void moduleManagerDestroy(ModuleManager& manager)
 		delete module;
 	}
 	manager.modules.clear();
+	manager.modulesByAbsolutePath.clear();
+
+	// Modules which were prescanned but never evaluated
+	for (PrescannedModuleTablePair& prescannedPair : manager.prescannedModules)
+	{
+		delete prescannedPair.second.tokens;
+		free((void*)prescannedPair.second.filename);
+	}
+	manager.prescannedModules.clear();
 	closeAllDynamicLibraries();
 }
 
-bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut)
+//
+// Memory accounting
+//
+
+// These are estimates. Allocator and hash table overhead aren't known exactly, so only what the
+// containers say they hold is counted
+
+// Strings short enough for the small string optimization don't allocate
+static unsigned long estimateStringHeapBytes(const std::string& str)
+{
+	std::string emptyString;
+	return str.capacity() > emptyString.capacity() ? str.capacity() + 1 : 0;
+}
+
+static unsigned long estimateTokensBytes(const std::vector<Token>& tokens)
+{
+	unsigned long bytes = sizeof(tokens) + tokens.capacity() * sizeof(Token);
+	for (const Token& token : tokens)
+		bytes += estimateStringHeapBytes(token.contents);
+	return bytes;
+}
+
+// Splices may be reachable from multiple outputs, so only count each output once
+static void estimateGeneratorOutputBytes_Recursive(
+    const GeneratorOutput* output, std::unordered_map<const GeneratorOutput*, bool>& visited,
+    unsigned long& numOutputsOut, unsigned long& bytesOut)
+{
+	if (!output || visited.find(output) != visited.end())
+		return;
+	visited[output] = true;
+
+	bytesOut += sizeof(GeneratorOutput);
+	const std::vector<StringOutput>* outputLists[] = {&output->source, &output->header};
+	for (const std::vector<StringOutput>* outputList : outputLists)
+	{
+		bytesOut += outputList->capacity() * sizeof(StringOutput);
+		numOutputsOut += outputList->size();
+		for (const StringOutput& stringOutput : *outputList)
+		{
+			bytesOut += estimateStringHeapBytes(stringOutput.output);
+			estimateGeneratorOutputBytes_Recursive(stringOutput.spliceOutput, visited,
+			                                       numOutputsOut, bytesOut);
+		}
+	}
+	bytesOut += output->functions.capacity() * sizeof(FunctionMetadata);
+	bytesOut += output->imports.capacity() * sizeof(ImportMetadata);
+}
+
+enum MemoryCategory
+{
+	MemoryCategory_ModuleTokens,
+	MemoryCategory_MacroTokens,
+	MemoryCategory_GeneratorOutputs,
+	MemoryCategory_OrphanedOutputs,
+	MemoryCategory_Definitions,
+	MemoryCategory_References,
+
+	MemoryCategory_Count
+};
+
+void moduleManagerReportMemoryUsage(ModuleManager& manager, const char* phaseName)
+{
+	if (!logging.memory && !g_tracingEnabled)
+		return;
+
+	struct
+	{
+		const char* name;
+		const char* countUnit;
+		unsigned long count;
+		unsigned long bytes;
+	} categories[] = {{"Module tokens", "tokens", 0, 0},
+	                  {"Macro and comptime tokens", "tokens", 0, 0},
+	                  {"Generator outputs", "outputs", 0, 0},
+	                  {"Orphaned outputs", "outputs", 0, 0},
+	                  {"Definitions", "definitions", 0, 0},
+	                  {"References", "references", 0, 0}};
+	// Only as high as the phases which were sampled, not necessarily the true peak
+	static unsigned long s_sampledMaxes[MemoryCategory_Count] = {0};
+
+	EvaluatorEnvironment& environment = manager.environment;
+
+	for (const Module* module : manager.modules)
+	{
+		if (!module->tokens)
+			continue;
+		categories[MemoryCategory_ModuleTokens].count += module->tokens->size();
+		categories[MemoryCategory_ModuleTokens].bytes += estimateTokensBytes(*module->tokens);
+	}
+
+	for (const std::vector<Token>* tokens : environment.comptimeTokens)
+	{
+		categories[MemoryCategory_MacroTokens].count += tokens->size();
+		categories[MemoryCategory_MacroTokens].bytes += estimateTokensBytes(*tokens);
+	}
+
+	std::unordered_map<const GeneratorOutput*, bool> visitedOutputs;
+	for (const Module* module : manager.modules)
+		estimateGeneratorOutputBytes_Recursive(
+		    module->generatedOutput, visitedOutputs,
+		    categories[MemoryCategory_GeneratorOutputs].count,
+		    categories[MemoryCategory_GeneratorOutputs].bytes);
+	for (const ObjectDefinitionPair& definitionPair : environment.definitions)
+		estimateGeneratorOutputBytes_Recursive(
+		    definitionPair.second.output, visitedOutputs,
+		    categories[MemoryCategory_GeneratorOutputs].count,
+		    categories[MemoryCategory_GeneratorOutputs].bytes);
+	// Visited after everything else so these only count what isn't still in use elsewhere
+	for (const GeneratorOutput* orphanedOutput : environment.orphanedOutputs)
+		estimateGeneratorOutputBytes_Recursive(orphanedOutput, visitedOutputs,
+		                                       categories[MemoryCategory_OrphanedOutputs].count,
+		                                       categories[MemoryCategory_OrphanedOutputs].bytes);
+
+	for (const ObjectDefinitionPair& definitionPair : environment.definitions)
+	{
+		const ObjectDefinition& definition = definitionPair.second;
+		categories[MemoryCategory_Definitions].count += 1;
+		categories[MemoryCategory_Definitions].bytes +=
+		    sizeof(definitionPair) + estimateStringHeapBytes(definitionPair.first) +
+		    estimateStringHeapBytes(definition.name) +
+		    definition.macroExpansions.capacity() * sizeof(MacroExpansion);
+
+		for (const ObjectReferenceStatusPair& referencePair : definition.references)
+		{
+			categories[MemoryCategory_References].count += referencePair.second.references.size();
+			categories[MemoryCategory_References].bytes +=
+			    sizeof(referencePair) + estimateStringHeapBytes(referencePair.first) +
+			    referencePair.second.references.capacity() * sizeof(ObjectReference);
+		}
+	}
+	for (const ObjectReferencePoolPair& poolPair : environment.referencePools)
+	{
+		categories[MemoryCategory_References].count += poolPair.second.references.size();
+		categories[MemoryCategory_References].bytes +=
+		    sizeof(poolPair) + estimateStringHeapBytes(poolPair.first) +
+		    poolPair.second.references.capacity() * sizeof(ObjectReference);
+	}
+
+	if (logging.memory)
+		Logf("\nEstimated memory usage after %s:\n", phaseName);
+
+	unsigned long totalBytes = 0;
+	for (int i = 0; i < MemoryCategory_Count; ++i)
+	{
+		if (categories[i].bytes > s_sampledMaxes[i])
+			s_sampledMaxes[i] = categories[i].bytes;
+		totalBytes += categories[i].bytes;
+
+		if (logging.memory)
+			Logf("  %-26s %10lu %-11s %10.1f KB (max of sampled phases %.1f KB)\n",
+			     categories[i].name, categories[i].count, categories[i].countUnit,
+			     categories[i].bytes / 1024.0, s_sampledMaxes[i] / 1024.0);
+
+		tracingAddCounter(categories[i].name, categories[i].bytes);
+	}
+
+	if (logging.memory)
+		Logf("  %-26s %22s %10.1f KB\n", "Total", "", totalBytes / 1024.0);
+
+#ifdef UNIX
+	// The true peak of the whole process, including everything the estimates above don't cover.
+	// Note that on Linux, ru_maxrss is in kilobytes
+	if (logging.memory)
+	{
+		struct rusage selfUsage = {};
+		getrusage(RUSAGE_SELF, &selfUsage);
+		Logf("  %-26s %22s %10ld KB\n", "Process peak resident", "", selfUsage.ru_maxrss);
+	}
+#endif
+}
+
+static const uint32_t tokenCacheMagic = 0x4b544b43;  // "CKTK"
+static const uint32_t tokenCacheVersion = 2;
+
+// Each source file gets its own token cache. The name includes a hash of the full path so files
+// with the same name in different directories don't fight over one cache
+static void getTokenCachePath(const char* filename, char* bufferOut, int bufferSize)
+{
+	char baseName[MAX_PATH_LENGTH] = {0};
+	getFilenameFromPath(filename, baseName, sizeof(baseName));
+	uint32_t pathCrc = 0;
+	crc32(filename, strlen(filename), &pathCrc);
+	SafeSnprinf(bufferOut, bufferSize, "%s/tokens/%s_%08x.tokens", cakelispWorkingDir, baseName,
+	            pathCrc);
+}
+
+// Returns null if there's no cached tokens for this version of the file. numLinesOut is how many
+// lines were tokenized to create the cached tokens
+static std::vector<Token>* readTokenCache(const char* filename, uint32_t fileCrc,
+                                          uint32_t fileSize, uint32_t* numLinesOut)
+{
+	char cacheFilename[MAX_PATH_LENGTH] = {0};
+	getTokenCachePath(filename, cacheFilename, sizeof(cacheFilename));
+	MappedFile cacheFile;
+	if (!fileMap(cacheFilename, cacheFile))
+		return nullptr;
+
+	const char* at = cacheFile.data;
+	const char* end = cacheFile.data + cacheFile.size;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint32_t cachedFileCrc = 0;
+	uint32_t cachedFileSize = 0;
+	std::vector<Token>* tokens = nullptr;
+	if (bufferReadUint32(&at, end, &magic) && magic == tokenCacheMagic &&
+	    bufferReadUint32(&at, end, &version) && version == tokenCacheVersion &&
+	    bufferReadUint32(&at, end, &cachedFileCrc) && cachedFileCrc == fileCrc &&
+	    bufferReadUint32(&at, end, &cachedFileSize) && cachedFileSize == fileSize &&
+	    bufferReadUint32(&at, end, numLinesOut))
+	{
+		// Every token's source is the file itself, which lives as long as the tokens
+		std::vector<const char*> sources = {filename};
+		tokens = new std::vector<Token>;
+		bool isValid = readTokensBinary(&at, end, *tokens, sources);
+		for (size_t i = 1; i < sources.size(); ++i)
+			free((void*)sources[i]);
+		if (!isValid || sources.size() != 1 || tokens->empty())
+		{
+			delete tokens;
+			tokens = nullptr;
+		}
+	}
+	fileUnmap(cacheFile);
+
+	if (tokens && (logging.tokenization || logging.fileSystem))
+		Logf("Using cached tokens for %s from %s\n", filename, cacheFilename);
+
+	return tokens;
+}
+
+static void writeTokenCache(const char* filename, uint32_t fileCrc, uint32_t fileSize,
+                            uint32_t numLines, const std::vector<Token>& tokens)
+{
+	char cacheDirectory[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(cacheDirectory, "%s/tokens", cakelispWorkingDir);
+	makeDirectory(cacheDirectory);
+
+	char cacheFilename[MAX_PATH_LENGTH] = {0};
+	getTokenCachePath(filename, cacheFilename, sizeof(cacheFilename));
+	// Write to a temporary file first so an interrupted write can't leave a partial cache
+	char tempFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(tempFilename, "%s.tmp", cacheFilename);
+	FILE* cacheFile = fopen(tempFilename, "wb");
+	if (!cacheFile)
+		return;
+
+	fileWriteUint32(cacheFile, tokenCacheMagic);
+	fileWriteUint32(cacheFile, tokenCacheVersion);
+	fileWriteUint32(cacheFile, fileCrc);
+	fileWriteUint32(cacheFile, fileSize);
+	fileWriteUint32(cacheFile, numLines);
+	std::vector<const char*> sources = {filename};
+	writeTokensBinary(cacheFile, tokens, sources);
+
+	bool writeFailed = ferror(cacheFile);
+	fclose(cacheFile);
+	if (writeFailed || rename(tempFilename, cacheFilename) != 0)
+	{
+		remove(tempFilename);
+		return;
+	}
+
+	if (logging.fileSystem)
+		Logf("Wrote %s\n", cacheFilename);
+}
+
+// Same as fgets(), but from a buffer
+static bool readLineFromBuffer(const char** at, const char* end, char* lineOut, int lineOutSize)
+{
+	if (*at >= end)
+		return false;
+	char* writeHead = lineOut;
+	char* lineOutEnd = lineOut + lineOutSize - 1;
+	while (*at < end && writeHead < lineOutEnd)
+	{
+		char c = *(*at)++;
+		*writeHead++ = c;
+		if (c == '\n')
+			break;
+	}
+	*writeHead = '\0';
+	return true;
+}
+
+static void reportTokenizeError(std::string* errorsOut, const char* error)
+{
+	if (errorsOut)
+		errorsOut->append(error);
+	else
+		Logf("%s", error);
+}
+
+bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut,
+                                bool useTokenCache, std::string* errorsOut)
 {
+	TraceScope tokenizeScope("tokenize", filename);
+
 	*tokensOut = nullptr;
 
-	FILE* file = fileOpen(filename, "r");
-	if (!file)
+	// The whole file is needed anyways to tell whether the token cache is valid
+	MappedFile file;
+	char error[MAX_PATH_LENGTH + 256] = {0};
+	if (!fileMap(filename, file))
+	{
+		PrintfBuffer(error, "error: Could not open %s\n", filename);
+		reportTokenizeError(errorsOut, error);
 		return false;
+	}
+	if (logging.fileSystem)
+		Logf("Opened %s\n", filename);
+	uint32_t fileCrc = 0;
+	crc32(file.data, file.size, &fileCrc);
+	uint32_t fileSize = (uint32_t)file.size;
+
+	// Cached tokens were already validated when they were written
+	if (useTokenCache)
+	{
+		uint32_t numCachedLines = 0;
+		std::vector<Token>* cachedTokens =
+		    readTokenCache(filename, fileCrc, fileSize, &numCachedLines);
+		if (cachedTokens)
+		{
+			// Count the lines as if they were tokenized, so totals don't depend on the cache
+			g_totalLinesTokenized += (int)numCachedLines;
+			fileUnmap(file);
+			*tokensOut = cachedTokens;
+			return true;
+		}
+	}
 
+	const char* readHead = file.data;
+	const char* readEnd = file.data + file.size;
 	char lineBuffer[2048] = {0};
 	int lineNumber = 1;
 	// We need to be very careful about when we delete this so as to not invalidate pointers
@@ -155,7 +513,7 @@ bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>**
 	{
 		std::vector<Token>* tokens_CREATIONONLY = new std::vector<Token>;
 		bool isFirstLine = true;
-		while (fgets(lineBuffer, sizeof(lineBuffer), file))
+		while (readLineFromBuffer(&readHead, readEnd, lineBuffer, sizeof(lineBuffer)))
 		{
 			if (logging.tokenization)
 				Logf("%s", lineBuffer);
@@ -173,12 +531,14 @@ bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>**
 				}
 			}
 
-			const char* error =
+			const char* tokenizeError =
 			    tokenizeLine(lineBuffer, filename, lineNumber, *tokens_CREATIONONLY);
-			if (error != nullptr)
+			if (tokenizeError != nullptr)
 			{
-				Logf("%s:%d: error: %s\n", filename, lineNumber, error);
+				PrintfBuffer(error, "%s:%d: error: %s\n", filename, lineNumber, tokenizeError);
+				reportTokenizeError(errorsOut, error);
 
+				fileUnmap(file);
 				delete tokens_CREATIONONLY;
 				return false;
 			}
@@ -189,19 +549,27 @@ bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>**
 		// Make it const to avoid pointer invalidation due to resize
 		tokens = tokens_CREATIONONLY;
 	}
+	fileUnmap(file);
 
 	if (logging.tokenization)
 		Logf("Tokenized %d lines\n", lineNumber - 1);
 
 	if (tokens->empty())
 	{
-		Log("error: empty file. Please remove from system, or add (ignore)\n");
+		reportTokenizeError(errorsOut,
+		                    "error: empty file. Please remove from system, or add (ignore)\n");
 		delete tokens;
 		return false;
 	}
 
-	if (!validateParentheses(*tokens))
+	const char* parenthesisError = nullptr;
+	const Token* mismatchedToken = findMismatchedParenthesis(*tokens, &parenthesisError);
+	if (mismatchedToken)
 	{
+		PrintfBuffer(error, "%s:%d:%d: error: %s\n", mismatchedToken->source,
+		             mismatchedToken->lineNumber, 1 + mismatchedToken->columnStart,
+		             parenthesisError);
+		reportTokenizeError(errorsOut, error);
 		delete tokens;
 		return false;
 	}
@@ -242,13 +610,195 @@ bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>**
 		}
 	}
 
-	fclose(file);
+	if (useTokenCache)
+		writeTokenCache(filename, fileCrc, fileSize, (uint32_t)(lineNumber - 1), *tokens);
 
 	*tokensOut = tokens;
 
 	return true;
 }
 
+// Adds the absolute paths of modules imported at the top level of tokens. Imports which can't be
+// found yet are left for evaluation to report or find
+// Returns false if the file couldn't be read
+static bool getFileCrc(const char* filename, uint32_t* crcOut)
+{
+	MappedFile file;
+	if (!fileMap(filename, file))
+		return false;
+	*crcOut = 0;
+	crc32(file.data, file.size, crcOut);
+	fileUnmap(file);
+	return true;
+}
+
+static void prescanFindImports(ModuleManager& manager, const std::vector<Token>& tokens,
+                               std::vector<std::string>& importsOut)
+{
+	int depth = 0;
+	for (int i = 0; i < (int)tokens.size(); ++i)
+	{
+		const Token& token = tokens[i];
+		if (token.type == TokenType_CloseParen)
+		{
+			--depth;
+			continue;
+		}
+		if (token.type != TokenType_OpenParen)
+			continue;
+		++depth;
+		if (depth != 1 || i + 1 >= (int)tokens.size() ||
+		    tokens[i + 1].type != TokenType_Symbol || tokens[i + 1].contents.compare("import") != 0)
+			continue;
+
+		int endInvocationIndex = FindCloseParenTokenIndex(tokens, i);
+		for (int argumentIndex = i + 2; argumentIndex < endInvocationIndex; ++argumentIndex)
+		{
+			const Token& argument = tokens[argumentIndex];
+			// Skips over &comptime-only etc.
+			if (argument.type != TokenType_String || argument.contents.empty())
+				continue;
+
+			char resolvedPath[MAX_PATH_LENGTH] = {0};
+			if (!searchForFileInPaths(argument.contents.c_str(), argument.source,
+			                          manager.environment.searchPaths, resolvedPath,
+			                          ArraySize(resolvedPath)))
+				continue;
+			const char* absolutePath = makeAbsolutePath_Allocated(".", resolvedPath);
+			if (!absolutePath)
+				continue;
+			importsOut.push_back(absolutePath);
+			free((void*)absolutePath);
+		}
+
+		// The invocation's close paren ends this form
+		i = endInvocationIndex;
+		--depth;
+	}
+}
+
+static void prescanLogImportCycles_Recursive(ModuleManager& manager, const std::string& path,
+                                             std::vector<std::string>& stack,
+                                             std::unordered_map<std::string, int>& visitState)
+{
+	// 1 means the module is on the stack, 2 means it and its imports have been visited
+	visitState[path] = 1;
+	stack.push_back(path);
+
+	PrescannedModuleTableIterator findIt = manager.prescannedModules.find(path);
+	if (findIt != manager.prescannedModules.end())
+	{
+		for (const std::string& importPath : findIt->second.imports)
+		{
+			int importState = visitState[importPath];
+			if (importState == 0)
+			{
+				prescanLogImportCycles_Recursive(manager, importPath, stack, visitState);
+			}
+			else if (importState == 1)
+			{
+				Log("Import cycle: ");
+				std::vector<std::string>::iterator cycleStart =
+				    std::find(stack.begin(), stack.end(), importPath);
+				for (std::vector<std::string>::iterator it = cycleStart; it != stack.end(); ++it)
+					Logf("%s -> ", it->c_str());
+				Logf("%s\n", importPath.c_str());
+			}
+		}
+	}
+
+	stack.pop_back();
+	visitState[path] = 2;
+}
+
+void moduleManagerPrescanImports(ModuleManager& manager, const std::vector<const char*>& filenames)
+{
+	TraceScope prescanScope("phase", "Prescan imports");
+
+	std::vector<std::string> toScan;
+	for (const char* filename : filenames)
+	{
+		const char* absolutePath = makeAbsolutePath_Allocated(".", filename);
+		// Evaluation will report the error
+		if (!absolutePath)
+			continue;
+		toScan.push_back(absolutePath);
+		free((void*)absolutePath);
+	}
+	std::vector<std::string> roots = toScan;
+
+	size_t numThreads = std::thread::hardware_concurrency();
+	if (!numThreads)
+		numThreads = maxProcessesRecommendedSpawned;
+	// Keep verbose output readable by not interleaving modules
+	if (logging.tokenization || logging.fileSystem)
+		numThreads = 1;
+
+	// Breadth first, so each level of the import graph is tokenized in parallel
+	while (!toScan.empty())
+	{
+		std::vector<PrescannedModule*> newModules;
+		for (const std::string& path : toScan)
+		{
+			if (manager.prescannedModules.find(path) != manager.prescannedModules.end())
+				continue;
+			PrescannedModule& newModule = manager.prescannedModules[path];
+			newModule = {};
+			// Must match the name moduleManagerAddEvaluateFile() would give it
+			char resolvedPath[MAX_PATH_LENGTH] = {0};
+			makeAbsoluteOrRelativeToWorkingDir(path.c_str(), resolvedPath,
+			                                   ArraySize(resolvedPath));
+			newModule.filename = strdup(resolvedPath);
+			newModules.push_back(&newModule);
+		}
+		toScan.clear();
+
+		std::atomic<size_t> nextModuleIndex(0);
+		auto tokenizeWorker = [&]() {
+			for (size_t moduleIndex = nextModuleIndex++; moduleIndex < newModules.size();
+			     moduleIndex = nextModuleIndex++)
+			{
+				PrescannedModule& module = *newModules[moduleIndex];
+				// Taken before tokenizing, so a change while tokenizing is caught as well
+				module.hasFileCrc = getFileCrc(module.filename, &module.fileCrc);
+				// Errors wait until evaluation, which might resolve the import elsewhere or never
+				// reach it
+				if (!moduleLoadTokenizeValidate(module.filename, &module.tokens,
+				                                manager.environment.useCachedFiles,
+				                                &module.tokenizeErrors))
+					module.failedToTokenize = true;
+			}
+		};
+		size_t numLevelThreads = std::min(numThreads, newModules.size());
+		std::vector<std::thread> tokenizeThreads;
+		for (size_t i = 1; i < numLevelThreads; ++i)
+			tokenizeThreads.push_back(std::thread(tokenizeWorker));
+		tokenizeWorker();
+		for (std::thread& tokenizeThread : tokenizeThreads)
+			tokenizeThread.join();
+
+		for (PrescannedModule* module : newModules)
+		{
+			if (!module->tokens)
+				continue;
+			prescanFindImports(manager, *module->tokens, module->imports);
+			PushBackAll(toScan, module->imports);
+		}
+	}
+
+	if (logging.imports)
+	{
+		Logf("Prescanned %d modules\n", (int)manager.prescannedModules.size());
+		std::vector<std::string> stack;
+		std::unordered_map<std::string, int> visitState;
+		for (const std::string& root : roots)
+		{
+			if (visitState[root] == 0)
+				prescanLogImportCycles_Recursive(manager, root, stack, visitState);
+		}
+	}
+}
+
 bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename, Module** moduleOut)
 {
 	if (moduleOut)
@@ -257,6 +807,26 @@ bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename,
 	if (!filename)
 		return false;
 
+	// Check for already loaded module. Make sure to use absolute paths to protect the user from
+	// multiple includes in case they got tricky with their import path
+	const char* absoluteFilename = makeAbsolutePath_Allocated(".", filename);
+	if (!absoluteFilename)
+	{
+		Logf("error: failed to normalize path %s\n", filename);
+		return false;
+	}
+	ModulePathTableIterator findLoadedIt = manager.modulesByAbsolutePath.find(absoluteFilename);
+	if (findLoadedIt != manager.modulesByAbsolutePath.end())
+	{
+		if (moduleOut)
+			*moduleOut = findLoadedIt->second;
+
+		if (logging.imports)
+			Logf("Already loaded %s\n", findLoadedIt->second->filename);
+		free((void*)absoluteFilename);
+		return true;
+	}
+
 	char resolvedPath[MAX_PATH_LENGTH] = {0};
 	makeAbsoluteOrRelativeToWorkingDir(filename, resolvedPath, ArraySize(resolvedPath));
 	const char* normalizedFilename = strdup(resolvedPath);
@@ -270,63 +840,79 @@ bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename,
 #else
 		Logf("error: could not normalize filename, or file not found: %s\n", filename);
 #endif
+		free((void*)absoluteFilename);
 		return false;
 	}
 
-	// Check for already loaded module. Make sure to use absolute paths to protect the user from
-	// multiple includes in case they got tricky with their import path
-	for (Module* module : manager.modules)
+	Module* newModule = new Module();
+	// We need to keep this memory around for the lifetime of the token, regardless of relocation
+	newModule->filename = normalizedFilename;
+
+	// The prescan may have already tokenized it. Compile-time code may have changed the file since
+	// then, e.g. to generate it, in which case it is tokenized again
+	PrescannedModuleTableIterator findPrescannedIt =
+	    manager.prescannedModules.find(absoluteFilename);
+	if (findPrescannedIt != manager.prescannedModules.end())
 	{
-		const char* normalizedProspectiveModuleFilename = makeAbsolutePath_Allocated(".", filename);
-		if (!normalizedProspectiveModuleFilename)
+		PrescannedModule& prescannedModule = findPrescannedIt->second;
+		uint32_t fileCrc = 0;
+		if ((prescannedModule.tokens || prescannedModule.failedToTokenize) &&
+		    (!prescannedModule.hasFileCrc ||
+		     !getFileCrc(prescannedModule.filename, &fileCrc) ||
+		     fileCrc != prescannedModule.fileCrc))
 		{
-			Logf("error: failed to normalize path %s", filename);
-			free((void*)normalizedFilename);
-			return false;
+			if (logging.imports || logging.fileSystem)
+				Logf("%s changed since it was prescanned\n", newModule->filename);
+			delete prescannedModule.tokens;
+			free((void*)prescannedModule.filename);
+			prescannedModule.tokens = nullptr;
+			prescannedModule.filename = nullptr;
+			prescannedModule.failedToTokenize = false;
+			prescannedModule.tokenizeErrors.clear();
 		}
-
-		const char* normalizedModuleFilename = makeAbsolutePath_Allocated(".", module->filename);
-
-		if (!normalizedModuleFilename)
+	}
+	if (findPrescannedIt != manager.prescannedModules.end() &&
+	    (findPrescannedIt->second.tokens || findPrescannedIt->second.failedToTokenize))
+	{
+		PrescannedModule& prescannedModule = findPrescannedIt->second;
+		// The tokens point to the prescan's copy of the same filename
+		if (prescannedModule.tokens)
 		{
-			Logf("error: failed to normalize path %s", module->filename);
-			free((void*)normalizedProspectiveModuleFilename);
 			free((void*)normalizedFilename);
-			return false;
+			normalizedFilename = prescannedModule.filename;
+			newModule->filename = prescannedModule.filename;
+			newModule->tokens = prescannedModule.tokens;
+			prescannedModule.filename = nullptr;
+			prescannedModule.tokens = nullptr;
 		}
-
-		if (strcmp(normalizedModuleFilename, normalizedProspectiveModuleFilename) == 0)
+		// The prescan kept the details quiet until now
+		else
 		{
-			if (moduleOut)
-				*moduleOut = module;
-
-			if (logging.imports)
-				Logf("Already loaded %s\n", normalizedFilename);
+			Logf("%s", prescannedModule.tokenizeErrors.c_str());
+			Logf("error: failed to tokenize %s\n", newModule->filename);
+			delete newModule;
 			free((void*)normalizedFilename);
-			free((void*)normalizedProspectiveModuleFilename);
-			free((void*)normalizedModuleFilename);
-			return true;
+			free((void*)absoluteFilename);
+			return false;
 		}
-
-		free((void*)normalizedProspectiveModuleFilename);
-		free((void*)normalizedModuleFilename);
 	}
-
-	Module* newModule = new Module();
-	// We need to keep this memory around for the lifetime of the token, regardless of relocation
-	newModule->filename = normalizedFilename;
 	// This stage cleans up after itself if it fails
-	if (!moduleLoadTokenizeValidate(newModule->filename, &newModule->tokens))
+	else if (!moduleLoadTokenizeValidate(newModule->filename, &newModule->tokens,
+	                                     manager.environment.useCachedFiles,
+	                                     /*errorsOut=*/nullptr))
 	{
 		Logf("error: failed to tokenize %s\n", newModule->filename);
 		delete newModule;
 		free((void*)normalizedFilename);
+		free((void*)absoluteFilename);
 		return false;
 	}
 
 	newModule->generatedOutput = new GeneratorOutput;
 
 	manager.modules.push_back(newModule);
+	manager.modulesByAbsolutePath[absoluteFilename] = newModule;
+	free((void*)absoluteFilename);
 
 	EvaluatorContext moduleContext = {};
 	moduleContext.module = newModule;
@@ -339,9 +925,14 @@ bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename,
 	StringOutput moduleDelimiterTemplate = {};
 	moduleDelimiterTemplate.modifiers = StringOutMod_NewlineAfter;
 	moduleContext.delimiterTemplate = moduleDelimiterTemplate;
-	int numErrors =
-	    EvaluateGenerateAll_Recursive(manager.environment, moduleContext, *newModule->tokens,
-	                                  /*startTokenIndex=*/0, *newModule->generatedOutput);
+	int numErrors = 0;
+	{
+		// Note that this includes evaluating any modules this module imports
+		TraceScope evaluateScope("evaluate", newModule->filename);
+		numErrors =
+		    EvaluateGenerateAll_Recursive(manager.environment, moduleContext, *newModule->tokens,
+		                                  /*startTokenIndex=*/0, *newModule->generatedOutput);
+	}
 	// After this point, the module may have references to its tokens in the environmment, so we
 	// cannot destroy it until we're done evaluating everything
 	if (numErrors)
@@ -365,7 +956,9 @@ bool moduleManagerEvaluateResolveReferences(ModuleManager& manager)
 
 // Directory is named from build configuration labels, e.g. Debug-HotReload
 // Order DOES matter, in case changing configuration order changes which settings get eval'd first
-static bool createBuildOutputDirectory(EvaluatorEnvironment& environment, std::string& outputDirOut)
+// If configurationLabel is set, it is added after the evaluated labels
+static bool createBuildOutputDirectory(EvaluatorEnvironment& environment,
+                                       const char* configurationLabel, std::string& outputDirOut)
 {
 	// As soon as we start writing, we need to decide what directory we will write to. Fix build
 	// configuration labels because it's too late to change them now
@@ -374,8 +967,12 @@ static bool createBuildOutputDirectory(EvaluatorEnvironment& environment, std::s
 	// Sane default in case something goes wrong
 	outputDirOut = cakelispWorkingDir;
 
+	std::vector<std::string> labels = environment.buildConfigurationLabels;
+	if (configurationLabel)
+		labels.push_back(configurationLabel);
+
 	char outputDirName[MAX_PATH_LENGTH] = {0};
-	int numLabels = (int)environment.buildConfigurationLabels.size();
+	int numLabels = (int)labels.size();
 	char* writeHead = outputDirName;
 
 	if (!writeStringToBuffer(cakelispWorkingDir, &writeHead, outputDirName, sizeof(outputDirName)))
@@ -391,7 +988,7 @@ static bool createBuildOutputDirectory(EvaluatorEnvironment& environment, std::s
 
 	for (int i = 0; i < numLabels; ++i)
 	{
-		const std::string& label = environment.buildConfigurationLabels[i];
+		const std::string& label = labels[i];
 		if (!writeStringToBuffer(label.c_str(), &writeHead, outputDirName, sizeof(outputDirName)))
 		{
 			Log("error: ran out of space writing build configuration output directory name\n");
@@ -422,20 +1019,35 @@ static bool createBuildOutputDirectory(EvaluatorEnvironment& environment, std::s
 	return true;
 }
 
+// Everything a writer thread needs to output a single module
+struct ModuleWriteJob
+{
+	Module* module;
+	WriterOutputSettings outputSettings;
+	GeneratorOutput header;
+	GeneratorOutput footer;
+};
+
 bool moduleManagerWriteGeneratedOutput(ModuleManager& manager)
 {
-	createBuildOutputDirectory(manager.environment, manager.buildOutputDir);
+	createBuildOutputDirectory(manager.environment, /*configurationLabel=*/nullptr,
+	                           manager.buildOutputDir);
 
 	NameStyleSettings nameSettings;
 	WriterFormatSettings formatSettings;
 
-	for (Module* module : manager.modules)
+	// Prepare output names and headings up front. Once references are resolved, each module's
+	// output tree is independent, so only the writing itself needs to run in parallel
+	std::vector<ModuleWriteJob> writeJobs(manager.modules.size());
+	for (size_t moduleIndex = 0; moduleIndex < manager.modules.size(); ++moduleIndex)
 	{
-		WriterOutputSettings outputSettings;
+		Module* module = manager.modules[moduleIndex];
+		ModuleWriteJob& job = writeJobs[moduleIndex];
+		job.module = module;
+
+		WriterOutputSettings& outputSettings = job.outputSettings;
 		outputSettings.sourceCakelispFilename = module->filename;
 
-		GeneratorOutput header;
-		GeneratorOutput footer;
 		// Something to attach the reason for generating this output
 		const Token* blameToken = &(*module->tokens)[0];
 		// Always include my header file
@@ -445,14 +1057,14 @@ bool moduleManagerWriteGeneratedOutput(ModuleManager& manager)
 			                    sizeof(relativeIncludeBuffer));
 			// TODO: hpp to h support
 			strcat(relativeIncludeBuffer, ".hpp");
-			addStringOutput(header.source, "#include", StringOutMod_SpaceAfter, blameToken);
-			addStringOutput(header.source, relativeIncludeBuffer, StringOutMod_SurroundWithQuotes,
-			                blameToken);
-			addLangTokenOutput(header.source, StringOutMod_NewlineAfter, blameToken);
+			addStringOutput(job.header.source, "#include", StringOutMod_SpaceAfter, blameToken);
+			addStringOutput(job.header.source, relativeIncludeBuffer,
+			                StringOutMod_SurroundWithQuotes, blameToken);
+			addLangTokenOutput(job.header.source, StringOutMod_NewlineAfter, blameToken);
 		}
-		makeRunTimeHeaderFooter(header, footer, blameToken);
-		outputSettings.heading = &header;
-		outputSettings.footer = &footer;
+		makeRunTimeHeaderFooter(job.header, job.footer, blameToken);
+		outputSettings.heading = &job.header;
+		outputSettings.footer = &job.footer;
 
 		char sourceOutputName[MAX_PATH_LENGTH] = {0};
 		if (!outputFilenameFromSourceFilename(manager.buildOutputDir.c_str(),
@@ -468,14 +1080,48 @@ bool moduleManagerWriteGeneratedOutput(ModuleManager& manager)
 		module->headerOutputName = headerOutputName;
 		outputSettings.sourceOutputName = module->sourceOutputName.c_str();
 		outputSettings.headerOutputName = module->headerOutputName.c_str();
-
-		if (!writeGeneratorOutput(*module->generatedOutput, nameSettings, formatSettings,
-		                          outputSettings))
-			return false;
 	}
 
+	// Each worker pulls the next unwritten module until none are left
+	std::atomic<size_t> nextJobIndex(0);
+	std::atomic<bool> writeSucceeded(true);
+	auto writeWorker = [&]() {
+		for (size_t jobIndex = nextJobIndex++; jobIndex < writeJobs.size();
+		     jobIndex = nextJobIndex++)
+		{
+			ModuleWriteJob& job = writeJobs[jobIndex];
+			TraceScope writeScope("write", job.module->filename);
+			if (!writeGeneratorOutput(*job.module->generatedOutput, nameSettings, formatSettings,
+			                          job.outputSettings))
+				writeSucceeded = false;
+		}
+	};
+
+	size_t numThreads = std::thread::hardware_concurrency();
+	if (!numThreads)
+		numThreads = maxProcessesRecommendedSpawned;
+	if (numThreads > writeJobs.size())
+		numThreads = writeJobs.size();
+	// Keep verbose output readable by not interleaving modules
+	if (logging.fileSystem || logging.metadata)
+		numThreads = 1;
+
+	if (logging.phases)
+		Logf("Writing %d modules using %d threads\n", (int)writeJobs.size(), (int)numThreads);
+
+	// This thread does its share of the work too
+	std::vector<std::thread> writeThreads;
+	for (size_t i = 1; i < numThreads; ++i)
+		writeThreads.push_back(std::thread(writeWorker));
+	writeWorker();
+	for (std::thread& writeThread : writeThreads)
+		writeThread.join();
+
+	if (!writeSucceeded)
+		return false;
+
 	if (logging.phases || logging.performance)
-		Logf("Processed %d lines\n", g_totalLinesTokenized);
+		Logf("Processed %d lines\n", g_totalLinesTokenized.load());
 
 	return true;
 }
@@ -592,26 +1238,16 @@ static unsigned long GetMostRecentIncludeModified_Recursive(
 
 static void OnCompileProcessOutput(const char* output)
 {
-	// TODO C/C++ error to Cakelisp token mapper
+	printCakelispLocationsForCompilerOutput(output);
 }
 
-// enum BuildTargetType
-// {
-// 	BuildTargetType_Executable,
-// 	BuildTargetType_Library
-// };
-
-// struct BuildTarget
-// {
-// 	BuildTargetType type;
-// 	std::vector<std::string> filesToLink;
-// };
-
 struct BuiltObject
 {
 	int buildStatus;
 	std::string sourceFilename;
 	std::string filename;
+	// The module itself, or the module which added this C/C++ build dependency
+	Module* module;
 
 	ProcessCommand* buildCommandOverride;
 	std::vector<std::string> includesSearchDirs;
@@ -619,6 +1255,9 @@ struct BuiltObject
 
 	// Only used for include scanning
 	std::vector<std::string> headerSearchDirectories;
+
+	// Filled in once the compiler closes. See post-build-process hooks
+	ProcessResult processResult;
 };
 
 void builtObjectsFree(std::vector<BuiltObject*>& objects)
@@ -673,8 +1312,49 @@ bool copyExecutableToFinalOutput(ModuleManager& manager, const std::string& cach
 	return true;
 }
 
+// Either a BuildTarget, or the single executable linked when there are no targets
+struct BuildTargetLink
+{
+	BuildTargetType type;
+	std::string finalOutputName;
+	std::string cachedOutputName;
+	// The link can start as soon as these are built
+	std::vector<BuiltObject*> objects;
+	std::vector<const char*> objectsToLink;
+	bool objectsDirty;
+	// Executables only. See buildTargetLinkPrepare()
+	bool librariesDirty;
+
+	// Copied so hooks can modify it. linkArguments points into it
+	ProcessCommand linkCommand;
+	const char** linkArguments;
+	bool needsLink;
+	int linkStatus;
+	ProcessResult linkResult;
+};
+
+// Everything which differs between the configurations built from a single evaluation
+struct ConfigurationBuild
+{
+	// Empty if only the evaluated configuration is being built. See --configs
+	std::string name;
+	std::string buildOutputDir;
+	// From add-build-options-for-config
+	std::vector<std::string> additionalOptions;
+
+	// If an existing cached build was run, check the current build's commands against the previous
+	// commands via CRC comparison. This ensures changing commands will cause rebuilds
+	ArtifactCrcTable cachedCommandCrcs;
+	// If any artifact no longer matches its crc in cachedCommandCrcs, the change will appear here
+	ArtifactCrcTable newCommandCrcs;
+
+	// Pointer because the objects can't move, status codes are pointed to
+	std::vector<BuiltObject*> builtObjects;
+	std::vector<BuildTargetLink> links;
+};
+
 // commandArguments should have terminating null sentinel
-static bool commandEqualsCachedCommand(ModuleManager& manager, const char* artifactKey,
+static bool commandEqualsCachedCommand(ConfigurationBuild& configuration, const char* artifactKey,
                                        const char** commandArguments, uint32_t* crcOut)
 {
 	uint32_t newCommandCrc = 0;
@@ -686,8 +1366,8 @@ static bool commandEqualsCachedCommand(ModuleManager& manager, const char* artif
 	if (crcOut)
 		*crcOut = newCommandCrc;
 
-	ArtifactCrcTable::iterator findIt = manager.cachedCommandCrcs.find(artifactKey);
-	if (findIt == manager.cachedCommandCrcs.end())
+	ArtifactCrcTable::iterator findIt = configuration.cachedCommandCrcs.find(artifactKey);
+	if (findIt == configuration.cachedCommandCrcs.end())
 	{
 		if (logging.commandCrcs)
 			Logf("CRC32 for %s: %u (not cached)\n", artifactKey, newCommandCrc);
@@ -700,34 +1380,632 @@ static bool commandEqualsCachedCommand(ModuleManager& manager, const char* artif
 	return findIt->second == newCommandCrc;
 }
 
-static bool moduleManagerReadCacheFile(ModuleManager& manager);
-static void moduleManagerWriteCacheFile(ModuleManager& manager);
+static bool moduleManagerReadCacheFile(ConfigurationBuild& configuration);
+static void moduleManagerWriteCacheFile(ConfigurationBuild& configuration);
 
-bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtOutputs)
+static bool moduleIsInBuildTarget(ModuleManager& manager, Module* module)
 {
-	if (!moduleManagerReadCacheFile(manager))
-		return false;
+	for (const BuildTarget& target : manager.environment.buildTargets)
+	{
+		if (FindInContainer(target.modules, module) != target.modules.end())
+			return true;
+	}
+	return false;
+}
 
-	int currentNumProcessesSpawned = 0;
+// When building several configurations, each one's outputs go in a directory named after it, next
+// to where the output would otherwise go. For example, bin/app becomes bin/Release/app
+static void getConfigurationOutputName(const ConfigurationBuild& configuration,
+                                       const std::string& outputName,
+                                       std::string& configurationOutputNameOut)
+{
+	if (configuration.name.empty())
+	{
+		configurationOutputNameOut = outputName;
+		return;
+	}
 
-	int numModules = manager.modules.size();
-	// Pointer because the objects can't move, status codes are pointed to
-	std::vector<BuiltObject*> builtObjects;
+	char outputDirectory[MAX_PATH_LENGTH] = {0};
+	getDirectoryFromPath(outputName.c_str(), outputDirectory, sizeof(outputDirectory));
+	char outputFilename[MAX_PATH_LENGTH] = {0};
+	getFilenameFromPath(outputName.c_str(), outputFilename, sizeof(outputFilename));
 
-	for (int moduleIndex = 0; moduleIndex < numModules; ++moduleIndex)
-	{
-		Module* module = manager.modules[moduleIndex];
+	char configurationDirectory[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(configurationDirectory, "%s/%s", outputDirectory, configuration.name.c_str());
+	makeDirectory(configurationDirectory);
 
-		for (ModulePreBuildHook hook : module->preBuildHooks)
-		{
-			if (!hook(manager, module))
+	configurationOutputNameOut = configurationDirectory;
+	configurationOutputNameOut += "/";
+	configurationOutputNameOut += outputFilename;
+}
+
+static bool buildTargetLinkInitialize(ModuleManager& manager, ConfigurationBuild& configuration,
+                                      BuildTargetLink& link, BuildTargetType type,
+                                      const std::string& outputName,
+                                      const ProcessCommand* linkCommandOverride)
+{
+	link.type = type;
+	getConfigurationOutputName(configuration, outputName, link.finalOutputName);
+	link.objectsDirty = false;
+	link.librariesDirty = false;
+	link.linkArguments = nullptr;
+	link.needsLink = false;
+	link.linkStatus = 0;
+
+	char outputFilename[MAX_PATH_LENGTH] = {0};
+	getFilenameFromPath(outputName.c_str(), outputFilename, sizeof(outputFilename));
+	char cachedOutputPath[MAX_PATH_LENGTH] = {0};
+	if (!outputFilenameFromSourceFilename(configuration.buildOutputDir.c_str(), outputFilename,
+	                                      /*addExtension=*/nullptr, cachedOutputPath,
+	                                      sizeof(cachedOutputPath)))
+		return false;
+	link.cachedOutputName = cachedOutputPath;
+
+	switch (type)
+	{
+		case BuildTargetType_Executable:
+			link.linkCommand = manager.environment.buildTimeLinkCommand;
+			break;
+		case BuildTargetType_StaticLibrary:
+			link.linkCommand = manager.environment.buildTimeStaticLinkCommand;
+			break;
+		case BuildTargetType_SharedLibrary:
+			link.linkCommand = manager.environment.buildTimeSharedLinkCommand;
+			break;
+	}
+
+	if (linkCommandOverride)
+	{
+		if (!linkCommandOverride->fileToExecute.empty())
+			link.linkCommand.fileToExecute = linkCommandOverride->fileToExecute;
+		if (!linkCommandOverride->arguments.empty())
+			link.linkCommand.arguments = linkCommandOverride->arguments;
+	}
+
+	return true;
+}
+
+// Creates the link arguments and decides whether the cached output can be used instead
+static bool buildTargetLinkPrepare(ModuleManager& manager, ConfigurationBuild& configuration,
+                                   BuildTargetLink& link)
+{
+	for (BuiltObject* object : link.objects)
+	{
+		link.objectsToLink.push_back(object->filename.c_str());
+
+		// If all our objects are older than our output, don't even link!
+		link.objectsDirty |= !canUseCachedFile(manager.environment, object->filename.c_str(),
+		                                       link.cachedOutputName.c_str());
+	}
+
+	// Executables may link against libraries from the same configuration, which are linked before
+	// them. Which ones isn't known, so any library changing means relinking
+	if (link.type == BuildTargetType_Executable)
+	{
+		for (const BuildTargetLink& library : configuration.links)
+		{
+			if (library.type == BuildTargetType_Executable || library.objects.empty())
+				continue;
+
+			link.librariesDirty |=
+			    library.needsLink ||
+			    !canUseCachedFile(manager.environment, library.cachedOutputName.c_str(),
+			                      link.cachedOutputName.c_str());
+		}
+	}
+
+	ProcessCommandArgumentType outputType = link.type == BuildTargetType_Executable ?
+	                                            ProcessCommandArgumentType_ExecutableOutput :
+	                                            ProcessCommandArgumentType_DynamicLibraryOutput;
+	ProcessCommandInput linkTimeInputs[] = {
+	    {outputType, {link.cachedOutputName.c_str()}},
+	    {ProcessCommandArgumentType_ObjectInput, link.objectsToLink}};
+
+	// Hooks should cooperate with eachother, i.e. try to only add things. Archivers don't take
+	// linker arguments, so static libraries are left alone
+	if (link.type != BuildTargetType_StaticLibrary)
+	{
+		for (PreLinkHook preLinkHook : manager.environment.preLinkHooks)
+		{
+			if (!preLinkHook(manager, link.linkCommand, linkTimeInputs, ArraySize(linkTimeInputs)))
 			{
 				Log("error: hook returned failure. Aborting build\n");
-				builtObjectsFree(builtObjects);
 				return false;
 			}
 		}
+	}
+
+	link.linkArguments = MakeProcessArgumentsFromCommand(link.linkCommand, linkTimeInputs,
+	                                                     ArraySize(linkTimeInputs));
+	if (!link.linkArguments)
+		return false;
+
+	uint32_t commandCrc = 0;
+	bool commandEqualsCached = commandEqualsCachedCommand(
+	    configuration, link.finalOutputName.c_str(), link.linkArguments, &commandCrc);
+
+	// Check if we can use the cached version
+	if (!link.objectsDirty && !link.librariesDirty && commandEqualsCached)
+	{
+		if (logging.buildProcess)
+			Logf("Skipping linking %s (no built objects or libraries are newer than cached "
+			     "output, command identical)\n",
+			     link.finalOutputName.c_str());
+		return true;
+	}
+
+	if (logging.buildReasons)
+	{
+		Logf("Link %s reason(s):\n", link.finalOutputName.c_str());
+		if (link.objectsDirty)
+			Log("\tobject files updated\n");
+		if (link.librariesDirty)
+			Log("\tlibraries updated\n");
+		if (!commandEqualsCached)
+			Log("\tcommand changed since last run\n");
+	}
+
+	if (!commandEqualsCached)
+		configuration.newCommandCrcs[link.finalOutputName] = commandCrc;
+
+	link.needsLink = true;
+	return true;
+}
+
+static bool buildTargetLinkCopyToFinalOutput(ModuleManager& manager, BuildTargetLink& link)
+{
+	if (link.type == BuildTargetType_Executable)
+		return copyExecutableToFinalOutput(manager, link.cachedOutputName, link.finalOutputName);
+
+	if (logging.fileSystem)
+		Log("Copying library from cache\n");
+
+	if (!copyBinaryFileTo(link.cachedOutputName.c_str(), link.finalOutputName.c_str()))
+	{
+		Log("error: failed to copy library from cache\n");
+		return false;
+	}
+	return true;
+}
+
+static void buildTargetLinksFree(std::vector<BuildTargetLink>& links)
+{
+	for (BuildTargetLink& link : links)
+	{
+		if (link.linkArguments)
+			free(link.linkArguments);
+		link.linkArguments = nullptr;
+	}
+	links.clear();
+}
+
+static bool createBuildOutputDirectory(EvaluatorEnvironment& environment,
+                                       const char* configurationLabel, std::string& outputDirOut);
+
+static bool configurationBuildsCreate(ModuleManager& manager,
+                                      std::vector<ConfigurationBuild>& configurations)
+{
+	if (manager.buildConfigurations.empty())
+	{
+		configurations.resize(1);
+		configurations[0].buildOutputDir = manager.buildOutputDir;
+	}
+	else
+	{
+		configurations.resize(manager.buildConfigurations.size());
+		for (size_t i = 0; i < configurations.size(); ++i)
+		{
+			configurations[i].name = manager.buildConfigurations[i];
+			if (!createBuildOutputDirectory(manager.environment, configurations[i].name.c_str(),
+			                                configurations[i].buildOutputDir))
+				return false;
+		}
+	}
+
+	for (ConfigurationBuild& configuration : configurations)
+	{
+		std::vector<std::string> labels = manager.environment.buildConfigurationLabels;
+		if (!configuration.name.empty())
+			labels.push_back(configuration.name);
+		for (const std::string& label : labels)
+		{
+			BuildConfigurationOptionsTableIterator findIt =
+			    manager.environment.buildConfigurationOptions.find(label);
+			if (findIt != manager.environment.buildConfigurationOptions.end())
+				PushBackAll(configuration.additionalOptions, findIt->second);
+		}
+
+		if (!moduleManagerReadCacheFile(configuration))
+			return false;
+	}
+
+	return true;
+}
+
+static void configurationBuildsFree(std::vector<ConfigurationBuild>& configurations)
+{
+	for (ConfigurationBuild& configuration : configurations)
+	{
+		buildTargetLinksFree(configuration.links);
+		builtObjectsFree(configuration.builtObjects);
+	}
+	configurations.clear();
+}
+
+// Unity builds compile generated modules in groups, each through a single source file which
+// includes the group's sources. Groups are saved so that changing a module only changes its own
+// group, keeping rebuilds as small as they are without unity builds
+struct UnityGroup
+{
+	std::string name;
+	std::vector<Module*> modules;
+	// Only modules which would be compiled the same way can be grouped together
+	std::string compatibilityKey;
+	unsigned long sourceSize;
+};
+
+// Modules are added to a group until their generated source adds up to this many bytes
+static const unsigned long unityGroupMaxSourceSize = 128 * 1024;
+
+// Module to the unity source it is compiled through. Modules which aren't in a group of at least
+// two modules are compiled on their own, and aren't in this table
+typedef std::unordered_map<Module*, std::string> UnitySourceTable;
+typedef UnitySourceTable::iterator UnitySourceTableIterator;
+
+static unsigned long getFileSize(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return 0;
+	unsigned long size = 0;
+	if (fseek(file, 0, SEEK_END) == 0)
+		size = (unsigned long)ftell(file);
+	fclose(file);
+	return size;
+}
+
+// Returns an empty key if the module can't be part of a group
+static std::string getUnityCompatibilityKey(ModuleManager& manager, Module* module)
+{
+	// The whole point is to share a single compiler invocation
+	if (!module->buildTimeBuildCommand.fileToExecute.empty() ||
+	    !module->buildTimeBuildCommand.arguments.empty())
+		return EmptyString;
+
+	std::string key = "unity";
+	for (const std::string& searchDir : module->cSearchDirectories)
+	{
+		key += "\n-I";
+		key += searchDir;
+	}
+	for (const std::string& option : module->additionalBuildOptions)
+	{
+		key += "\n";
+		key += option;
+	}
+	// Objects are linked into targets as a whole, so every module in one must be in the same targets
+	for (size_t i = 0; i < manager.environment.buildTargets.size(); ++i)
+	{
+		const BuildTarget& target = manager.environment.buildTargets[i];
+		if (FindInContainer(target.modules, module) != target.modules.end())
+		{
+			key += "\ntarget ";
+			key += std::to_string(i);
+		}
+	}
+	return key;
+}
+
+static bool unityGroupCanAdd(const UnityGroup& group, Module* module, const std::string& key,
+                             unsigned long moduleSize)
+{
+	if (group.compatibilityKey.compare(key) != 0 ||
+	    group.sourceSize + moduleSize > unityGroupMaxSourceSize)
+		return false;
+
+	for (Module* member : group.modules)
+	{
+		for (const std::string& typeName : module->localTypeNames)
+		{
+			if (FindInContainer(member->localTypeNames, typeName) != member->localTypeNames.end())
+			{
+				if (logging.buildProcess)
+					Logf("Not grouping %s with %s: both define local type %s\n",
+					     module->filename, member->filename, typeName.c_str());
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Modules which import the same things will likely include the same headers, so grouping them
+// saves the most parsing
+static int unityGroupCountSharedImports(const UnityGroup& group, Module* module)
+{
+	int numShared = 0;
+	for (const ModuleDependency& dependency : module->dependencies)
+	{
+		if (dependency.type != ModuleDependency_Cakelisp)
+			continue;
+
+		for (Module* member : group.modules)
+		{
+			bool found = false;
+			for (const ModuleDependency& memberDependency : member->dependencies)
+			{
+				if (memberDependency.type == ModuleDependency_Cakelisp &&
+				    memberDependency.name.compare(dependency.name) == 0)
+				{
+					found = true;
+					break;
+				}
+			}
+			if (found)
+			{
+				++numShared;
+				break;
+			}
+		}
+	}
+	return numShared;
+}
+
+// Returns false if there were errors; the file not existing is not an error
+static bool readUnityGroups(const char* filename, std::vector<UnityGroup>& groupsOut,
+                            std::vector<std::vector<std::string>>& memberSourcesOut)
+{
+	if (!fileExists(filename))
+		return true;
+
+	const std::vector<Token>* tokens = nullptr;
+	if (!moduleLoadTokenizeValidate(filename, &tokens, /*useTokenCache=*/false,
+	                                /*errorsOut=*/nullptr))
+		return false;
+
+	for (int i = 0; i < (int)(*tokens).size(); ++i)
+	{
+		if ((*tokens)[i].type != TokenType_OpenParen)
+			continue;
+
+		int endInvocationIndex = FindCloseParenTokenIndex((*tokens), i);
+		const Token& invocationToken = (*tokens)[i + 1];
+		if (invocationToken.contents.compare("unity-group") != 0)
+		{
+			Logf("error: unrecognized invocation in %s: %s\n", filename,
+			     invocationToken.contents.c_str());
+			delete tokens;
+			return false;
+		}
+
+		int nameIndex =
+		    getExpectedArgument("expected group name", (*tokens), i, 1, endInvocationIndex);
+		if (nameIndex == -1)
+		{
+			delete tokens;
+			return false;
+		}
+
+		UnityGroup group = {};
+		group.name = (*tokens)[nameIndex].contents;
+		groupsOut.push_back(group);
+
+		memberSourcesOut.push_back({});
+		for (int memberIndex = getNextArgument((*tokens), nameIndex, endInvocationIndex);
+		     memberIndex < endInvocationIndex;
+		     memberIndex = getNextArgument((*tokens), memberIndex, endInvocationIndex))
+			memberSourcesOut.back().push_back((*tokens)[memberIndex].contents);
+
+		i = endInvocationIndex;
+	}
+
+	delete tokens;
+	return true;
+}
+
+static void writeUnityGroups(const char* filename, const std::vector<UnityGroup>& groups)
+{
+	std::vector<Token> outputTokens;
+	const Token openParen = {TokenType_OpenParen, EmptyString, "ModuleManager.cpp", 1, 0, 0};
+	const Token closeParen = {TokenType_CloseParen, EmptyString, "ModuleManager.cpp", 1, 0, 0};
+	const Token groupInvoke = {TokenType_Symbol, "unity-group", "ModuleManager.cpp", 1, 0, 0};
+
+	for (const UnityGroup& group : groups)
+	{
+		outputTokens.push_back(openParen);
+		outputTokens.push_back(groupInvoke);
+
+		Token nameToken = {TokenType_String, group.name, "ModuleManager.cpp", 1, 0, 0};
+		outputTokens.push_back(nameToken);
+
+		for (Module* module : group.modules)
+		{
+			Token memberToken = {
+			    TokenType_String, module->sourceOutputName, "ModuleManager.cpp", 1, 0, 0};
+			outputTokens.push_back(memberToken);
+		}
+
+		outputTokens.push_back(closeParen);
+	}
+
+	FILE* file = fileOpen(filename, "w");
+	if (!file)
+	{
+		Logf("error: Could not write unity groups file %s\n", filename);
+		return;
+	}
+
+	prettyPrintTokensToFile(file, outputTokens);
+
+	fclose(file);
+}
+
+static bool unityBuildGroupModules(ModuleManager& manager, UnitySourceTable& unitySourcesOut)
+{
+	TraceScope groupScope("build", "unity grouping");
+
+	char groupsFilename[MAX_PATH_LENGTH] = {0};
+	if (!outputFilenameFromSourceFilename(manager.buildOutputDir.c_str(), "Unity", "cake",
+	                                      groupsFilename, sizeof(groupsFilename)))
+	{
+		Log("error: failed to create unity groups file name\n");
+		return false;
+	}
+
+	std::vector<Module*> modulesToGroup;
+	std::vector<std::string> compatibilityKeys;
+	std::vector<unsigned long> sourceSizes;
+	bool hasBuildTargets = !manager.environment.buildTargets.empty();
+	for (Module* module : manager.modules)
+	{
+		bool isBuilt =
+		    hasBuildTargets ? moduleIsInBuildTarget(manager, module) : !module->skipBuild;
+		if (!isBuilt)
+			continue;
+
+		std::string key = getUnityCompatibilityKey(manager, module);
+		if (key.empty())
+			continue;
+
+		modulesToGroup.push_back(module);
+		compatibilityKeys.push_back(key);
+		sourceSizes.push_back(getFileSize(module->sourceOutputName.c_str()));
+	}
+
+	std::vector<UnityGroup> groups;
+	std::vector<bool> isGrouped(modulesToGroup.size(), false);
+
+	// Keep modules in the groups they were in last time, as long as they still fit
+	{
+		std::vector<UnityGroup> previousGroups;
+		std::vector<std::vector<std::string>> previousMemberSources;
+		if (manager.environment.useCachedFiles &&
+		    !readUnityGroups(groupsFilename, previousGroups, previousMemberSources))
+			Logf("warning: ignoring unreadable unity groups file %s\n", groupsFilename);
+
+		for (size_t groupIndex = 0; groupIndex < previousGroups.size(); ++groupIndex)
+		{
+			UnityGroup& group = previousGroups[groupIndex];
+			for (const std::string& memberSource : previousMemberSources[groupIndex])
+			{
+				for (size_t i = 0; i < modulesToGroup.size(); ++i)
+				{
+					if (isGrouped[i] ||
+					    modulesToGroup[i]->sourceOutputName.compare(memberSource) != 0)
+						continue;
+
+					bool isFirstMember = group.modules.empty();
+					if (isFirstMember)
+						group.compatibilityKey = compatibilityKeys[i];
+					if (isFirstMember || unityGroupCanAdd(group, modulesToGroup[i],
+					                                      compatibilityKeys[i], sourceSizes[i]))
+					{
+						group.modules.push_back(modulesToGroup[i]);
+						group.sourceSize += sourceSizes[i];
+						isGrouped[i] = true;
+					}
+					break;
+				}
+			}
+
+			if (!group.modules.empty())
+				groups.push_back(group);
+		}
+	}
+
+	// New modules, and those which no longer fit their old group, go in the most similar group
+	for (size_t i = 0; i < modulesToGroup.size(); ++i)
+	{
+		if (isGrouped[i])
+			continue;
+
+		UnityGroup* bestGroup = nullptr;
+		int bestNumSharedImports = -1;
+		for (UnityGroup& group : groups)
+		{
+			if (!unityGroupCanAdd(group, modulesToGroup[i], compatibilityKeys[i], sourceSizes[i]))
+				continue;
+
+			int numSharedImports = unityGroupCountSharedImports(group, modulesToGroup[i]);
+			if (numSharedImports > bestNumSharedImports)
+			{
+				bestGroup = &group;
+				bestNumSharedImports = numSharedImports;
+			}
+		}
+
+		if (!bestGroup)
+		{
+			UnityGroup newGroup = {};
+			// Find an unused name, which keeps the other groups' files untouched
+			for (int nameIndex = 0; newGroup.name.empty(); ++nameIndex)
+			{
+				std::string name = "Unity" + std::to_string(nameIndex);
+				bool nameUsed = false;
+				for (const UnityGroup& group : groups)
+				{
+					if (group.name.compare(name) == 0)
+					{
+						nameUsed = true;
+						break;
+					}
+				}
+				if (!nameUsed)
+					newGroup.name = name;
+			}
+			newGroup.compatibilityKey = compatibilityKeys[i];
+			groups.push_back(newGroup);
+			bestGroup = &groups.back();
+		}
+
+		bestGroup->modules.push_back(modulesToGroup[i]);
+		bestGroup->sourceSize += sourceSizes[i];
+		isGrouped[i] = true;
+	}
+
+	writeUnityGroups(groupsFilename, groups);
+
+	for (const UnityGroup& group : groups)
+	{
+		if (group.modules.size() < 2)
+			continue;
+
+		char unitySourceName[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(unitySourceName, "%s/%s.cpp", manager.buildOutputDir.c_str(),
+		             group.name.c_str());
+
+		// Sources are in the same directory as the unity source, so they can be included by name
+		std::string contents =
+		    "// Generated by Cakelisp. Compiles these modules together in a single unity build\n";
+		for (Module* module : group.modules)
+		{
+			char sourceFilename[MAX_PATH_LENGTH] = {0};
+			getFilenameFromPath(module->sourceOutputName.c_str(), sourceFilename,
+			                    sizeof(sourceFilename));
+			contents += "#include \"";
+			contents += sourceFilename;
+			contents += "\"\n";
+
+			unitySourcesOut[module] = unitySourceName;
+		}
+
+		if (!writeIfContentsNewer(contents, unitySourceName))
+			return false;
+
+		if (logging.buildProcess)
+			Logf("Unity build %s: %d modules, %lu bytes of source\n", unitySourceName,
+			     (int)group.modules.size(), group.sourceSize);
+	}
 
+	return true;
+}
+
+static bool collectBuiltObjects(ModuleManager& manager, ConfigurationBuild& configuration,
+                                UnitySourceTable& unitySources)
+{
+	std::vector<std::string> unitySourcesAdded;
+	for (Module* module : manager.modules)
+	{
 		ProcessCommand* buildCommandOverride = nullptr;
 		{
 			int buildCommandState = 0;
@@ -743,7 +2021,6 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtO
 				    "error: module build command override must be completely defined. Missing %s\n",
 				    module->buildTimeBuildCommand.fileToExecute.empty() ? "file to execute" :
 				                                                          "arguments");
-				builtObjectsFree(builtObjects);
 				return false;
 			}
 
@@ -751,6 +2028,12 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtO
 				buildCommandOverride = &module->buildTimeBuildCommand;
 		}
 
+		// With build targets, exactly the modules they list are built, even if they were imported
+		// only for their declarations
+		bool hasBuildTargets = !manager.environment.buildTargets.empty();
+		if (hasBuildTargets && !moduleIsInBuildTarget(manager, module))
+			continue;
+
 		if (logging.buildProcess)
 			Logf("Build module %s\n", module->sourceOutputName.c_str());
 		for (ModuleDependency& dependency : module->dependencies)
@@ -765,40 +2048,49 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtO
 
 			if (dependency.type == ModuleDependency_CFile)
 			{
-				BuiltObject* newBuiltObject = new BuiltObject;
-				newBuiltObject->buildStatus = 0;
-				newBuiltObject->sourceFilename = dependency.name;
-
 				char buildObjectName[MAX_PATH_LENGTH] = {0};
 				if (!outputFilenameFromSourceFilename(
-				        manager.buildOutputDir.c_str(), newBuiltObject->sourceFilename.c_str(),
+				        configuration.buildOutputDir.c_str(), dependency.name.c_str(),
 				        compilerObjectExtension, buildObjectName, sizeof(buildObjectName)))
 				{
-					delete newBuiltObject;
 					Log("error: failed to create suitable output filename");
-					builtObjectsFree(builtObjects);
 					return false;
 				}
 
+				BuiltObject* newBuiltObject = new BuiltObject;
+				newBuiltObject->buildStatus = 0;
+				newBuiltObject->sourceFilename = dependency.name;
+				newBuiltObject->module = module;
 				newBuiltObject->filename = buildObjectName;
 
 				// This is a bit weird to automatically use the parent module's build command
 				copyModuleBuildOptionsToBuiltObject(module, buildCommandOverride, newBuiltObject);
 
-				builtObjects.push_back(newBuiltObject);
+				configuration.builtObjects.push_back(newBuiltObject);
 			}
 		}
 
-		if (module->skipBuild)
+		if (module->skipBuild && !hasBuildTargets)
 			continue;
 
+		// The first module of a unity group builds the whole group. Every module in a group has
+		// the same options and targets, so it can stand in for the others
+		std::string sourceFilename = module->sourceOutputName;
+		UnitySourceTableIterator findUnityIt = unitySources.find(module);
+		if (findUnityIt != unitySources.end())
+		{
+			if (FindInContainer(unitySourcesAdded, findUnityIt->second) != unitySourcesAdded.end())
+				continue;
+			unitySourcesAdded.push_back(findUnityIt->second);
+			sourceFilename = findUnityIt->second;
+		}
+
 		char buildObjectName[MAX_PATH_LENGTH] = {0};
 		if (!outputFilenameFromSourceFilename(
-		        manager.buildOutputDir.c_str(), module->sourceOutputName.c_str(),
+		        configuration.buildOutputDir.c_str(), sourceFilename.c_str(),
 		        compilerObjectExtension, buildObjectName, sizeof(buildObjectName)))
 		{
 			Log("error: failed to create suitable output filename");
-			builtObjectsFree(builtObjects);
 			return false;
 		}
 
@@ -806,327 +2098,506 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtO
 		// In that case, the status code should still be 0, as if we built and succeeded building it
 		BuiltObject* newBuiltObject = new BuiltObject;
 		newBuiltObject->buildStatus = 0;
-		newBuiltObject->sourceFilename = module->sourceOutputName.c_str();
+		newBuiltObject->sourceFilename = sourceFilename;
 		newBuiltObject->filename = buildObjectName;
+		newBuiltObject->module = module;
 
 		copyModuleBuildOptionsToBuiltObject(module, buildCommandOverride, newBuiltObject);
 
-		builtObjects.push_back(newBuiltObject);
+		configuration.builtObjects.push_back(newBuiltObject);
 	}
 
-	HeaderModificationTimeTable headerModifiedCache;
+	return true;
+}
+
+// Sets processStartedOut if the object couldn't be taken from the cache, and a compiler was started
+static bool buildObject(ModuleManager& manager, ConfigurationBuild& configuration,
+                        BuiltObject* object, HeaderModificationTimeTable& headerModifiedCache,
+                        bool* processStartedOut)
+{
+	*processStartedOut = false;
 
-	for (BuiltObject* object : builtObjects)
+	std::vector<const char*> searchDirArgs;
+	searchDirArgs.reserve(object->includesSearchDirs.size() +
+	                      manager.environment.cSearchDirectories.size());
+	for (const std::string& searchDirArg : object->includesSearchDirs)
 	{
-		std::vector<const char*> searchDirArgs;
-		searchDirArgs.reserve(object->includesSearchDirs.size() +
-		                      manager.environment.cSearchDirectories.size());
-		for (const std::string& searchDirArg : object->includesSearchDirs)
+		searchDirArgs.push_back(searchDirArg.c_str());
+	}
+
+	// This code sucks
+	std::vector<std::string> globalSearchDirArgs;
+	globalSearchDirArgs.reserve(manager.environment.cSearchDirectories.size());
+	for (const std::string& searchDir : manager.environment.cSearchDirectories)
+	{
+		char searchDirToArgument[MAX_PATH_LENGTH + 2];
+		PrintfBuffer(searchDirToArgument, "-I%s", searchDir.c_str());
+		globalSearchDirArgs.push_back(searchDirToArgument);
+		searchDirArgs.push_back(globalSearchDirArgs.back().c_str());
+	}
+
+	std::vector<const char*> additionalOptions;
+	for (const std::string& option : object->additionalOptions)
+	{
+		additionalOptions.push_back(option.c_str());
+	}
+	for (const std::string& option : configuration.additionalOptions)
+	{
+		additionalOptions.push_back(option.c_str());
+	}
+
+	ProcessCommand& buildCommand = object->buildCommandOverride ?
+	                                   *object->buildCommandOverride :
+	                                   manager.environment.buildTimeBuildCommand;
+
+	ProcessCommandInput buildTimeInputs[] = {
+	    {ProcessCommandArgumentType_SourceInput, {object->sourceFilename.c_str()}},
+	    {ProcessCommandArgumentType_ObjectOutput, {object->filename.c_str()}},
+	    {ProcessCommandArgumentType_IncludeSearchDirs, std::move(searchDirArgs)},
+	    {ProcessCommandArgumentType_AdditionalOptions, std::move(additionalOptions)}};
+	const char** buildArguments = MakeProcessArgumentsFromCommand(buildCommand, buildTimeInputs,
+	                                                              ArraySize(buildTimeInputs));
+	if (!buildArguments)
+	{
+		Log("error: failed to construct build arguments\n");
+		return false;
+	}
+
+	uint32_t commandCrc = 0;
+	bool commandEqualsCached = commandEqualsCachedCommand(configuration, object->filename.c_str(),
+	                                                      buildArguments, &commandCrc);
+	// We could avoid doing this work, but it makes it easier to log if we do it regardless of
+	// commandEqualsCached invalidating our cache anyways
+	bool canUseCache = canUseCachedFile(manager.environment, object->sourceFilename.c_str(),
+	                                    object->filename.c_str());
+	bool headersModified = false;
+	if (commandEqualsCached && canUseCache)
+	{
+		std::vector<std::string> headerSearchDirectories;
 		{
-			searchDirArgs.push_back(searchDirArg.c_str());
+			headerSearchDirectories.reserve(object->headerSearchDirectories.size() +
+			                                manager.environment.cSearchDirectories.size() + 1);
+			// Must include CWD to find generated cakelisp files
+			headerSearchDirectories.push_back(".");
+			PushBackAll(headerSearchDirectories, object->headerSearchDirectories);
+			PushBackAll(headerSearchDirectories, manager.environment.cSearchDirectories);
 		}
 
-		// This code sucks
-		std::vector<std::string> globalSearchDirArgs;
-		globalSearchDirArgs.reserve(manager.environment.cSearchDirectories.size());
-		for (const std::string& searchDir : manager.environment.cSearchDirectories)
+		// Note that I use the .o as "includedBy" because our header may not have needed any
+		// changes if our include changed. We have to use the .o as the time reference that
+		// we've rebuilt
+		unsigned long mostRecentHeaderModTime = 0;
 		{
-			char searchDirToArgument[MAX_PATH_LENGTH + 2];
-			PrintfBuffer(searchDirToArgument, "-I%s", searchDir.c_str());
-			globalSearchDirArgs.push_back(searchDirToArgument);
-			searchDirArgs.push_back(globalSearchDirArgs.back().c_str());
+			TraceScope includeScanScope("include scanning", object->sourceFilename.c_str());
+			mostRecentHeaderModTime = GetMostRecentIncludeModified_Recursive(
+			    headerSearchDirectories, object->sourceFilename.c_str(),
+			    /*includedBy*/ nullptr, headerModifiedCache);
 		}
 
-		std::vector<const char*> additionalOptions;
-		for (const std::string& option : object->additionalOptions)
+		unsigned long artifactModTime = fileGetLastModificationTime(object->filename.c_str());
+		if (artifactModTime >= mostRecentHeaderModTime)
 		{
-			additionalOptions.push_back(option.c_str());
+			if (logging.buildProcess)
+				Logf("Skipping compiling %s (using cached object)\n", object->filename.c_str());
+			free(buildArguments);
+			return true;
 		}
-
-		ProcessCommand& buildCommand = object->buildCommandOverride ?
-		                                   *object->buildCommandOverride :
-		                                   manager.environment.buildTimeBuildCommand;
-
-		ProcessCommandInput buildTimeInputs[] = {
-		    {ProcessCommandArgumentType_SourceInput, {object->sourceFilename.c_str()}},
-		    {ProcessCommandArgumentType_ObjectOutput, {object->filename.c_str()}},
-		    {ProcessCommandArgumentType_IncludeSearchDirs, std::move(searchDirArgs)},
-		    {ProcessCommandArgumentType_AdditionalOptions, std::move(additionalOptions)}};
-		const char** buildArguments = MakeProcessArgumentsFromCommand(buildCommand, buildTimeInputs,
-		                                                              ArraySize(buildTimeInputs));
-		if (!buildArguments)
+		else
 		{
-			Log("error: failed to construct build arguments\n");
-			builtObjectsFree(builtObjects);
-			return false;
+			headersModified = true;
+			if (logging.includeScanning || logging.buildProcess)
+				Logf("--- Must rebuild %s (header files modified)\n", object->filename.c_str());
 		}
+	}
 
-		uint32_t commandCrc = 0;
-		bool commandEqualsCached = commandEqualsCachedCommand(manager, object->filename.c_str(),
-		                                                      buildArguments, &commandCrc);
-		// We could avoid doing this work, but it makes it easier to log if we do it regardless of
-		// commandEqualsCached invalidating our cache anyways
-		bool canUseCache = canUseCachedFile(manager.environment, object->sourceFilename.c_str(),
-		                                    object->filename.c_str());
-		bool headersModified = false;
-		if (commandEqualsCached && canUseCache)
-		{
-			std::vector<std::string> headerSearchDirectories;
-			{
-				headerSearchDirectories.reserve(object->headerSearchDirectories.size() +
-				                                manager.environment.cSearchDirectories.size() + 1);
-				// Must include CWD to find generated cakelisp files
-				headerSearchDirectories.push_back(".");
-				PushBackAll(headerSearchDirectories, object->headerSearchDirectories);
-				PushBackAll(headerSearchDirectories, manager.environment.cSearchDirectories);
-			}
+	if (logging.buildReasons)
+	{
+		Logf("Build %s reason(s):\n", object->filename.c_str());
+		if (!canUseCache)
+			Log("\tobject files updated\n");
+		if (!commandEqualsCached)
+			Log("\tcommand changed since last run\n");
+		if (headersModified)
+			Log("\theaders modified\n");
+	}
 
-			// Note that I use the .o as "includedBy" because our header may not have needed any
-			// changes if our include changed. We have to use the .o as the time reference that
-			// we've rebuilt
-			unsigned long mostRecentHeaderModTime = GetMostRecentIncludeModified_Recursive(
-			    headerSearchDirectories, object->sourceFilename.c_str(),
-			    /*includedBy*/ nullptr, headerModifiedCache);
+	if (!commandEqualsCached)
+		configuration.newCommandCrcs[object->filename] = commandCrc;
 
-			unsigned long artifactModTime = fileGetLastModificationTime(object->filename.c_str());
-			if (artifactModTime >= mostRecentHeaderModTime)
-			{
-				if (logging.buildProcess)
-					Logf("Skipping compiling %s (using cached object)\n",
-					     object->sourceFilename.c_str());
-				continue;
-			}
-			else
-			{
-				headersModified = true;
-				if (logging.includeScanning || logging.buildProcess)
-					Logf("--- Must rebuild %s (header files modified)\n",
-					     object->sourceFilename.c_str());
-			}
+	// Go through with the build
+	RunProcessArguments compileArguments = {};
+	compileArguments.fileToExecute = buildCommand.fileToExecute.c_str();
+	compileArguments.arguments = buildArguments;
+	compileArguments.resultOut = &object->processResult;
+	// PrintProcessArguments(buildArguments);
+
+	if (runProcess(compileArguments, &object->buildStatus) != 0)
+	{
+		Log("error: failed to invoke compiler\n");
+		free(buildArguments);
+		return false;
+	}
+
+	free(buildArguments);
+	*processStartedOut = true;
+	return true;
+}
+
+static bool createConfigurationLinks(ModuleManager& manager, ConfigurationBuild& configuration)
+{
+	std::vector<BuildTargetLink>& links = configuration.links;
+	if (manager.environment.buildTargets.empty())
+	{
+		std::string outputName;
+		getExecutableOutputName(manager, outputName);
+
+		links.resize(1);
+		if (!buildTargetLinkInitialize(manager, configuration, links[0],
+		                               BuildTargetType_Executable, outputName,
+		                               /*linkCommandOverride=*/nullptr))
+			return false;
+	}
+	else
+	{
+		links.resize(manager.environment.buildTargets.size());
+		for (size_t i = 0; i < links.size(); ++i)
+		{
+			const BuildTarget& target = manager.environment.buildTargets[i];
+			if (!buildTargetLinkInitialize(manager, configuration, links[i], target.type,
+			                               target.outputName, &target.linkCommandOverride))
+				return false;
 		}
+	}
 
-		if (logging.buildReasons)
+	for (size_t i = 0; i < links.size(); ++i)
+	{
+		BuildTargetLink& link = links[i];
+		const BuildTarget* target = nullptr;
+		if (!manager.environment.buildTargets.empty())
+			target = &manager.environment.buildTargets[i];
+		for (BuiltObject* object : configuration.builtObjects)
 		{
-			Logf("Build %s reason(s):\n", object->filename.c_str());
-			if (!canUseCache)
-				Log("\tobject files updated\n");
-			if (!commandEqualsCached)
-				Log("\tcommand changed since last run\n");
-			if (headersModified)
-				Log("\theaders modified\n");
+			if (target && FindInContainer(target->modules, object->module) == target->modules.end())
+				continue;
+
+			if (logging.buildProcess)
+				Logf("Need to link %s into %s\n", object->filename.c_str(),
+				     link.finalOutputName.c_str());
+
+			link.objects.push_back(object);
 		}
+	}
 
-		if (!commandEqualsCached)
-			manager.newCommandCrcs[object->filename] = commandCrc;
+	return true;
+}
 
-		// Go through with the build
-		RunProcessArguments compileArguments = {};
-		compileArguments.fileToExecute = buildCommand.fileToExecute.c_str();
-		compileArguments.arguments = buildArguments;
-		// PrintProcessArguments(buildArguments);
+// Objects and links are built as a graph of jobs. Each link only waits for its own objects, so it
+// starts while unrelated objects are still compiling
+struct BuildJob
+{
+	ConfigurationBuild* configuration;
+	// Exactly one of these is set
+	BuiltObject* object;
+	BuildTargetLink* link;
+
+	// Jobs which can start once this one succeeds
+	std::vector<int> dependents;
+	int numDependenciesRemaining;
+	bool isRunning;
+};
 
-		if (runProcess(compileArguments, &object->buildStatus) != 0)
+static void buildJobAddDependency(std::vector<BuildJob>& jobs, int jobIndex, int dependencyIndex)
+{
+	jobs[dependencyIndex].dependents.push_back(jobIndex);
+	++jobs[jobIndex].numDependenciesRemaining;
+}
+
+static void buildJobsCreate(std::vector<ConfigurationBuild>& configurations,
+                            std::vector<BuildJob>& jobsOut)
+{
+	for (ConfigurationBuild& configuration : configurations)
+	{
+		int firstObjectJobIndex = jobsOut.size();
+		for (BuiltObject* object : configuration.builtObjects)
+			jobsOut.push_back({&configuration, object, nullptr, {}, 0, false});
+
+		int firstLinkJobIndex = jobsOut.size();
+		for (BuildTargetLink& link : configuration.links)
 		{
-			Log("error: failed to invoke compiler\n");
-			free(buildArguments);
-			builtObjectsFree(builtObjects);
-			return false;
-		}
+			int linkJobIndex = jobsOut.size();
+			jobsOut.push_back({&configuration, nullptr, &link, {}, 0, false});
 
-		free(buildArguments);
+			for (BuiltObject* object : link.objects)
+			{
+				int objectIndex = FindInContainer(configuration.builtObjects, object) -
+				                  configuration.builtObjects.begin();
+				buildJobAddDependency(jobsOut, linkJobIndex, firstObjectJobIndex + objectIndex);
+			}
+		}
 
-		// TODO This could be made smarter by allowing more spawning right when a process
-		// closes, instead of starting in waves
-		++currentNumProcessesSpawned;
-		if (currentNumProcessesSpawned >= maxProcessesRecommendedSpawned)
+		// Libraries are copied to their final output before executables are linked, because
+		// executables may link against them
+		for (int linkJobIndex = firstLinkJobIndex; linkJobIndex < (int)jobsOut.size();
+		     ++linkJobIndex)
 		{
-			waitForAllProcessesClosed(OnCompileProcessOutput);
-			currentNumProcessesSpawned = 0;
+			if (jobsOut[linkJobIndex].link->type != BuildTargetType_Executable)
+				continue;
+
+			for (int libraryJobIndex = firstLinkJobIndex; libraryJobIndex < (int)jobsOut.size();
+			     ++libraryJobIndex)
+			{
+				if (jobsOut[libraryJobIndex].link->type != BuildTargetType_Executable)
+					buildJobAddDependency(jobsOut, linkJobIndex, libraryJobIndex);
+			}
 		}
 	}
+}
 
-	if (logging.includeScanning || logging.performance)
-		Logf("%lu files tested for modification times\n", headerModifiedCache.size());
+// Sets processStartedOut if the job has to wait for a process. Otherwise, it is already done
+static bool buildJobStart(ModuleManager& manager, BuildJob& job,
+                          HeaderModificationTimeTable& headerModifiedCache,
+                          bool* processStartedOut)
+{
+	*processStartedOut = false;
 
-	waitForAllProcessesClosed(OnCompileProcessOutput);
-	currentNumProcessesSpawned = 0;
+	if (job.object)
+		return buildObject(manager, *job.configuration, job.object, headerModifiedCache,
+		                   processStartedOut);
 
-	std::string outputExecutableName;
-	if (!manager.environment.executableOutput.empty())
-	{
-		char outputExecutableFilename[MAX_PATH_LENGTH] = {0};
-		getFilenameFromPath(manager.environment.executableOutput.c_str(), outputExecutableFilename,
-		                    sizeof(outputExecutableFilename));
+	BuildTargetLink& link = *job.link;
+	if (link.objects.empty())
+		return true;
 
-		outputExecutableName = outputExecutableFilename;
-	}
-	if (outputExecutableName.empty())
-		outputExecutableName = "a.out";
+	if (!buildTargetLinkPrepare(manager, *job.configuration, link))
+		return false;
 
-	char outputExecutableCachePath[MAX_PATH_LENGTH] = {0};
-	if (!outputFilenameFromSourceFilename(
-	        manager.buildOutputDir.c_str(), outputExecutableName.c_str(),
-	        /*addExtension=*/nullptr, outputExecutableCachePath, sizeof(outputExecutableCachePath)))
+	if (!link.needsLink)
+		return true;
+
+	// Archivers add to existing archives, which would keep objects no longer in the target
+	if (link.type == BuildTargetType_StaticLibrary)
+		remove(link.cachedOutputName.c_str());
+
+	RunProcessArguments linkArguments = {};
+	linkArguments.fileToExecute = link.linkCommand.fileToExecute.c_str();
+	linkArguments.arguments = link.linkArguments;
+	linkArguments.resultOut = &link.linkResult;
+	if (runProcess(linkArguments, &link.linkStatus) != 0)
 	{
-		builtObjectsFree(builtObjects);
+		Logf("error: failed to invoke linker for %s\n", link.finalOutputName.c_str());
 		return false;
 	}
-	outputExecutableName = outputExecutableCachePath;
 
-	int numObjectsToLink = 0;
-	bool succeededBuild = true;
-	bool objectsDirty = false;
-	for (BuiltObject* object : builtObjects)
+	*processStartedOut = true;
+	return true;
+}
+
+static bool runPostBuildProcessHooks(ModuleManager& manager, const ProcessResult& result)
+{
+	for (PostBuildProcessHook hook : manager.environment.postBuildProcessHooks)
 	{
-		// Module* module = manager.modules[moduleIndex];
-		int buildResult = object->buildStatus;
-		if (buildResult != 0)
+		if (!hook(manager, result))
 		{
-			Logf("error: failed to make target %s\n", object->filename.c_str());
-			succeededBuild = false;
-			continue;
+			Log("error: hook returned failure. Aborting build\n");
+			return false;
 		}
+	}
+	return true;
+}
 
-		if (logging.buildProcess)
-			Logf("Need to link %s\n", object->filename.c_str());
-
-		++numObjectsToLink;
-
-		// If all our objects are older than our executable, don't even link!
-		objectsDirty |= !canUseCachedFile(manager.environment, object->filename.c_str(),
-		                                  outputExecutableName.c_str());
+// Returns false if the job failed, in which case its dependents must not start
+static bool buildJobFinish(ModuleManager& manager, BuildJob& job,
+                           std::vector<std::string>& builtOutputs)
+{
+	if (job.object)
+	{
+		if (job.object->buildStatus != 0)
+		{
+			Logf("error: failed to make target %s\n", job.object->filename.c_str());
+			return false;
+		}
+		return true;
 	}
 
-	if (!succeededBuild)
+	BuildTargetLink& link = *job.link;
+	if (link.linkStatus != 0)
 	{
-		builtObjectsFree(builtObjects);
+		Logf("error: failed to link %s\n", link.finalOutputName.c_str());
 		return false;
 	}
 
-	std::string finalOutputName;
-	getExecutableOutputName(manager, finalOutputName);
+	if (!buildTargetLinkCopyToFinalOutput(manager, link))
+		return false;
+
+	Logf("%s %s\n", link.needsLink ? "Successfully built and linked" : "No changes needed for",
+	     link.finalOutputName.c_str());
 
-	if (numObjectsToLink)
+	if (link.type == BuildTargetType_Executable)
+		builtOutputs.push_back(link.finalOutputName);
+	return true;
+}
+
+static void buildJobMarkDependentsReady(std::vector<BuildJob>& jobs, const BuildJob& job,
+                                        std::vector<int>& readyJobs)
+{
+	for (int dependentIndex : job.dependents)
 	{
-		std::vector<const char*> objectsToLink(numObjectsToLink);
-		for (int i = 0; i < numObjectsToLink; ++i)
-		{
-			BuiltObject* object = builtObjects[i];
+		if (--jobs[dependentIndex].numDependenciesRemaining)
+			continue;
 
-			objectsToLink[i] = object->filename.c_str();
-		}
+		// Links go first. Everything waiting on them is the end of the build
+		if (jobs[dependentIndex].link)
+			readyJobs.insert(readyJobs.begin(), dependentIndex);
+		else
+			readyJobs.push_back(dependentIndex);
+	}
+}
 
-		// Copy it so hooks can modify it
-		ProcessCommand linkCommand = manager.environment.buildTimeLinkCommand;
-		ProcessCommandInput linkTimeInputs[] = {
-		    {ProcessCommandArgumentType_ExecutableOutput, {outputExecutableName.c_str()}},
-		    {ProcessCommandArgumentType_ObjectInput, objectsToLink}};
+// Runs every job as soon as what it depends on has succeeded. If a job fails, everything which
+// doesn't depend on it still runs, so all errors are reported at once
+static bool buildJobsRun(ModuleManager& manager, std::vector<BuildJob>& jobs,
+                         std::vector<std::string>& builtOutputs)
+{
+	HeaderModificationTimeTable headerModifiedCache;
 
-		// Hooks should cooperate with eachother, i.e. try to only add things
-		for (PreLinkHook preLinkHook : manager.environment.preLinkHooks)
+	std::vector<int> readyJobs;
+	for (int i = 0; i < (int)jobs.size(); ++i)
+	{
+		if (!jobs[i].numDependenciesRemaining)
+			readyJobs.push_back(i);
+	}
+
+	bool succeededBuild = true;
+	// Every configuration's processes count towards the same limit, so configurations build
+	// concurrently without overloading the machine
+	int numProcessesRunning = 0;
+	while (true)
+	{
+		while (!readyJobs.empty() && numProcessesRunning < maxProcessesRecommendedSpawned)
 		{
-			if (!preLinkHook(manager, linkCommand, linkTimeInputs, ArraySize(linkTimeInputs)))
+			BuildJob& job = jobs[readyJobs.front()];
+			readyJobs.erase(readyJobs.begin());
+
+			bool processStarted = false;
+			if (!buildJobStart(manager, job, headerModifiedCache, &processStarted))
 			{
-				Log("error: hook returned failure. Aborting build\n");
-				builtObjectsFree(builtObjects);
+				waitForAllProcessesClosed(OnCompileProcessOutput);
 				return false;
 			}
+
+			if (processStarted)
+			{
+				job.isRunning = true;
+				++numProcessesRunning;
+			}
+			else if (buildJobFinish(manager, job, builtOutputs))
+				buildJobMarkDependentsReady(jobs, job, readyJobs);
+			else
+				succeededBuild = false;
 		}
 
-		const char** linkArgumentList =
-		    MakeProcessArgumentsFromCommand(linkCommand, linkTimeInputs, ArraySize(linkTimeInputs));
-		if (!linkArgumentList)
+		if (!numProcessesRunning)
+			break;
+
+		// This may also be a process started elsewhere, e.g. an optimized compile-time build
+		int* closedProcessStatus = waitForAnyProcessClosed(OnCompileProcessOutput);
+		if (!closedProcessStatus)
 		{
-			builtObjectsFree(builtObjects);
+			Log("error: build processes closed unexpectedly\n");
 			return false;
 		}
 
-		uint32_t commandCrc = 0;
-		bool commandEqualsCached = commandEqualsCachedCommand(manager, finalOutputName.c_str(),
-		                                                      linkArgumentList, &commandCrc);
-
-		// Check if we can use the cached version
-		if (!objectsDirty && commandEqualsCached)
+		for (BuildJob& job : jobs)
 		{
-			if (logging.buildProcess)
-				Log("Skipping linking (no built objects are newer than cached executable, command "
-				    "identical)\n");
+			int* jobStatus = job.object ? &job.object->buildStatus : &job.link->linkStatus;
+			if (!job.isRunning || jobStatus != closedProcessStatus)
+				continue;
 
+			job.isRunning = false;
+			--numProcessesRunning;
+			if (!runPostBuildProcessHooks(
+			        manager, job.object ? job.object->processResult : job.link->linkResult))
 			{
-				if (!copyExecutableToFinalOutput(manager, outputExecutableName, finalOutputName))
-				{
-					free(linkArgumentList);
-					builtObjectsFree(builtObjects);
-					return false;
-				}
-
-				Logf("No changes needed for %s\n", finalOutputName.c_str());
-				builtOutputs.push_back(finalOutputName);
+				waitForAllProcessesClosed(OnCompileProcessOutput);
+				return false;
 			}
 
-			free(linkArgumentList);
-			builtObjectsFree(builtObjects);
-			moduleManagerWriteCacheFile(manager);
-			return true;
+			if (buildJobFinish(manager, job, builtOutputs))
+				buildJobMarkDependentsReady(jobs, job, readyJobs);
+			else
+				succeededBuild = false;
+			break;
 		}
+	}
 
-		if (logging.buildReasons)
-		{
-			Logf("Link %s reason(s):\n", finalOutputName.c_str());
-			if (objectsDirty)
-				Log("\tobject files updated\n");
-			if (!commandEqualsCached)
-				Log("\tcommand changed since last run\n");
-		}
+	if (logging.includeScanning || logging.performance)
+		Logf("%lu files tested for modification times\n", headerModifiedCache.size());
 
-		if (!commandEqualsCached)
-			manager.newCommandCrcs[finalOutputName] = commandCrc;
+	return succeededBuild;
+}
 
-		RunProcessArguments linkArguments = {};
-		linkArguments.fileToExecute = linkCommand.fileToExecute.c_str();
-		linkArguments.arguments = linkArgumentList;
-		int linkStatus = 0;
-		if (runProcess(linkArguments, &linkStatus) != 0)
+static bool moduleManagerBuildConfigurations(ModuleManager& manager,
+                                             std::vector<ConfigurationBuild>& configurations,
+                                             std::vector<std::string>& builtOutputs)
+{
+	// Hooks run once per module, no matter how many configurations are built
+	for (Module* module : manager.modules)
+	{
+		for (ModulePreBuildHook hook : module->preBuildHooks)
 		{
-			free(linkArgumentList);
-			builtObjectsFree(builtObjects);
-			return false;
+			if (!hook(manager, module))
+			{
+				Log("error: hook returned failure. Aborting build\n");
+				return false;
+			}
 		}
-
-		free(linkArgumentList);
-
-		waitForAllProcessesClosed(OnCompileProcessOutput);
-
-		succeededBuild = linkStatus == 0;
 	}
 
-	if (!succeededBuild)
-	{
-		builtObjectsFree(builtObjects);
+	UnitySourceTable unitySources;
+	if (manager.unityBuild && !unityBuildGroupModules(manager, unitySources))
 		return false;
-	}
 
+	for (ConfigurationBuild& configuration : configurations)
 	{
-		if (!copyExecutableToFinalOutput(manager, outputExecutableName, finalOutputName))
-		{
-			builtObjectsFree(builtObjects);
+		if (!collectBuiltObjects(manager, configuration, unitySources))
 			return false;
-		}
+	}
 
-		Logf("Successfully built and linked %s\n", finalOutputName.c_str());
-		builtOutputs.push_back(finalOutputName);
+	// Objects are shared by every target which lists their module, so they are only built once
+	for (ConfigurationBuild& configuration : configurations)
+	{
+		if (!createConfigurationLinks(manager, configuration))
+			return false;
 	}
 
-	builtObjectsFree(builtObjects);
-	moduleManagerWriteCacheFile(manager);
+	// Generated code was written and hooks may have created files since directories were listed
+	fileExistsCacheClear();
+
+	std::vector<BuildJob> jobs;
+	buildJobsCreate(configurations, jobs);
+	if (!buildJobsRun(manager, jobs, builtOutputs))
+		return false;
+
+	for (ConfigurationBuild& configuration : configurations)
+		moduleManagerWriteCacheFile(configuration);
+
 	return true;
 }
 
+bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtOutputs)
+{
+	std::vector<ConfigurationBuild> configurations;
+	bool succeededBuild = configurationBuildsCreate(manager, configurations) &&
+	                      moduleManagerBuildConfigurations(manager, configurations, builtOutputs);
+	configurationBuildsFree(configurations);
+	return succeededBuild;
+}
+
 // Returns false if there were errors; the file not existing is not an error
-static bool moduleManagerReadCacheFile(ModuleManager& manager)
+static bool moduleManagerReadCacheFile(ConfigurationBuild& configuration)
 {
 	char inputFilename[MAX_PATH_LENGTH] = {0};
-	if (!outputFilenameFromSourceFilename(manager.buildOutputDir.c_str(), "Cache", "cake",
+	if (!outputFilenameFromSourceFilename(configuration.buildOutputDir.c_str(), "Cache", "cake",
 	                                      inputFilename, sizeof(inputFilename)))
 	{
 		Log("error: failed to create cache file name\n");
@@ -1138,7 +2609,9 @@ static bool moduleManagerReadCacheFile(ModuleManager& manager)
 		return true;
 
 	const std::vector<Token>* tokens = nullptr;
-	if (!moduleLoadTokenizeValidate(inputFilename, &tokens))
+	// Small enough that caching its tokens wouldn't help, and it changes every build
+	if (!moduleLoadTokenizeValidate(inputFilename, &tokens, /*useTokenCache=*/false,
+	                                /*errorsOut=*/nullptr))
 	{
 		// moduleLoadTokenizeValidate deletes tokens on error
 		return false;
@@ -1169,7 +2642,7 @@ static bool moduleManagerReadCacheFile(ModuleManager& manager)
 				}
 
 				char* endPtr;
-				manager.cachedCommandCrcs[(*tokens)[artifactIndex].contents] =
+				configuration.cachedCommandCrcs[(*tokens)[artifactIndex].contents] =
 				    strtol((*tokens)[crcIndex].contents.c_str(), &endPtr, /*base=*/10);
 			}
 			else
@@ -1188,10 +2661,10 @@ static bool moduleManagerReadCacheFile(ModuleManager& manager)
 	return true;
 }
 
-static void moduleManagerWriteCacheFile(ModuleManager& manager)
+static void moduleManagerWriteCacheFile(ConfigurationBuild& configuration)
 {
 	char outputFilename[MAX_PATH_LENGTH] = {0};
-	if (!outputFilenameFromSourceFilename(manager.buildOutputDir.c_str(), "Cache", "cake",
+	if (!outputFilenameFromSourceFilename(configuration.buildOutputDir.c_str(), "Cache", "cake",
 	                                      outputFilename, sizeof(outputFilename)))
 	{
 		Log("error: failed to create cache file name\n");
@@ -1200,10 +2673,10 @@ static void moduleManagerWriteCacheFile(ModuleManager& manager)
 
 	// Combine all CRCs into a single map
 	ArtifactCrcTable outputCrcs;
-	for (ArtifactCrcTablePair& crcPair : manager.cachedCommandCrcs)
+	for (ArtifactCrcTablePair& crcPair : configuration.cachedCommandCrcs)
 		outputCrcs.insert(crcPair);
 	// New commands override previously cached
-	for (ArtifactCrcTablePair& crcPair : manager.newCommandCrcs)
+	for (ArtifactCrcTablePair& crcPair : configuration.newCommandCrcs)
 		outputCrcs[crcPair.first] = crcPair.second;
 
 	std::vector<Token> outputTokens;
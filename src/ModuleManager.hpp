@@ -32,6 +32,9 @@ struct Module
 	std::vector<ModuleDependency> dependencies;
 	std::vector<std::string> cSearchDirectories;
 	std::vector<std::string> additionalBuildOptions;
+	// Types only visible in this module's source. Unity builds can't combine modules which define
+	// the same one
+	std::vector<std::string> localTypeNames;
 	// Do not build or link this module. Useful both for compile-time only files (which error
 	// because they are empty files) and for files only evaluated for their declarations (e.g. if
 	// the definitions are going to be provided via dynamic linking)
@@ -47,6 +50,30 @@ struct Module
 	std::vector<ModulePreBuildHook> preBuildHooks;
 };
 
+typedef std::unordered_map<std::string, Module*> ModulePathTable;
+typedef ModulePathTable::iterator ModulePathTableIterator;
+
+// A module read and tokenized ahead of evaluation. See moduleManagerPrescanImports()
+struct PrescannedModule
+{
+	// The tokens' sources point to filename, so the module takes ownership of both once it is
+	// evaluated. Until then, they belong to the prescan
+	const char* filename;
+	const std::vector<Token>* tokens;
+	bool failedToTokenize;
+	// Only output if the module is actually evaluated, which it might never be
+	std::string tokenizeErrors;
+	// The contents the tokens came from. If the file no longer matches when it is imported, it is
+	// read again
+	bool hasFileCrc;
+	uint32_t fileCrc;
+	// Absolute paths of the modules imported at the top level of this module
+	std::vector<std::string> imports;
+};
+typedef std::unordered_map<std::string, PrescannedModule> PrescannedModuleTable;
+typedef PrescannedModuleTable::iterator PrescannedModuleTableIterator;
+typedef std::pair<const std::string, PrescannedModule> PrescannedModuleTablePair;
+
 typedef std::unordered_map<std::string, uint32_t> ArtifactCrcTable;
 typedef std::pair<const std::string, uint32_t> ArtifactCrcTablePair;
 
@@ -57,26 +84,45 @@ struct ModuleManager
 	Token globalPseudoInvocationName;
 	// Pointer only so things cannot move around
 	std::vector<Module*> modules;
+	// Keyed by the real absolute path, so a module imported by different paths is only loaded once
+	ModulePathTable modulesByAbsolutePath;
+	// The import graph, keyed by absolute path
+	PrescannedModuleTable prescannedModules;
 
 	// Cached directory, not necessarily the final artifacts directory (e.g. executable-output
-	// option sets different location for the final executable)
+	// option sets different location for the final executable). Generated code is written here
 	std::string buildOutputDir;
 
-	// If an existing cached build was run, check the current build's commands against the previous
-	// commands via CRC comparison. This ensures changing commands will cause rebuilds
-	ArtifactCrcTable cachedCommandCrcs;
-	// If any artifact no longer matches its crc in cachedCommandCrcs, the change will appear here
-	ArtifactCrcTable newCommandCrcs;
+	// If set, each of these is built from the same generated code instead of only the evaluated
+	// configuration. Each is added as a label after the evaluated labels. See --configs
+	std::vector<std::string> buildConfigurations;
+
+	// Compile generated modules in batches, each through a single source file which includes them.
+	// See --unity-build
+	bool unityBuild;
 };
 
 void moduleManagerInitialize(ModuleManager& manager);
 void moduleManagerDestroy(ModuleManager& manager);
 
-bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut);
+// If useTokenCache is set, tokens are read from the cache if the file hasn't changed since they
+// were written, which skips tokenizing and validation. Errors are output, unless errorsOut is set,
+// in which case they are appended to it instead
+bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut,
+                                bool useTokenCache, std::string* errorsOut);
+// Read and tokenize the files and everything they import ahead of evaluation, in parallel. Imports
+// are found by looking for top-level import invocations, so anything imported another way (e.g. by
+// a macro, or after adding a search path) is still loaded when it is evaluated. The order modules
+// are evaluated in doesn't change
+void moduleManagerPrescanImports(ModuleManager& manager, const std::vector<const char*>& filenames);
 bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename, Module** moduleOut);
 bool moduleManagerEvaluateResolveReferences(ModuleManager& manager);
 bool moduleManagerWriteGeneratedOutput(ModuleManager& manager);
 bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtOutputs);
 
+// Estimate how much memory tokens, outputs, and definitions take up. Outputs if --verbose-memory is
+// set, along with the process's peak memory usage, and adds trace counters if tracing
+void moduleManagerReportMemoryUsage(ModuleManager& manager, const char* phaseName);
+
 // Initializes a normal environment and outputs all generators available to it
 void listBuiltInGenerators();
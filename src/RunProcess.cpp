@@ -5,15 +5,36 @@
 #include <vector>
 
 #ifdef UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>  // PATH_MAX
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <string.h>
-#include <sys/types.h>  // pid
-#include <sys/wait.h>   // waitpid
-#include <unistd.h>     // exec, fork
+#include <sys/resource.h>  // rusage
+#include <sys/types.h>     // pid
+#include <sys/wait.h>      // wait4
+#include <time.h>          // clock_gettime
+#include <unistd.h>        // pipe, chdir
+
+extern char** environ;
+
+// posix_spawn_file_actions_addchdir_np() is only available in newer C libraries
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define HAVE_SPAWN_ADDCHDIR
+#endif
+
+// pipe2() sets close-on-exec as the pipe is created, so no other thread's spawn can inherit it
+#if defined(__linux__)
+#define HAVE_PIPE2
+#endif
 #else
 #error Platform support is needed for running subprocesses
 #endif
 
 #include "Logging.hpp"
+#include "Tracing.hpp"
 #include "Utilities.hpp"
 
 #ifdef UNIX
@@ -25,23 +46,37 @@ typedef int ProcessId;
 struct Subprocess
 {
 	int* statusOut;
+	ProcessResult* resultOut;
 	ProcessId processId;
-	int pipeReadFileDescriptor;
+	// Separate so results can tell them apart. -1 once the process closes its end
+	int standardOutputFileDescriptor;
+	int standardErrorFileDescriptor;
+	// Non-blocking, and fed as the process reads it, alongside reading its output. Otherwise, a
+	// process which writes more output than fits in the pipe before it reads all of its input
+	// would wait on us while we wait on it. -1 once everything is written
+	int standardInputFileDescriptor;
+	std::string pendingInput;
+	// Output from both, in the order it arrived, which hasn't been passed on yet
+	std::string pendingOutput;
 	std::string command;
+	double startSeconds;
+	TraceTime startTime;
+	// Exited, but waitForAnyProcessClosed() hasn't reported it yet
+	bool hasClosed;
 };
 
 static std::vector<Subprocess> s_subprocesses;
 
-// Never returns, if success
-void systemExecute(const char* fileToExecute, char** arguments)
-{
+static bool pollSubprocesses(SubprocessOnOutputFunc onOutput, int extraFileDescriptor);
+
 #ifdef UNIX
-	// pid_t pid;
-	execvp(fileToExecute, arguments);
-	perror("RunProcess execvp() error: ");
-	Logf("Failed to execute %s\n", fileToExecute);
-#endif
+static double getMonotonicSeconds()
+{
+	timespec now = {};
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
 }
+#endif
 
 void subprocessReceiveStdOut(const char* processOutputBuffer)
 {
@@ -54,6 +89,348 @@ void subprocessReceiveStdOut(const char* processOutputBuffer)
 // 	Logf("%s", processOutputBuffer);
 // }
 
+//
+// Jobserver
+//
+
+// GNU make's jobserver lets make, cakelisp, and anything they run share one limit on how many jobs
+// run at once. Every process past the first needs a token, which is a byte read from the jobserver.
+// The first process uses the token every client is implicitly given
+struct Jobserver
+{
+	bool isEnabled;
+	// Whether we made the jobserver, rather than joining the one in MAKEFLAGS
+	bool isServer;
+	// Our own non-blocking open file description. Changing make's to be non-blocking
+	// would change it for every other client too
+	int readFileDescriptor;
+	int writeFileDescriptor;
+	// Tokens must be returned exactly as they were read
+	std::vector<char> heldTokens;
+};
+
+static Jobserver s_jobserver = {false, false, -1, -1, {}};
+
+#ifdef UNIX
+// Make uses the last of these in MAKEFLAGS. --jobserver-fds is from before make 4.2
+static bool getJobserverAuth(const char* makeFlags, std::string& authOut)
+{
+	const char* options[] = {"--jobserver-auth=", "--jobserver-fds="};
+	const char* lastValue = nullptr;
+	for (const char* option : options)
+	{
+		size_t optionLength = strlen(option);
+		for (const char* found = strstr(makeFlags, option); found;
+		     found = strstr(found + 1, option))
+		{
+			if (!lastValue || found + optionLength > lastValue)
+				lastValue = found + optionLength;
+		}
+	}
+	if (!lastValue)
+		return false;
+
+	const char* valueEnd = lastValue;
+	while (*valueEnd && *valueEnd != ' ')
+		++valueEnd;
+	authOut.assign(lastValue, valueEnd - lastValue);
+	return true;
+}
+
+// Opening the pipe again through /proc gives us our own open file description, which can be made
+// non-blocking. The pipe's own must stay blocking for the other clients. Without one of our own,
+// another client could take the token between poll() and read(), leaving us blocked in read()
+// while our own processes wait to be reaped, so the jobserver can't be used. Returns -1 then
+static int openJobserverRead(int fileDescriptor)
+{
+	char procPath[64] = {0};
+	PrintfBuffer(procPath, "/proc/self/fd/%d", fileDescriptor);
+	int reopenedFileDescriptor = open(procPath, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (reopenedFileDescriptor == -1 && logging.processes)
+		Log("Jobserver can't be read without blocking, so it won't be used\n");
+	return reopenedFileDescriptor;
+}
+
+static bool jobserverJoin(const std::string& auth)
+{
+	// Named pipe, from make 4.4
+	const char* fifoPrefix = "fifo:";
+	if (auth.compare(0, strlen(fifoPrefix), fifoPrefix) == 0)
+	{
+		const char* fifoPath = auth.c_str() + strlen(fifoPrefix);
+		int fileDescriptor = open(fifoPath, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fileDescriptor == -1)
+		{
+			perror("RunProcess jobserver: ");
+			return false;
+		}
+		s_jobserver.readFileDescriptor = fileDescriptor;
+		s_jobserver.writeFileDescriptor = fileDescriptor;
+		return true;
+	}
+
+	int readFileDescriptor = -1;
+	int writeFileDescriptor = -1;
+	if (sscanf(auth.c_str(), "%d,%d", &readFileDescriptor, &writeFileDescriptor) != 2 ||
+	    readFileDescriptor < 0 || writeFileDescriptor < 0)
+		return false;
+
+	// Make only leaves the pipe open for commands it knows run make, e.g. ones marked with +
+	if (fcntl(readFileDescriptor, F_GETFD) == -1 || fcntl(writeFileDescriptor, F_GETFD) == -1)
+	{
+		if (logging.processes)
+			Log("Jobserver in MAKEFLAGS isn't open to us. Run cakelisp from a recipe line "
+			    "starting with + to share make's jobs\n");
+		return false;
+	}
+
+	s_jobserver.readFileDescriptor = openJobserverRead(readFileDescriptor);
+	if (s_jobserver.readFileDescriptor == -1)
+		return false;
+	s_jobserver.writeFileDescriptor = writeFileDescriptor;
+	return true;
+}
+
+static bool jobserverCreate(int numJobs)
+{
+	// Unlike our other pipes, these must be inherited, so processes we run can join
+	int pipeFileDescriptors[2] = {-1, -1};
+	if (pipe(pipeFileDescriptors) == -1)
+	{
+		perror("RunProcess jobserver: ");
+		return false;
+	}
+
+	// One token is implicit
+	for (int i = 0; i < numJobs - 1; ++i)
+	{
+		if (write(pipeFileDescriptors[1], "+", 1) != 1)
+		{
+			perror("RunProcess jobserver: ");
+			close(pipeFileDescriptors[0]);
+			close(pipeFileDescriptors[1]);
+			return false;
+		}
+	}
+
+	s_jobserver.readFileDescriptor = openJobserverRead(pipeFileDescriptors[0]);
+	if (s_jobserver.readFileDescriptor == -1)
+	{
+		close(pipeFileDescriptors[0]);
+		close(pipeFileDescriptors[1]);
+		return false;
+	}
+	s_jobserver.writeFileDescriptor = pipeFileDescriptors[1];
+
+	std::string makeFlags;
+	const char* existingMakeFlags = getenv("MAKEFLAGS");
+	if (existingMakeFlags)
+		makeFlags = existingMakeFlags;
+	char jobserverFlags[128] = {0};
+	PrintfBuffer(jobserverFlags, " -j%d --jobserver-auth=%d,%d", numJobs, pipeFileDescriptors[0],
+	             pipeFileDescriptors[1]);
+	makeFlags.append(jobserverFlags);
+	setenv("MAKEFLAGS", makeFlags.c_str(), /*overwrite=*/1);
+	return true;
+}
+
+static void jobserverReturnToken()
+{
+	char token = s_jobserver.heldTokens.back();
+	s_jobserver.heldTokens.pop_back();
+	while (write(s_jobserver.writeFileDescriptor, &token, 1) == -1 && errno == EINTR)
+		continue;
+}
+
+static void jobserverReturnAllTokens()
+{
+	while (!s_jobserver.heldTokens.empty())
+		jobserverReturnToken();
+}
+#endif
+
+void jobserverInitialize(int numJobs)
+{
+#ifdef UNIX
+	if (s_jobserver.isEnabled)
+		return;
+
+	std::string auth;
+	const char* makeFlags = getenv("MAKEFLAGS");
+	if (makeFlags && getJobserverAuth(makeFlags, auth) && jobserverJoin(auth))
+		s_jobserver.isServer = false;
+	else if (jobserverCreate(numJobs))
+		s_jobserver.isServer = true;
+	else
+		return;
+
+	s_jobserver.isEnabled = true;
+	// Tokens we exit with would be lost to everyone else
+	atexit(jobserverReturnAllTokens);
+
+	if (logging.processes)
+		Logf("%s jobserver\n", s_jobserver.isServer ? "Started" : "Joined make's");
+#endif
+}
+
+static int countRunningSubprocesses()
+{
+	int numRunning = 0;
+	for (const Subprocess& process : s_subprocesses)
+	{
+		if (!process.hasClosed)
+			++numRunning;
+	}
+	return numRunning;
+}
+
+// Waits for a token if the process about to be run needs one. Our own processes are reaped while
+// waiting, and exiting frees their tokens for this process instead
+static void jobserverAcquireToken()
+{
+#ifdef UNIX
+	while (s_jobserver.isEnabled &&
+	       countRunningSubprocesses() > (int)s_jobserver.heldTokens.size())
+	{
+		// Wakes up for either a token or one of our processes exiting. Running processes always
+		// have output pipes open, so this can't wait forever
+		if (!pollSubprocesses(/*onOutput=*/nullptr, s_jobserver.readFileDescriptor))
+			break;
+
+		// Another client may have taken the token first, which won't block
+		char token = 0;
+		ssize_t numBytesRead = read(s_jobserver.readFileDescriptor, &token, 1);
+		if (numBytesRead == 1)
+		{
+			s_jobserver.heldTokens.push_back(token);
+			return;
+		}
+
+		if (numBytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			continue;
+
+		break;
+	}
+
+	if (s_jobserver.isEnabled &&
+	    countRunningSubprocesses() > (int)s_jobserver.heldTokens.size())
+	{
+		Log("warning: lost connection to jobserver. Processes will be run without it\n");
+		s_jobserver.isEnabled = false;
+	}
+#endif
+}
+
+// Processes which have exited no longer need their tokens
+static void jobserverReleaseUnneededTokens()
+{
+#ifdef UNIX
+	if (!s_jobserver.isEnabled)
+		return;
+
+	int numTokensNeeded = countRunningSubprocesses() - 1;
+	while ((int)s_jobserver.heldTokens.size() > numTokensNeeded &&
+	       !s_jobserver.heldTokens.empty())
+		jobserverReturnToken();
+#endif
+}
+
+#ifdef UNIX
+// Pipes are close-on-exec so that processes only inherit their own ends of their own pipes. Ends
+// a process should have are explicitly duplicated onto its standard streams, which clears the flag
+static bool createPipe(int pipeFileDescriptorsOut[2])
+{
+#ifdef HAVE_PIPE2
+	if (pipe2(pipeFileDescriptorsOut, O_CLOEXEC) == -1)
+	{
+		perror("RunProcess: ");
+		return false;
+	}
+#else
+	if (pipe(pipeFileDescriptorsOut) == -1)
+	{
+		perror("RunProcess: ");
+		return false;
+	}
+	for (int i = 0; i < 2; ++i)
+	{
+		int flags = fcntl(pipeFileDescriptorsOut[i], F_GETFD);
+		fcntl(pipeFileDescriptorsOut[i], F_SETFD, flags | FD_CLOEXEC);
+	}
+#endif
+	return true;
+}
+
+static void closePipe(int pipeFileDescriptors[2])
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		if (pipeFileDescriptors[i] != -1)
+			close(pipeFileDescriptors[i]);
+		pipeFileDescriptors[i] = -1;
+	}
+}
+
+// If the process exits without reading everything, writing fails with EPIPE, but also raises
+// SIGPIPE, which would kill us. It is blocked only for the write, and discarded if the write raised
+// it, so our signal handling is otherwise left alone
+static ssize_t writeWithoutSigpipe(int fileDescriptor, const char* data, size_t size)
+{
+	sigset_t sigpipeSet;
+	sigemptyset(&sigpipeSet);
+	sigaddset(&sigpipeSet, SIGPIPE);
+
+	sigset_t pendingSignals;
+	sigpending(&pendingSignals);
+	bool wasSigpipePending = sigismember(&pendingSignals, SIGPIPE);
+
+	sigset_t previousMask;
+	pthread_sigmask(SIG_BLOCK, &sigpipeSet, &previousMask);
+
+	ssize_t numBytesWritten = write(fileDescriptor, data, size);
+	int writeErrno = errno;
+
+	sigpending(&pendingSignals);
+	if (!wasSigpipePending && sigismember(&pendingSignals, SIGPIPE))
+	{
+		// Returns right away, because it is already pending
+		int signalNumber = 0;
+		sigwait(&sigpipeSet, &signalNumber);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+	errno = writeErrno;
+	return numBytesWritten;
+}
+
+// Writes as much of the process's pending input as its stdin takes without blocking. Once all of
+// it is written, stdin is closed so the process sees the end of it
+static void subprocessWriteStandardInput(Subprocess& process)
+{
+	while (!process.pendingInput.empty())
+	{
+		ssize_t numBytesWritten =
+		    writeWithoutSigpipe(process.standardInputFileDescriptor, process.pendingInput.data(),
+		                        process.pendingInput.size());
+		if (numBytesWritten == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			// The process will see truncated input and fail on its own
+			perror("RunProcess write to stdin: ");
+			break;
+		}
+		process.pendingInput.erase(0, numBytesWritten);
+	}
+
+	close(process.standardInputFileDescriptor);
+	process.standardInputFileDescriptor = -1;
+	process.pendingInput.clear();
+}
+#endif
+
 int runProcess(const RunProcessArguments& arguments, int* statusOut)
 {
 #ifdef UNIX
@@ -67,131 +444,367 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 		Log("\n");
 	}
 
-	int pipeFileDescriptors[2] = {0};
+	// Callers which don't check the return value will still see the process failed
+	*statusOut = 1;
+
 	const int PipeRead = 0;
 	const int PipeWrite = 1;
-	if (pipe(pipeFileDescriptors) == -1)
-	{
-		perror("RunProcess: ");
+	int outputPipeFileDescriptors[2] = {-1, -1};
+	int errorPipeFileDescriptors[2] = {-1, -1};
+	int inputPipeFileDescriptors[2] = {-1, -1};
+	if (!createPipe(outputPipeFileDescriptors))
 		return 1;
-	}
-
-	pid_t pid = fork();
-	if (pid == -1)
+	if (!createPipe(errorPipeFileDescriptors))
 	{
-		perror("RunProcess fork() error: cannot create child: ");
+		closePipe(outputPipeFileDescriptors);
 		return 1;
 	}
-	// Child
-	else if (pid == 0)
+	if (arguments.standardInput)
 	{
-		// Redirect std out and err to the pipes instead
-		if (dup2(pipeFileDescriptors[PipeWrite], STDOUT_FILENO) == -1 ||
-		    dup2(pipeFileDescriptors[PipeWrite], STDERR_FILENO) == -1)
+		if (!createPipe(inputPipeFileDescriptors))
 		{
-			perror("RunProcess: ");
+			closePipe(outputPipeFileDescriptors);
+			closePipe(errorPipeFileDescriptors);
 			return 1;
 		}
-		// Only write
-		close(pipeFileDescriptors[PipeRead]);
+	}
 
-		char** nonConstArguments = nullptr;
+	jobserverAcquireToken();
+
+	// posix_spawn() doesn't copy our address space like fork() does, which is expensive once
+	// we've loaded many compile-time libraries. Redirection and the working directory are set up
+	// by the file actions instead of by code running in the child
+	posix_spawn_file_actions_t fileActions;
+	posix_spawn_file_actions_init(&fileActions);
+	posix_spawn_file_actions_adddup2(&fileActions, outputPipeFileDescriptors[PipeWrite],
+	                                 STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&fileActions, errorPipeFileDescriptors[PipeWrite],
+	                                 STDERR_FILENO);
+	if (arguments.standardInput)
+		posix_spawn_file_actions_adddup2(&fileActions, inputPipeFileDescriptors[PipeRead],
+		                                 STDIN_FILENO);
+
+	// Whatever our own handling of SIGPIPE is, the process should get the default
+	posix_spawnattr_t spawnAttributes;
+	posix_spawnattr_init(&spawnAttributes);
+	sigset_t defaultSignals;
+	sigemptyset(&defaultSignals);
+	sigaddset(&defaultSignals, SIGPIPE);
+	posix_spawnattr_setsigdefault(&spawnAttributes, &defaultSignals);
+	posix_spawnattr_setflags(&spawnAttributes, POSIX_SPAWN_SETSIGDEF);
+
+	// Older C libraries can't change directory as a file action, so change ours while spawning
+	char previousWorkingDir[PATH_MAX] = {0};
+	if (arguments.workingDir)
+	{
+#ifdef HAVE_SPAWN_ADDCHDIR
+		posix_spawn_file_actions_addchdir_np(&fileActions, arguments.workingDir);
+#else
+		if (!getcwd(previousWorkingDir, sizeof(previousWorkingDir)) ||
+		    chdir(arguments.workingDir) != 0)
 		{
-			int numArgs = 0;
-			for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
-				++numArgs;
-
-			// Add one for null sentinel
-			nonConstArguments = new char*[numArgs + 1];
-			int i = 0;
-			for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
-			{
-				nonConstArguments[i] = strdup(*arg);
-				++i;
-			}
-
-			// Null sentinel
-			nonConstArguments[numArgs] = nullptr;
+			perror("RunProcess chdir: ");
+			posix_spawn_file_actions_destroy(&fileActions);
+			posix_spawnattr_destroy(&spawnAttributes);
+			closePipe(outputPipeFileDescriptors);
+			closePipe(errorPipeFileDescriptors);
+			closePipe(inputPipeFileDescriptors);
+			jobserverReleaseUnneededTokens();
+			return 1;
 		}
+#endif
 
-		if (arguments.workingDir)
-		{
-			if (chdir(arguments.workingDir) != 0)
-			{
-				perror("RunProcess chdir: ");
-				goto childProcessFailed;
-			}
+		if (logging.processes)
+			Logf("Set working directory to %s\n", arguments.workingDir);
+	}
 
-			if (logging.processes)
-				Logf("Set working directory to %s\n", arguments.workingDir);
-		}
+	// The arguments aren't modified, despite what the signature suggests
+	pid_t pid = 0;
+	int spawnError = posix_spawnp(&pid, arguments.fileToExecute, &fileActions, &spawnAttributes,
+	                              (char* const*)arguments.arguments, environ);
 
-		systemExecute(arguments.fileToExecute, nonConstArguments);
+	if (previousWorkingDir[0] && chdir(previousWorkingDir) != 0)
+		perror("RunProcess chdir: ");
+	posix_spawn_file_actions_destroy(&fileActions);
+	posix_spawnattr_destroy(&spawnAttributes);
 
-	childProcessFailed:
-		// This shouldn't happen unless the execution failed or soemthing
-		for (char** arg = nonConstArguments; *arg != nullptr; ++arg)
-			delete *arg;
-		delete[] nonConstArguments;
+	// Only the child uses these ends
+	close(outputPipeFileDescriptors[PipeWrite]);
+	close(errorPipeFileDescriptors[PipeWrite]);
+	if (arguments.standardInput)
+		close(inputPipeFileDescriptors[PipeRead]);
 
-		// A failed child should not flush parent files
-		_exit(EXIT_FAILURE); /*  */
-	}
-	// Parent
-	else
+	if (spawnError != 0)
 	{
-		// Only read
-		close(pipeFileDescriptors[PipeWrite]);
+		Logf("RunProcess error: failed to execute %s: %s\n", arguments.fileToExecute,
+		     strerror(spawnError));
+		close(outputPipeFileDescriptors[PipeRead]);
+		close(errorPipeFileDescriptors[PipeRead]);
+		if (arguments.standardInput)
+			close(inputPipeFileDescriptors[PipeWrite]);
+		jobserverReleaseUnneededTokens();
+		return 1;
+	}
 
-		if (logging.processes)
-			Logf("Created child process %d\n", pid);
+	if (logging.processes)
+		Logf("Created child process %d\n", pid);
 
-		std::string command = "";
+	// Kept to report failures and name trace spans, after the arguments are gone
+	std::string command;
+	{
+		size_t commandLength = 0;
+		for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
+			commandLength += strlen(*arg) + 1;
+		command.reserve(commandLength);
 		for (const char** arg = arguments.arguments; *arg != nullptr; ++arg)
 		{
 			command.append(*arg);
-			command.append(" ");
+			command.push_back(' ');
 		}
+	}
 
-		s_subprocesses.push_back({statusOut, pid, pipeFileDescriptors[PipeRead], command});
+	*statusOut = -1;
+	if (arguments.resultOut)
+		*arguments.resultOut = {};
+
+	Subprocess newProcess = {};
+	newProcess.statusOut = statusOut;
+	newProcess.resultOut = arguments.resultOut;
+	newProcess.processId = pid;
+	newProcess.standardOutputFileDescriptor = outputPipeFileDescriptors[PipeRead];
+	newProcess.standardErrorFileDescriptor = errorPipeFileDescriptors[PipeRead];
+	newProcess.standardInputFileDescriptor = inputPipeFileDescriptors[PipeWrite];
+	if (arguments.standardInput)
+	{
+		int flags = fcntl(inputPipeFileDescriptors[PipeWrite], F_GETFL);
+		fcntl(inputPipeFileDescriptors[PipeWrite], F_SETFL, flags | O_NONBLOCK);
+		newProcess.pendingInput = arguments.standardInput;
 	}
+	newProcess.command = std::move(command);
+	newProcess.startSeconds = getMonotonicSeconds();
+	newProcess.startTime = g_tracingEnabled ? tracingGetTime() : 0;
+	s_subprocesses.push_back(std::move(newProcess));
 
 	return 0;
 #endif
 	return 1;
 }
 
-void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput)
+static void subprocessOutput(Subprocess& process, size_t numBytes, SubprocessOnOutputFunc onOutput)
 {
-	if (s_subprocesses.empty())
+	if (!numBytes)
 		return;
 
-	for (Subprocess& process : s_subprocesses)
+	std::string output = process.pendingOutput.substr(0, numBytes);
+	process.pendingOutput.erase(0, numBytes);
+	subprocessReceiveStdOut(output.c_str());
+	onOutput(output.c_str());
+}
+
+// Only the oldest process's output is shown as it arrives, and only in whole lines. Other
+// processes' output is shown all at once when they close, which then can't land in the middle of a
+// line, or mix with another process's multi-line errors
+static void subprocessOutputCompleteLines(Subprocess& process, SubprocessOnOutputFunc onOutput)
+{
+	size_t lastNewline = process.pendingOutput.rfind('\n');
+	if (lastNewline != std::string::npos)
+		subprocessOutput(process, lastNewline + 1, onOutput);
+}
+
+#ifdef UNIX
+// Reaps the process, whose output has already been closed, and records its results
+static void subprocessClose(Subprocess& process)
+{
+	// It exited without reading all of its input
+	if (process.standardInputFileDescriptor != -1)
+	{
+		close(process.standardInputFileDescriptor);
+		process.standardInputFileDescriptor = -1;
+		process.pendingInput.clear();
+	}
+
+	rusage usage = {};
+	wait4(process.processId, process.statusOut, 0, &usage);
+	process.hasClosed = true;
+
+	double wallTime = getMonotonicSeconds() - process.startSeconds;
+	double userTime = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+	double systemTime = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+	// Bytes, unlike everywhere else
+	long peakResidentSetSizeKilobytes = usage.ru_maxrss / 1024;
+#else
+	long peakResidentSetSizeKilobytes = usage.ru_maxrss;
+#endif
+
+	if (process.resultOut)
+	{
+		process.resultOut->status = *process.statusOut;
+		process.resultOut->command = process.command;
+		process.resultOut->wallTime = wallTime;
+		process.resultOut->userTime = userTime;
+		process.resultOut->systemTime = systemTime;
+		process.resultOut->peakResidentSetSizeKilobytes = peakResidentSetSizeKilobytes;
+	}
+
+	char usageDescription[128] = {0};
+	PrintfBuffer(usageDescription, "wall %.2fs, user %.2fs, system %.2fs, peak memory %ld KB",
+	             wallTime, userTime, systemTime, peakResidentSetSizeKilobytes);
+
+	if (logging.processes)
+		Logf("Child process %d closed with status %d (%s)\n", process.processId,
+		     *process.statusOut, usageDescription);
+
+	if (g_tracingEnabled)
 	{
+		std::string processName = process.command.substr(0, process.command.find(' '));
+		std::string detail = process.command + "(" + usageDescription + ")";
+		tracingAddSpan("process", processName.c_str(), detail.c_str(), process.startTime,
+		               tracingGetTime(), process.processId);
+	}
+}
+#endif
+
+// Blocks until there is output, a process exits, or extraFileDescriptor (if not -1) is readable.
+// Pending input is written as processes are ready for it. Output is only passed on if onOutput is
+// set; otherwise, it waits to be passed on later. Returns false if polling failed
+static bool pollSubprocesses(SubprocessOnOutputFunc onOutput, int extraFileDescriptor)
+{
 #ifdef UNIX
-		char processOutputBuffer[1024] = {0};
-		int numBytesRead =
-		    read(process.pipeReadFileDescriptor, processOutputBuffer, sizeof(processOutputBuffer));
-		while (numBytesRead > 0)
+	enum SubprocessStream
+	{
+		SubprocessStream_Output,
+		SubprocessStream_Error,
+		SubprocessStream_Input
+	};
+	struct PolledStream
+	{
+		size_t subprocessIndex;
+		SubprocessStream stream;
+	};
+	std::vector<pollfd> pollFileDescriptors;
+	std::vector<PolledStream> polledStreams;
+	for (size_t i = 0; i < s_subprocesses.size(); ++i)
+	{
+		const Subprocess& process = s_subprocesses[i];
+		if (process.standardOutputFileDescriptor != -1)
+		{
+			pollFileDescriptors.push_back({process.standardOutputFileDescriptor, POLLIN, 0});
+			polledStreams.push_back({i, SubprocessStream_Output});
+		}
+		if (process.standardErrorFileDescriptor != -1)
+		{
+			pollFileDescriptors.push_back({process.standardErrorFileDescriptor, POLLIN, 0});
+			polledStreams.push_back({i, SubprocessStream_Error});
+		}
+		if (process.standardInputFileDescriptor != -1)
+		{
+			pollFileDescriptors.push_back({process.standardInputFileDescriptor, POLLOUT, 0});
+			polledStreams.push_back({i, SubprocessStream_Input});
+		}
+	}
+	if (extraFileDescriptor != -1)
+		pollFileDescriptors.push_back({extraFileDescriptor, POLLIN, 0});
+	if (pollFileDescriptors.empty())
+		return true;
+
+	if (poll(pollFileDescriptors.data(), pollFileDescriptors.size(), /*timeout=*/-1) == -1)
+	{
+		if (errno == EINTR)
+			return true;
+		perror("RunProcess poll: ");
+		return false;
+	}
+
+	for (size_t pollIndex = 0; pollIndex < polledStreams.size(); ++pollIndex)
+	{
+		if (!pollFileDescriptors[pollIndex].revents)
+			continue;
+
+		const PolledStream& polledStream = polledStreams[pollIndex];
+		Subprocess& process = s_subprocesses[polledStream.subprocessIndex];
+		if (polledStream.stream == SubprocessStream_Input)
 		{
-			processOutputBuffer[numBytesRead] = '\0';
-			subprocessReceiveStdOut(processOutputBuffer);
-			onOutput(processOutputBuffer);
-			numBytesRead = read(process.pipeReadFileDescriptor, processOutputBuffer,
-			                    sizeof(processOutputBuffer));
+			// Closing its output may have already closed this
+			if (process.standardInputFileDescriptor != -1)
+				subprocessWriteStandardInput(process);
+			continue;
 		}
 
-		close(process.pipeReadFileDescriptor);
+		bool isStandardError = polledStream.stream == SubprocessStream_Error;
+		int& fileDescriptor = isStandardError ? process.standardErrorFileDescriptor :
+		                                        process.standardOutputFileDescriptor;
 
-		waitpid(process.processId, process.statusOut, 0);
+		char processOutputBuffer[4096];
+		ssize_t numBytesRead = read(fileDescriptor, processOutputBuffer,
+		                            sizeof(processOutputBuffer));
+		if (numBytesRead == -1 && errno == EINTR)
+			continue;
 
-		// It's pretty useful to see the command which resulted in failure
-		if (*process.statusOut != 0)
-			Logf("%s\n", process.command.c_str());
+		if (numBytesRead > 0)
+		{
+			process.pendingOutput.append(processOutputBuffer, numBytesRead);
+			if (process.resultOut)
+			{
+				std::string& capturedOutput = isStandardError ?
+				                                  process.resultOut->standardError :
+				                                  process.resultOut->standardOutput;
+				capturedOutput.append(processOutputBuffer, numBytesRead);
+			}
+			if (onOutput && polledStream.subprocessIndex == 0)
+				subprocessOutputCompleteLines(process, onOutput);
+			continue;
+		}
+
+		close(fileDescriptor);
+		fileDescriptor = -1;
+
+		// Once both are closed, the process is exiting
+		if (process.standardOutputFileDescriptor == -1 &&
+		    process.standardErrorFileDescriptor == -1)
+			subprocessClose(process);
+	}
 #endif
+	return true;
+}
+
+int* waitForAnyProcessClosed(SubprocessOnOutputFunc onOutput)
+{
+	while (!s_subprocesses.empty())
+	{
+		for (size_t i = 0; i < s_subprocesses.size(); ++i)
+		{
+			Subprocess& process = s_subprocesses[i];
+			if (!process.hasClosed)
+				continue;
+
+			subprocessOutput(process, process.pendingOutput.size(), onOutput);
+
+			// It's pretty useful to see the command which resulted in failure
+			if (*process.statusOut != 0)
+				Logf("%s\n", process.command.c_str());
+
+			int* statusOut = process.statusOut;
+			s_subprocesses.erase(s_subprocesses.begin() + i);
+			jobserverReleaseUnneededTokens();
+			return statusOut;
+		}
+
+		// The oldest process may have output from before it became the oldest, or from while
+		// runProcess() was waiting for a jobserver token
+		subprocessOutputCompleteLines(s_subprocesses[0], onOutput);
+
+		if (!pollSubprocesses(onOutput, /*extraFileDescriptor=*/-1))
+			return nullptr;
 	}
 
-	s_subprocesses.clear();
+	return nullptr;
+}
+
+void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput)
+{
+	while (waitForAnyProcessClosed(onOutput))
+		continue;
 }
 
 void PrintProcessArguments(const char** processArguments)
@@ -5,18 +5,47 @@
 #include <string>
 #include <vector>
 
+// Everything known about a process once it has closed
+struct ProcessResult
+{
+	// Same as what is written to runProcess()'s statusOut
+	int status;
+	std::string command;
+	std::string standardOutput;
+	std::string standardError;
+
+	// In seconds. User and system time include the process's waited-for children
+	double wallTime;
+	double userTime;
+	double systemTime;
+	long peakResidentSetSizeKilobytes;
+};
+
 struct RunProcessArguments
 {
 	const char* fileToExecute;
 	// nullptr = no change (use parent process's working dir)
 	const char* workingDir;
 	const char** arguments;
+	// nullptr = inherit the parent process's stdin. Otherwise, this is copied, then written to the
+	// process's stdin as it reads it while waiting on processes, and then stdin is closed
+	const char* standardInput;
+	// Optional. Filled in once the process closes, so it must stay valid until then, like statusOut
+	ProcessResult* resultOut;
 };
 
+// Joins the GNU make jobserver in MAKEFLAGS if there is one, otherwise starts one with numJobs
+// tokens which the processes we run join through MAKEFLAGS. From then on, runProcess() waits for a
+// token before starting more than one process at a time
+void jobserverInitialize(int numJobs);
+
 int runProcess(const RunProcessArguments& arguments, int* statusOut);
 
 typedef void (*SubprocessOnOutputFunc)(const char* subprocessOutput);
 
+// Waits for any one process to close, while passing on output from all of them. Returns the
+// statusOut of the process which closed, or null if no processes are running
+int* waitForAnyProcessClosed(SubprocessOnOutputFunc onOutput);
 void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput);
 
 //
@@ -1,8 +1,10 @@
 #include "Tokenizer.hpp"
 
 #include <stdio.h>
+#include <string.h>
 #include <cctype>
 
+#include "FileUtilities.hpp"
 #include "Logging.hpp"
 #include "Utilities.hpp"
 
@@ -15,7 +17,7 @@ enum TokenizeState
 	TokenizeState_InString
 };
 
-int g_totalLinesTokenized = 0;
+std::atomic<int> g_totalLinesTokenized(0);
 
 // Returns nullptr if no errors, else the error text
 const char* tokenizeLine(const char* inputLine, const char* source, unsigned int lineNumber,
@@ -184,7 +186,7 @@ const char* tokenTypeToString(TokenType type)
 	}
 }
 
-bool validateParentheses(const std::vector<Token>& tokens)
+const Token* findMismatchedParenthesis(const std::vector<Token>& tokens, const char** errorOut)
 {
 	int nestingDepth = 0;
 	const Token* lastTopLevelOpenParen = nullptr;
@@ -202,19 +204,31 @@ bool validateParentheses(const std::vector<Token>& tokens)
 			--nestingDepth;
 			if (nestingDepth < 0)
 			{
-				ErrorAtToken(token,
-				             "Mismatched parenthesis. Too many closing parentheses, or missing "
-				             "opening parenthesies");
-				return false;
+				*errorOut =
+				    "Mismatched parenthesis. Too many closing parentheses, or missing opening "
+				    "parenthesies";
+				return &token;
 			}
 		}
 	}
 
 	if (nestingDepth != 0)
 	{
-		ErrorAtToken(
-		    *lastTopLevelOpenParen,
-		    "Mismatched parenthesis. Missing closing parentheses, or too many opening parentheses");
+		*errorOut =
+		    "Mismatched parenthesis. Missing closing parentheses, or too many opening parentheses";
+		return lastTopLevelOpenParen;
+	}
+
+	return nullptr;
+}
+
+bool validateParentheses(const std::vector<Token>& tokens)
+{
+	const char* error = nullptr;
+	const Token* mismatchedToken = findMismatchedParenthesis(tokens, &error);
+	if (mismatchedToken)
+	{
+		ErrorAtToken(*mismatchedToken, error);
 		return false;
 	}
 
@@ -339,6 +353,77 @@ void prettyPrintTokensToFile(FILE* file, const std::vector<Token>& tokens)
 	printTokensInternal(file, tokens, /*prettyPrint=*/true);
 }
 
+void writeTokensBinary(FILE* file, const std::vector<Token>& tokens,
+                       std::vector<const char*>& sources)
+{
+	fileWriteUint32(file, (uint32_t)tokens.size());
+	for (const Token& token : tokens)
+	{
+		fileWriteUint32(file, (uint32_t)token.type);
+		fileWriteString(file, token.contents);
+
+		uint32_t sourceIndex = 0;
+		while (sourceIndex < sources.size() && sources[sourceIndex] != token.source)
+			++sourceIndex;
+		fileWriteUint32(file, sourceIndex);
+		// The first time a source is used, the reader learns it from here
+		if (sourceIndex == sources.size())
+		{
+			fileWriteString(file, token.source ? token.source : "");
+			sources.push_back(token.source);
+		}
+
+		fileWriteUint32(file, token.lineNumber);
+		fileWriteUint32(file, (uint32_t)token.columnStart);
+		fileWriteUint32(file, (uint32_t)token.columnEnd);
+	}
+}
+
+bool readTokensBinary(const char** at, const char* end, std::vector<Token>& tokensOut,
+                      std::vector<const char*>& sources)
+{
+	// Type, contents length, source, line, and columns
+	const size_t minBytesPerToken = 6 * sizeof(uint32_t);
+	uint32_t numTokens = 0;
+	if (!bufferReadUint32(at, end, &numTokens) ||
+	    numTokens > (size_t)(end - *at) / minBytesPerToken)
+		return false;
+
+	tokensOut.reserve(tokensOut.size() + numTokens);
+	for (uint32_t i = 0; i < numTokens; ++i)
+	{
+		tokensOut.emplace_back();
+		Token& token = tokensOut.back();
+		uint32_t type = 0;
+		if (!bufferReadUint32(at, end, &type) || type > TokenType_String)
+			return false;
+		token.type = (TokenType)type;
+		if (!bufferReadString(at, end, token.contents))
+			return false;
+
+		uint32_t sourceIndex = 0;
+		if (!bufferReadUint32(at, end, &sourceIndex) || sourceIndex > sources.size())
+			return false;
+		if (sourceIndex == sources.size())
+		{
+			std::string source;
+			if (!bufferReadString(at, end, source))
+				return false;
+			sources.push_back(strdup(source.c_str()));
+		}
+		token.source = sources[sourceIndex];
+
+		uint32_t columnStart = 0;
+		uint32_t columnEnd = 0;
+		if (!bufferReadUint32(at, end, &token.lineNumber) ||
+		    !bufferReadUint32(at, end, &columnStart) || !bufferReadUint32(at, end, &columnEnd))
+			return false;
+		token.columnStart = (int)columnStart;
+		token.columnEnd = (int)columnEnd;
+	}
+	return true;
+}
+
 bool writeCharToBufferErrorToken(char c, char** at, char* bufferStart, int bufferSize,
                                  const Token& token)
 {
@@ -1,7 +1,8 @@
 #pragma once
 
-#include <vector>
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "TokenEnums.hpp"
 
@@ -35,15 +36,30 @@ bool tokenizeLinePrintError(const char* inputLine, const char* source, unsigned
                             std::vector<Token>& tokensOut);
 
 bool validateParentheses(const std::vector<Token>& tokens);
+// Same as validateParentheses(), but describes the error instead of outputting it. Returns the
+// offending token, or null if the parentheses match
+const Token* findMismatchedParenthesis(const std::vector<Token>& tokens, const char** errorOut);
 
 void printTokens(const std::vector<Token>& tokens);
 void prettyPrintTokens(const std::vector<Token>& tokens);
 void prettyPrintTokensToFile(FILE* file, const std::vector<Token>& tokens);
 
+// Tokens can be cached in a compact binary form, which is much faster to read than tokenizing or
+// generating them again. Each source is written once, then referred to by its index in sources.
+// Use the same sources list for every list of tokens in a file. Both sides may start with sources
+// they already agree on. Sources the reader hasn't seen are allocated with strdup(); free() them
+// when done
+void writeTokensBinary(FILE* file, const std::vector<Token>& tokens,
+                       std::vector<const char*>& sources);
+// Reads from at up to end, e.g. a mapped file. See bufferReadUint32()
+bool readTokensBinary(const char** at, const char* end, std::vector<Token>& tokensOut,
+                      std::vector<const char*>& sources);
+
 bool writeCharToBufferErrorToken(char c, char** at, char* bufferStart, int bufferSize,
                                  const Token& token);
 bool writeStringToBufferErrorToken(const char* str, char** at, char* bufferStart, int bufferSize,
                                    const Token& token);
 bool appendTokenToString(const Token& token, char** at, char* bufferStart, int bufferSize);
 
-extern int g_totalLinesTokenized;
+// Files may be tokenized in parallel
+extern std::atomic<int> g_totalLinesTokenized;
@@ -0,0 +1,172 @@
+#include "Tracing.hpp"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "Utilities.hpp"
+
+#ifdef UNIX
+#include <unistd.h>  // getpid
+#endif
+
+struct TraceEvent
+{
+	// 'X' for spans, 'C' for counters
+	char phase;
+	const char* category;
+	std::string name;
+	std::string detail;
+	TraceTime start;
+	TraceTime duration;
+	int threadId;
+	unsigned long long counterValue;
+};
+
+bool g_tracingEnabled = false;
+
+static std::string s_traceOutputFilename;
+static std::chrono::steady_clock::time_point s_traceStartTime;
+static std::vector<TraceEvent> s_traceEvents;
+// Modules are written from multiple threads
+static std::mutex s_traceEventsMutex;
+
+void tracingBegin(const char* outputFilename)
+{
+	s_traceOutputFilename = outputFilename;
+	s_traceStartTime = std::chrono::steady_clock::now();
+	g_tracingEnabled = true;
+}
+
+TraceTime tracingGetTime()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+	           std::chrono::steady_clock::now() - s_traceStartTime)
+	    .count();
+}
+
+int tracingGetThreadId()
+{
+	// Numbered in the order threads first record something. The main thread is almost always 0
+	static std::atomic<int> s_nextThreadId(0);
+	static thread_local int s_threadId = s_nextThreadId++;
+	return s_threadId;
+}
+
+void tracingAddSpan(const char* category, const char* name, const char* detail, TraceTime start,
+                    TraceTime end, int threadId)
+{
+	if (!g_tracingEnabled)
+		return;
+
+	TraceEvent event = {'X', category, name, detail ? detail : "", start, end - start, threadId, 0};
+
+	std::lock_guard<std::mutex> lock(s_traceEventsMutex);
+	s_traceEvents.push_back(std::move(event));
+}
+
+void tracingAddCounter(const char* name, unsigned long long value)
+{
+	if (!g_tracingEnabled)
+		return;
+
+	TraceEvent event = {'C', "counter", name, "", tracingGetTime(), 0, tracingGetThreadId(), value};
+
+	std::lock_guard<std::mutex> lock(s_traceEventsMutex);
+	s_traceEvents.push_back(std::move(event));
+}
+
+TraceScope::TraceScope(const char* category, const char* name, const char* detail)
+    : enabled(g_tracingEnabled), category(category), start(0)
+{
+	if (!enabled)
+		return;
+
+	this->name = name;
+	if (detail)
+		this->detail = detail;
+	start = tracingGetTime();
+}
+
+TraceScope::~TraceScope()
+{
+	if (!enabled)
+		return;
+
+	tracingAddSpan(category, name.c_str(), detail.c_str(), start, tracingGetTime(),
+	               tracingGetThreadId());
+}
+
+static void writeJsonString(FILE* file, const char* str)
+{
+	fputc('"', file);
+	for (const char* c = str; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+		{
+			fputc('\\', file);
+			fputc(*c, file);
+		}
+		else if (*c == '\n')
+			fputs("\\n", file);
+		else if (*c == '\t')
+			fputs("\\t", file);
+		// Other control characters aren't allowed in JSON strings
+		else if ((unsigned char)*c >= ' ')
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+bool tracingWriteOutput()
+{
+	if (!g_tracingEnabled)
+		return true;
+
+	FILE* traceFile = fileOpen(s_traceOutputFilename.c_str(), "w");
+	if (!traceFile)
+		return false;
+
+	int processId = 0;
+#ifdef UNIX
+	processId = getpid();
+#endif
+
+	std::lock_guard<std::mutex> lock(s_traceEventsMutex);
+	fprintf(traceFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (size_t i = 0; i < s_traceEvents.size(); ++i)
+	{
+		const TraceEvent& event = s_traceEvents[i];
+		if (event.phase == 'C')
+		{
+			fprintf(traceFile, "{\"ph\":\"C\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"name\":",
+			        processId, event.threadId, event.start);
+			writeJsonString(traceFile, event.name.c_str());
+			fprintf(traceFile, ",\"args\":{\"value\":%llu}}%s\n", event.counterValue,
+			        i + 1 < s_traceEvents.size() ? "," : "");
+			continue;
+		}
+
+		fprintf(traceFile, "{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"cat\":",
+		        processId, event.threadId, event.start, event.duration);
+		writeJsonString(traceFile, event.category);
+		fprintf(traceFile, ",\"name\":");
+		writeJsonString(traceFile, event.name.c_str());
+		if (!event.detail.empty())
+		{
+			fprintf(traceFile, ",\"args\":{\"detail\":");
+			writeJsonString(traceFile, event.detail.c_str());
+			fprintf(traceFile, "}");
+		}
+		fprintf(traceFile, "}%s\n", i + 1 < s_traceEvents.size() ? "," : "");
+	}
+	fprintf(traceFile, "]}\n");
+	fclose(traceFile);
+
+	Logf("Wrote trace of %d events to %s\n", (int)s_traceEvents.size(),
+	     s_traceOutputFilename.c_str());
+	return true;
+}
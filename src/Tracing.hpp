@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+// Records timed spans of what Cakelisp is doing, then writes them in Chrome's trace event format.
+// Open the output in chrome://tracing or https://ui.perfetto.dev to see where time goes
+
+typedef unsigned long long TraceTime;
+
+// Checked by everything which records spans, so tracing costs nothing when it is off
+extern bool g_tracingEnabled;
+
+void tracingBegin(const char* outputFilename);
+// Writes everything recorded so far. Safe to call when tracing is not enabled
+bool tracingWriteOutput();
+
+// Microseconds since tracingBegin()
+TraceTime tracingGetTime();
+
+// Spans on the same threadId are shown on the same row. Pass tracingGetThreadId() for spans on the
+// calling thread; subprocesses use their process ID so each gets its own row. detail may be null
+void tracingAddSpan(const char* category, const char* name, const char* detail, TraceTime start,
+                    TraceTime end, int threadId);
+int tracingGetThreadId();
+
+// Counters are drawn as a graph of value over time, one graph per name
+void tracingAddCounter(const char* name, unsigned long long value);
+
+// Records a span from construction until the end of the enclosing scope
+struct TraceScope
+{
+	TraceScope(const char* category, const char* name, const char* detail = nullptr);
+	~TraceScope();
+
+	bool enabled;
+	const char* category;
+	std::string name;
+	std::string detail;
+	TraceTime start;
+};
@@ -70,12 +70,24 @@ uint32_t crc32_for_byte(uint32_t r)
 	return r ^ (uint32_t)0xFF000000L;
 }
 
+struct Crc32Table
+{
+	uint32_t values[0x100];
+};
+
+static Crc32Table makeCrc32Table()
+{
+	Crc32Table table;
+	for (size_t i = 0; i < 0x100; ++i)
+		table.values[i] = crc32_for_byte(i);
+	return table;
+}
+
 void crc32(const void* data, size_t n_bytes, uint32_t* crc)
 {
-	static uint32_t table[0x100];
-	if (!*table)
-		for (size_t i = 0; i < 0x100; ++i)
-			table[i] = crc32_for_byte(i);
+	// Files are hashed from multiple threads. Static initialization is thread safe
+	static const Crc32Table crcTable = makeCrc32Table();
+	const uint32_t* table = crcTable.values;
 	for (size_t i = 0; i < n_bytes; ++i)
 		*crc = table[(uint8_t)*crc ^ ((uint8_t*)data)[i]] ^ *crc >> 8;
 }
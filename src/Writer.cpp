@@ -8,77 +8,82 @@
 #include "Utilities.hpp"
 
 // TODO: safe version of strcat
+#include <atomic>
 #include <stdarg.h>  // va_start
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-bool writeIfContentsNewer(const char* tempFilename, const char* outputFilename)
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+bool writeIfContentsNewer(const std::string& contents, const char* outputFilename)
 {
-	// Read temporary file and destination file and compare
-	FILE* newFile = fopen(tempFilename, "r");
-	if (!newFile)
-	{
-		Logf("error: Could not open %s\n", tempFilename);
-		return false;
-	}
-	FILE* oldFile = fopen(outputFilename, "r");
+	FILE* oldFile = fopen(outputFilename, "rb");
 	if (!oldFile)
 	{
-		// Write new and remove temp
 		if (logging.fileSystem)
 			Log("Destination file didn't exist. Writing\n");
-
-		return moveFile(tempFilename, outputFilename);
 	}
 	else
 	{
 		if (logging.fileSystem)
 			Log("Destination file exists. Comparing\n");
 
-		char newBuffer[1024] = {0};
-		char oldBuffer[1024] = {0};
-		bool identical = true;
-		while (1)
+		bool identical = false;
+		// Early-out on size mismatch, which catches most changes without reading the file
+		if (fseek(oldFile, 0, SEEK_END) == 0 && ftell(oldFile) == (long)contents.size())
 		{
-			bool newBufferRead = fgets(newBuffer, sizeof(newBuffer), newFile) != nullptr;
-			bool oldBufferRead = fgets(oldBuffer, sizeof(oldBuffer), oldFile) != nullptr;
-			if (!newBufferRead || !oldBufferRead)
+			rewind(oldFile);
+			identical = true;
+
+			char oldBuffer[4096];
+			size_t numCompared = 0;
+			size_t numRead = 0;
+			while ((numRead = fread(oldBuffer, sizeof(oldBuffer[0]), ArraySize(oldBuffer),
+			                        oldFile)) > 0)
 			{
-				if (newBufferRead != oldBufferRead)
+				if (numCompared + numRead > contents.size() ||
+				    memcmp(oldBuffer, contents.data() + numCompared, numRead) != 0)
+				{
 					identical = false;
-				break;
+					break;
+				}
+				numCompared += numRead;
 			}
 
-			if (memcmp(newBuffer, oldBuffer, sizeof(newBuffer)) != 0)
-			{
+			if (numCompared != contents.size())
 				identical = false;
-				break;
-			}
 		}
 
+		fclose(oldFile);
+
 		if (identical)
 		{
 			if (logging.fileSystem)
 				Log("Files are identical. Skipping\n");
-
-			fclose(newFile);
-			fclose(oldFile);
-			if (remove(tempFilename) != 0)
-			{
-				Logf("Failed to remove %s\n", tempFilename);
-				return false;
-			}
 			return true;
 		}
 
 		if (logging.fileSystem)
 			Log("File changed. writing\n");
+	}
 
-		fclose(newFile);
-		fclose(oldFile);
+	FILE* newFile = fileOpen(outputFilename, "wb");
+	if (!newFile)
+		return false;
 
-		return moveFile(tempFilename, outputFilename);
+	size_t numWritten = fwrite(contents.data(), sizeof(contents[0]), contents.size(), newFile);
+	fclose(newFile);
+	if (numWritten != contents.size())
+	{
+		Logf("error: failed to write %s\n", outputFilename);
+		return false;
 	}
+
+	return true;
 }
 
 const char* importLanguageToString(ImportLanguage type)
@@ -106,10 +111,10 @@ static NameStyleMode getNameStyleModeForFlags(const NameStyleSettings& settings,
 		++numMatchingFlags;
 		mode = settings.typeNameMode;
 
-		static bool hasWarned = false;
-		if (!hasWarned && mode == NameStyleMode_PascalCase)
+		// Modules may be written from several threads at once
+		static std::atomic<bool> hasWarned(false);
+		if (mode == NameStyleMode_PascalCase && !hasWarned.exchange(true))
 		{
-			hasWarned = true;
 			Log("\nWarning: Use of PascalCase for type names is discouraged because it will "
 			    "destroy lowercase C type names. You should use PascalCaseIfPlural instead, which "
 			    "will only apply case changes if the name looks lisp-y. This warning will only "
@@ -133,6 +138,12 @@ static NameStyleMode getNameStyleModeForFlags(const NameStyleSettings& settings,
 	return mode;
 }
 
+struct WriterMapMark
+{
+	size_t bufferOffset;
+	const Token* token;
+};
+
 struct StringOutputState
 {
 	int blockDepth;
@@ -140,22 +151,49 @@ struct StringOutputState
 	int numCharsOutput;
 	int currentLine;
 	int lastLineIndented;
-	FILE* fileOut;
+	// The whole file is rendered into memory, then compared against the existing file once done
+	std::string* bufferOut;
+	// Where in bufferOut each token's output starts, for building the source map
+	std::vector<WriterMapMark>* mapMarksOut;
 };
 
+static void recordMapMark(StringOutputState& state, const Token* token)
+{
+	if (!token || !state.mapMarksOut)
+		return;
+
+	std::vector<WriterMapMark>& marks = *state.mapMarksOut;
+	// Consecutive output from the same token only needs the first mark
+	if (!marks.empty() && marks.back().token == token)
+		return;
+
+	marks.push_back({state.bufferOut->size(), token});
+}
+
 // TODO Have writer scan strings for \n?
 static void Writer_Writef(StringOutputState& state, const char* format, ...)
 {
 	va_list args;
 	va_start(args, format);
-	if (state.fileOut)
+	va_list argsRetry;
+	va_copy(argsRetry, args);
+
+	// Most writes are short, so try to print straight into the end of the buffer. If it doesn't
+	// fit, grow the buffer to the exact size and print again
+	std::string& buffer = *state.bufferOut;
+	size_t startSize = buffer.size();
+	const size_t guessSize = 128;
+	buffer.resize(startSize + guessSize);
+	int numPrinted = vsnprintf(&buffer[startSize], guessSize, format, args);
+	if (numPrinted >= (int)guessSize)
 	{
-		state.numCharsOutput += vfprintf(state.fileOut, format, args);
-	}
-	else
-	{
-		state.numCharsOutput += vprintf(format, args);
+		buffer.resize(startSize + numPrinted + 1);
+		vsnprintf(&buffer[startSize], numPrinted + 1, format, argsRetry);
 	}
+	buffer.resize(startSize + (numPrinted > 0 ? numPrinted : 0));
+	state.numCharsOutput += numPrinted > 0 ? numPrinted : 0;
+
+	va_end(argsRetry);
 	va_end(args);
 }
 
@@ -214,13 +252,16 @@ static void writeStringOutput(const NameStyleSettings& nameSettings,
 	if (outputOperation.modifiers & StringOutMod_SpaceBefore)
 		Writer_Writef(state, " ");
 
+	recordMapMark(state, outputOperation.startToken);
+
 	// TODO Validate flags for e.g. OpenParen | CloseParen, which shouldn't be allowed
 	NameStyleMode mode = getNameStyleModeForFlags(nameSettings, outputOperation.modifiers);
 	if (mode)
 	{
-		char convertedName[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(mode, outputOperation.output.c_str(), convertedName,
-		                          sizeof(convertedName), *outputOperation.startToken);
+		char convertedNameBuffer[MAX_NAME_LENGTH] = {0};
+		const char* convertedName = lispNameStyleToCNameStyleCached(
+		    mode, outputOperation.output, convertedNameBuffer, sizeof(convertedNameBuffer),
+		    *outputOperation.startToken);
 		Writer_Writef(state, "%s", convertedName);
 	}
 	else if (outputOperation.modifiers & StringOutMod_SurroundWithQuotes)
@@ -336,6 +377,312 @@ void writeOutputFollowSplices_Recursive(const NameStyleSettings& nameSettings,
 	}
 }
 
+//
+// Source maps
+//
+
+struct SourceMapEntry
+{
+	int generatedLine;
+	int generatedColumn;
+	int sourceIndex;
+	int sourceLine;
+	int sourceColumn;
+};
+
+struct SourceMap
+{
+	std::vector<std::string> sources;
+	// Sorted by generated position
+	std::vector<SourceMapEntry> entries;
+};
+
+// Only the directory is resolved, because piped outputs never exist on disk
+static std::string getSourceMapKey(const char* generatedFilename)
+{
+	char directory[MAX_PATH_LENGTH] = {0};
+	getDirectoryFromPath(generatedFilename, directory, sizeof(directory));
+	char filename[MAX_PATH_LENGTH] = {0};
+	getFilenameFromPath(generatedFilename, filename, sizeof(filename));
+
+	const char* absoluteDirectory = makeAbsolutePath_Allocated(nullptr, directory);
+	if (!absoluteDirectory)
+		return EmptyString;
+	std::string key = absoluteDirectory;
+	free((void*)absoluteDirectory);
+	key.push_back('/');
+	key.append(filename);
+	return key;
+}
+
+static void appendJsonString(std::string& jsonOut, const char* str)
+{
+	jsonOut.push_back('"');
+	for (const char* c = str; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+			jsonOut.push_back('\\');
+		jsonOut.push_back(*c);
+	}
+	jsonOut.push_back('"');
+}
+
+// Only reads strings written by appendJsonString()
+static bool readJsonString(const char** at, const char* end, std::string& stringOut)
+{
+	if (*at >= end || **at != '"')
+		return false;
+	stringOut.clear();
+	for (++(*at); *at < end; ++(*at))
+	{
+		if (**at == '"')
+		{
+			++(*at);
+			return true;
+		}
+		if (**at == '\\' && ++(*at) >= end)
+			return false;
+		stringOut.push_back(**at);
+	}
+	return false;
+}
+
+// Converts buffer offsets into generated lines and columns, then writes the map next to the output
+// as outputFilename.map, e.g.
+//  {"file":"Hello.cake.cpp","sources":["test/Hello.cake"],"mappings":[1,1,0,1,1, ...]}
+// Each five numbers in mappings are generated line, generated column, index into sources, Cakelisp
+// line, and Cakelisp column. Lines and columns start at 1. The map is written even if the output
+// itself was piped, because the compiler still reports errors using outputFilename
+static bool writeSourceMap(const std::string& buffer, const std::vector<WriterMapMark>& marks,
+                           const char* outputFilename)
+{
+	std::vector<const char*> sources;
+	std::string mappings;
+	int currentLine = 1;
+	size_t lineStartOffset = 0;
+	size_t scanOffset = 0;
+	for (const WriterMapMark& mark : marks)
+	{
+		for (; scanOffset < mark.bufferOffset && scanOffset < buffer.size(); ++scanOffset)
+		{
+			if (buffer[scanOffset] == '\n')
+			{
+				++currentLine;
+				lineStartOffset = scanOffset + 1;
+			}
+		}
+
+		int sourceIndex = -1;
+		for (int i = 0; i < (int)sources.size(); ++i)
+		{
+			if (strcmp(sources[i], mark.token->source) == 0)
+			{
+				sourceIndex = i;
+				break;
+			}
+		}
+		if (sourceIndex == -1)
+		{
+			sourceIndex = sources.size();
+			sources.push_back(mark.token->source);
+		}
+
+		char entryBuffer[64] = {0};
+		PrintfBuffer(entryBuffer, "%s%d,%d,%d,%d,%d", mappings.empty() ? "" : ",", currentLine,
+		             (int)(mark.bufferOffset - lineStartOffset) + 1, sourceIndex,
+		             (int)mark.token->lineNumber, 1 + mark.token->columnStart);
+		mappings.append(entryBuffer);
+	}
+
+	std::string json = "{\"file\":";
+	{
+		char filename[MAX_PATH_LENGTH] = {0};
+		getFilenameFromPath(outputFilename, filename, sizeof(filename));
+		appendJsonString(json, filename);
+	}
+	json.append(",\"sources\":[");
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		if (i)
+			json.push_back(',');
+		appendJsonString(json, sources[i]);
+	}
+	json.append("],\"mappings\":[");
+	json.append(mappings);
+	json.append("]}\n");
+
+	char mapFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(mapFilename, "%s.map", outputFilename);
+	return writeIfContentsNewer(json, mapFilename);
+}
+
+// Only reads maps written by writeSourceMap()
+static bool readSourceMap(const char* at, const char* end, SourceMap& sourceMapOut)
+{
+	const char* sourcesKey = "\"sources\":[";
+	const char* sourcesStart = std::search(at, end, sourcesKey, sourcesKey + strlen(sourcesKey));
+	if (sourcesStart == end)
+		return false;
+	at = sourcesStart + strlen(sourcesKey);
+	while (at < end && *at != ']')
+	{
+		std::string source;
+		if (!readJsonString(&at, end, source))
+			return false;
+		sourceMapOut.sources.push_back(source);
+		if (at < end && *at == ',')
+			++at;
+	}
+
+	const char* mappingsKey = "\"mappings\":[";
+	const char* mappingsStart = std::search(at, end, mappingsKey, mappingsKey + strlen(mappingsKey));
+	if (mappingsStart == end)
+		return false;
+	at = mappingsStart + strlen(mappingsKey);
+	// Numbers are parsed in place, so make sure the mappings end before the buffer does
+	const char* mappingsEnd = std::find(at, end, ']');
+	if (mappingsEnd == end)
+		return false;
+	while (at < mappingsEnd)
+	{
+		int values[5];
+		for (int i = 0; i < 5; ++i)
+		{
+			char* numberEnd = nullptr;
+			values[i] = (int)strtol(at, &numberEnd, 10);
+			if (numberEnd == at || numberEnd > mappingsEnd)
+				return false;
+			at = numberEnd;
+			if (at < mappingsEnd && *at == ',')
+				++at;
+		}
+		if (values[2] < 0 || values[2] >= (int)sourceMapOut.sources.size())
+			return false;
+		sourceMapOut.entries.push_back({values[0], values[1], values[2], values[3], values[4]});
+	}
+	return true;
+}
+
+// Maps are only needed when the compiler reports something, so they're read from disk on demand.
+// Diagnostics usually come in runs from the same file, so the last map read is kept
+static const SourceMap* loadSourceMap(const char* generatedFilename)
+{
+	static std::string s_loadedMapKey;
+	static unsigned long s_loadedMapModificationTime = 0;
+	static SourceMap s_loadedMap;
+
+	std::string sourceMapKey = getSourceMapKey(generatedFilename);
+	if (sourceMapKey.empty())
+		return nullptr;
+	std::string mapFilename = sourceMapKey + ".map";
+	unsigned long modificationTime = fileGetLastModificationTime(mapFilename.c_str());
+	if (!modificationTime)
+		return nullptr;
+	if (sourceMapKey == s_loadedMapKey && modificationTime == s_loadedMapModificationTime)
+		return &s_loadedMap;
+
+	s_loadedMapKey.clear();
+	s_loadedMap = {};
+	MappedFile mapFile;
+	if (!fileMap(mapFilename.c_str(), mapFile))
+		return nullptr;
+	bool isValid = readSourceMap(mapFile.data, mapFile.data + mapFile.size, s_loadedMap);
+	fileUnmap(mapFile);
+	if (!isValid)
+	{
+		if (logging.fileSystem)
+			Logf("Ignoring invalid source map %s\n", mapFilename.c_str());
+		return nullptr;
+	}
+
+	s_loadedMapKey = sourceMapKey;
+	s_loadedMapModificationTime = modificationTime;
+	return &s_loadedMap;
+}
+
+// If line is a diagnostic like "file:line:column: message" pointing into a file we generated,
+// add a note with the Cakelisp location which generated that code
+static void noteCakelispLocationForDiagnostic(const std::string& line, std::string& notesOut)
+{
+	// Find the first ":<digits>:", which separates the path from the line number
+	size_t pathEnd = 0;
+	int generatedLine = 0;
+	int generatedColumn = 0;
+	for (size_t colon = line.find(':'); colon != std::string::npos;
+	     colon = line.find(':', colon + 1))
+	{
+		char* numberEnd = nullptr;
+		long number = strtol(line.c_str() + colon + 1, &numberEnd, 10);
+		if (numberEnd == line.c_str() + colon + 1 || *numberEnd != ':')
+			continue;
+
+		pathEnd = colon;
+		generatedLine = (int)number;
+		// Column is optional
+		const char* columnStart = numberEnd + 1;
+		number = strtol(columnStart, &numberEnd, 10);
+		if (numberEnd != columnStart && *numberEnd == ':')
+			generatedColumn = (int)number;
+		break;
+	}
+
+	if (!pathEnd || generatedLine <= 0)
+		return;
+
+	std::string generatedFilename = line.substr(0, pathEnd);
+	const SourceMap* sourceMap = loadSourceMap(generatedFilename.c_str());
+	if (!sourceMap)
+		return;
+
+	// The last entry which starts at or before the diagnostic's position generated it
+	const std::vector<SourceMapEntry>& entries = sourceMap->entries;
+	SourceMapEntry position = {generatedLine, generatedColumn ? generatedColumn : 1, 0, 0, 0};
+	std::vector<SourceMapEntry>::const_iterator entryIt = std::upper_bound(
+	    entries.begin(), entries.end(), position,
+	    [](const SourceMapEntry& a, const SourceMapEntry& b) {
+		    return a.generatedLine < b.generatedLine ||
+		           (a.generatedLine == b.generatedLine && a.generatedColumn < b.generatedColumn);
+	    });
+	if (entryIt == entries.begin())
+		return;
+	--entryIt;
+
+	char note[MAX_PATH_LENGTH * 2] = {0};
+	PrintfBuffer(note, "%s:%d:%d: note: %s:%d:%d was generated from here\n",
+	             sourceMap->sources[entryIt->sourceIndex].c_str(), entryIt->sourceLine,
+	             entryIt->sourceColumn, generatedFilename.c_str(), generatedLine,
+	             generatedColumn ? generatedColumn : 1);
+	// Compilers often report several things at the same position
+	if (notesOut.find(note) == std::string::npos)
+		notesOut.append(note);
+}
+
+void printCakelispLocationsForCompilerOutput(const char* compilerOutput)
+{
+	// Output arrives in arbitrarily-sized pieces, so hold on to any incomplete line
+	static std::string s_incompleteLine;
+	// The compiler output has already been printed, so wait until it ends on a full line before
+	// adding our notes, otherwise they would be printed in the middle of the compiler's line
+	static std::string s_pendingNotes;
+	s_incompleteLine.append(compilerOutput);
+
+	size_t lineStart = 0;
+	for (size_t lineEnd = s_incompleteLine.find('\n'); lineEnd != std::string::npos;
+	     lineEnd = s_incompleteLine.find('\n', lineStart))
+	{
+		noteCakelispLocationForDiagnostic(s_incompleteLine.substr(lineStart, lineEnd - lineStart),
+		                                  s_pendingNotes);
+		lineStart = lineEnd + 1;
+	}
+	s_incompleteLine.erase(0, lineStart);
+
+	if (s_incompleteLine.empty() && !s_pendingNotes.empty())
+	{
+		Logf("%s", s_pendingNotes.c_str());
+		s_pendingNotes.clear();
+	}
+}
+
 bool writeOutputs(const NameStyleSettings& nameSettings, const WriterFormatSettings& formatSettings,
                   const WriterOutputSettings& outputSettings, const GeneratorOutput& outputToWrite)
 {
@@ -347,22 +694,24 @@ bool writeOutputs(const NameStyleSettings& nameSettings, const WriterFormatSetti
 		StringOutputState outputState;
 		// To determine if anything was actually written
 		StringOutputState stateBeforeOutputWrite;
-		char tempFilename[MAX_PATH_LENGTH];
-	} outputs[] = {{/*isHeader=*/false, outputSettings.sourceOutputName, {}, {}, {0}},
+		std::string buffer;
+		std::vector<WriterMapMark> mapMarks;
+	} outputs[] = {{/*isHeader=*/false, outputSettings.sourceOutputName, {}, {}, {}, {}},
 	               {
 	                   /*isHeader=*/true,
 	                   outputSettings.headerOutputName,
 	                   {},
 	                   {},
-	                   {0},
+	                   {},
+	                   {},
 	               }};
 
 	for (int i = 0; i < static_cast<int>(ArraySize(outputs)); ++i)
 	{
-		// Write to a temporary file
-		PrintfBuffer(outputs[i].tempFilename, "%s.temp", outputs[i].outputFilename);
-		// TODO: If this fails to open, Writer_Writef just won't write to the file, it'll print
-		outputs[i].outputState.fileOut = fileOpen(outputs[i].tempFilename, "w");
+		outputs[i].outputState.bufferOut = &outputs[i].buffer;
+		// Headers aren't given to the compiler directly, so only sources get source maps
+		if (!outputs[i].isHeader)
+			outputs[i].outputState.mapMarksOut = &outputs[i].mapMarks;
 
 		if (outputSettings.heading)
 		{
@@ -373,17 +722,6 @@ bool writeOutputs(const NameStyleSettings& nameSettings, const WriterFormatSetti
 			                                   outputs[i].isHeader);
 		}
 
-		// if (outputs[i].heading)
-		// {
-		// 	Writer_Writef(outputs[i].outputState, outputs[i].heading);
-		// 	// TODO: Put this in Writer_Writef
-		// 	for (const char* c = outputs[i].heading; *c != '\0'; ++c)
-		// 	{
-		// 		if (*c == '\n')
-		// 			++outputs[i].outputState.currentLine;
-		// 	}
-		// }
-
 		outputs[i].stateBeforeOutputWrite = outputs[i].outputState;
 	}
 
@@ -401,16 +739,7 @@ bool writeOutputs(const NameStyleSettings& nameSettings, const WriterFormatSetti
 		    outputs[i].stateBeforeOutputWrite.numCharsOutput)
 		{
 			if (logging.fileSystem)
-				Logf("%s had no meaningful output\n", outputs[i].tempFilename);
-
-			fclose(outputs[i].outputState.fileOut);
-			outputs[i].outputState.fileOut = nullptr;
-
-			if (remove(outputs[i].tempFilename) != 0)
-			{
-				Logf("Error: Failed to remove %s\n", outputs[i].tempFilename);
-				return false;
-			}
+				Logf("%s had no meaningful output\n", outputs[i].outputFilename);
 			continue;
 		}
 
@@ -422,24 +751,17 @@ bool writeOutputs(const NameStyleSettings& nameSettings, const WriterFormatSetti
 			    outputs[i].isHeader);
 		}
 
-		// if (outputs[i].footer)
-		// {
-		// 	Writer_Writef(outputs[i].outputState, outputs[i].footer);
-		// 	// TODO: Put this in Writer_Writef
-		// 	for (const char* c = outputs[i].footer; *c != '\0'; ++c)
-		// 	{
-		// 		if (*c == '\n')
-		// 			++outputs[i].outputState.currentLine;
-		// 	}
-		// }
-
-		if (outputs[i].outputState.fileOut)
+		bool writeToFile = outputs[i].isHeader || !outputSettings.sourceContentsOut;
+		if (writeToFile)
 		{
-			fclose(outputs[i].outputState.fileOut);
-			outputs[i].outputState.fileOut = nullptr;
+			if (!writeIfContentsNewer(outputs[i].buffer, outputs[i].outputFilename))
+				return false;
 		}
+		else
+			*outputSettings.sourceContentsOut = outputs[i].buffer;
 
-		if (!writeIfContentsNewer(outputs[i].tempFilename, outputs[i].outputFilename))
+		if (!outputs[i].isHeader &&
+		    !writeSourceMap(outputs[i].buffer, outputs[i].mapMarks, outputs[i].outputFilename))
 			return false;
 	}
 
@@ -454,7 +776,7 @@ bool writeGeneratorOutput(const GeneratorOutput& generatedOutput,
 	if (!writeOutputs(nameSettings, formatSettings, outputSettings, generatedOutput))
 		return false;
 
-	// TODO: Write mapping and metadata
+	// TODO: Write metadata
 	if (logging.metadata)
 	{
 		// Metadata
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #include "ConverterEnums.hpp"
 #include "EvaluatorEnums.hpp"
 #include "WriterEnums.hpp"
@@ -29,11 +31,24 @@ struct WriterOutputSettings
 	// Note that these cover both the source and header heading and footer
 	const GeneratorOutput* heading;
 	const GeneratorOutput* footer;
+
+	// If set, the source is output here instead of to sourceOutputName, e.g. to be piped to the
+	// compiler. Compiler output referring to sourceOutputName still gets Cakelisp locations
+	std::string* sourceContentsOut;
 };
 
 const char* importLanguageToString(ImportLanguage type);
 
+// Compare the contents against what is already on disk, and only write if it differs. Not touching
+// identical files keeps their modification times stable, which is what lets the build system skip
+// recompiling them
+bool writeIfContentsNewer(const std::string& contents, const char* outputFilename);
+
 bool writeGeneratorOutput(const GeneratorOutput& generatedOutput,
                           const NameStyleSettings& nameSettings,
                           const WriterFormatSettings& formatSettings,
                           const WriterOutputSettings& outputSettings);
+
+// Reads compiler output and, for each diagnostic which refers to generated code, prints the
+// Cakelisp location which generated it. Output may be passed in pieces
+void printCakelispLocationsForCompilerOutput(const char* compilerOutput);
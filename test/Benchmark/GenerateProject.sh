@@ -0,0 +1,153 @@
+#!/bin/sh
+
+# Generate a synthetic Cakelisp project for measuring how Cakelisp scales. See Benchmark.sh
+#
+# Usage: GenerateProject.sh [options] <output directory>
+#   -n <count>  Modules (default 10)
+#   -m <count>  Functions per module (default 10)
+#   -k <count>  Macros per module (default 2)
+#   -d <depth>  How deeply macro invocations are nested in each function (default 4)
+#   -c <count>  Compile-time functions per module, called by the module's macros (default 1)
+#   -f <count>  How many later modules each module imports (header fan-out) (default 2)
+#
+# Each module has an edit point, a line ending in ";; edit-point", which Benchmark.sh changes to
+# simulate a single file being modified
+
+NUM_MODULES=10
+NUM_FUNCTIONS=10
+NUM_MACROS=2
+NESTING_DEPTH=4
+NUM_COMPTIME_FUNCTIONS=1
+FAN_OUT=2
+
+while getopts "n:m:k:d:c:f:" option; do
+	case $option in
+		n) NUM_MODULES=$OPTARG ;;
+		m) NUM_FUNCTIONS=$OPTARG ;;
+		k) NUM_MACROS=$OPTARG ;;
+		d) NESTING_DEPTH=$OPTARG ;;
+		c) NUM_COMPTIME_FUNCTIONS=$OPTARG ;;
+		f) FAN_OUT=$OPTARG ;;
+		*) echo "Unrecognized option. See the top of $0 for usage"; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+OUTPUT_DIR=$1
+if test -z "$OUTPUT_DIR"; then
+	echo "Expected output directory. See the top of $0 for usage"
+	exit 1
+fi
+
+# Macros call into Cakelisp, so compile-time code needs to find its headers
+CAKELISP_SRC_DIR=$(cd "$(dirname "$0")/../../src" && pwd)
+
+mkdir -p "$OUTPUT_DIR" || exit $?
+
+# Nest invocations of the module's macros (or plain additions without macros) depth times
+nested_expression() {
+	module=$1
+	depth=$2
+	expression="x"
+	level=0
+	while test $level -lt "$depth"; do
+		if test "$NUM_MACROS" -gt 0; then
+			expression="(bench-add-$module-$((level % NUM_MACROS)) $expression)"
+		else
+			expression="(+ $expression 1)"
+		fi
+		level=$((level + 1))
+	done
+	echo "$expression"
+}
+
+module=0
+while test $module -lt "$NUM_MODULES"; do
+	{
+		echo ";; Generated by GenerateProject.sh. Do not edit"
+		echo "(c-import \"<stdio.h>\")"
+
+		import=$((module + 1))
+		while test $import -le $((module + FAN_OUT)) && test $import -lt "$NUM_MODULES"; do
+			echo "(import \"Module$import.cake\")"
+			import=$((import + 1))
+		done
+		echo
+
+		comptime=0
+		while test $comptime -lt "$NUM_COMPTIME_FUNCTIONS"; do
+			echo "(defun-comptime bench-comptime-$module-$comptime (value int &return int)"
+			echo "  (return (+ value $comptime)))"
+			comptime=$((comptime + 1))
+		done
+		echo
+
+		macro=0
+		while test $macro -lt "$NUM_MACROS"; do
+			echo "(defmacro bench-add-$module-$macro (value any)"
+			echo "  (var total int 0)"
+			comptime=0
+			while test $comptime -lt "$NUM_COMPTIME_FUNCTIONS"; do
+				echo "  (set total (bench-comptime-$module-$comptime total))"
+				comptime=$((comptime + 1))
+			done
+			echo "  (when (< total 0)"
+			echo "    (return false))"
+			echo "  (tokenize-push output (+ (token-splice value) $macro))"
+			echo "  (return true))"
+			echo
+			macro=$((macro + 1))
+		done
+
+		function=0
+		while test $function -lt "$NUM_FUNCTIONS"; do
+			echo "(defun bench-function-$module-$function (&return int)"
+			echo "  (var x int $function)"
+			echo "  (set x $(nested_expression $module "$NESTING_DEPTH"))"
+			# Call into imported modules so their headers are actually needed
+			if test $function -eq 0; then
+				import=$((module + 1))
+				while test $import -le $((module + FAN_OUT)) && test $import -lt "$NUM_MODULES"; do
+					echo "  (set x (+ x (bench-function-$import-0)))"
+					import=$((import + 1))
+				done
+			fi
+			echo "  (return x))"
+			echo
+			function=$((function + 1))
+		done
+
+		echo "(defun bench-edit-point-$module (&return int)"
+		echo "  (return 0)) ;; edit-point"
+	} > "$OUTPUT_DIR/Module$module.cake"
+	module=$((module + 1))
+done
+
+{
+	echo ";; Generated by GenerateProject.sh. Do not edit"
+	echo "(set-cakelisp-option cakelisp-src-dir \"$CAKELISP_SRC_DIR\")"
+	echo "(c-import \"<stdio.h>\")"
+	module=0
+	while test $module -lt "$NUM_MODULES"; do
+		echo "(import \"Module$module.cake\")"
+		module=$((module + 1))
+	done
+	echo
+	echo "(defun main (&return int)"
+	echo "  (var total int 0)"
+	module=0
+	while test $module -lt "$NUM_MODULES"; do
+		function=0
+		while test $function -lt "$NUM_FUNCTIONS"; do
+			echo "  (set total (+ total (bench-function-$module-$function)))"
+			function=$((function + 1))
+		done
+		echo "  (set total (+ total (bench-edit-point-$module)))"
+		module=$((module + 1))
+	done
+	# printf so the shell's echo doesn't interpret the \n
+	printf '  (printf "%%d\\n" total)\n'
+	echo "  (return 0))"
+} > "$OUTPUT_DIR/Main.cake"
+
+echo "Generated $NUM_MODULES modules in $OUTPUT_DIR"